@@ -16,6 +16,7 @@
 
 #include <pcp-cpp/atom.hpp>
 #include <pcp-cpp/cache.hpp>
+#include <pcp-cpp/cached_instance_domain.hpp>
 #include <pcp-cpp/pmda.hpp>
 #include <pcp-cpp/units.hpp>
 
@@ -63,7 +64,7 @@ public:
 
 protected:
     pcp::instance_domain color_domain;
-    pcp::instance_domain now_domain;
+    pcp::cached_instance_domain now_domain;
     uint32_t numfetch;
     uint8_t rgb[3];
 
@@ -77,7 +78,8 @@ protected:
         return pcp::metrics_description()
         (0)
             (0, "numfetch", pcp::type<uint32_t>(), PM_SEM_INSTANT,
-             pcp::units(0,0,0, 0,0,0), pcp::storable_metric)
+             pcp::units(0,0,0, 0,0,0), pcp::bind_to(&numfetch),
+             pcp::storable_metric)
             (1, "color", pcp::type<int32_t>(), PM_SEM_INSTANT,
              pcp::units(0,0,0, 0,0,0), &color_domain, pcp::storable_metric)
         (1, "time")
@@ -118,10 +120,7 @@ protected:
             return pcp::atom(metric.type, tsp->tm_field);
         }
 
-        // simple.numfetch    SIMPLE:0:0
-        if (metric.item == 0) {
-            return pcp::atom(metric.type, numfetch);
-        }
+        // simple.numfetch    SIMPLE:0:0 is bound directly to numfetch.
 
         // simple.color       SIMPLE:0:1
         rgb[metric.instance] = (rgb[metric.instance] + 1) % 256;
@@ -175,7 +174,6 @@ private:
             if (statbuf.st_mtim.tv_sec != file_change.st_mtim.tv_sec ||
                     statbuf.st_mtim.tv_nsec != file_change.st_mtim.tv_nsec) {
 #endif
-                timenow_clear();
                 timenow_init();
                 file_change = statbuf;
             }
@@ -184,7 +182,7 @@ private:
 
     void timenow_clear()
     {
-        pcp::cache::perform(now_domain, PMDA_CACHE_INACTIVE);
+        now_domain.inactivate_all();
 #ifdef DESPERATE
         __pmdaCacheDump(stderr, now_domain, 1);
 #endif
@@ -199,12 +197,15 @@ private:
         std::ifstream file(config_filename.c_str());
         if (!file.is_open()) {
             pmNotifyErr(LOG_ERR, "failed to open %s", config_filename.c_str());
+            timenow_clear();
             return;
         }
 
         std::string line;
+        std::map<std::string, void *> instances;
         if (!std::getline(file, line)) {
             pmNotifyErr(LOG_ERR, "failed to read from %s", config_filename.c_str());
+            timenow_clear();
             return;
         }
 
@@ -219,9 +220,7 @@ private:
                 size_t index;
                 for (index = 0; index < num_timeslices; ++index) {
                     if (name == timeslices[index].tm_name) {
-                        const pcp::instance_id_type instance_id =
-                            pcp::cache::store(now_domain, name, &timeslices[index]);
-                        now_domain(instance_id, name);
+                        instances[name] = &timeslices[index];
                         break;
                     }
                 }
@@ -231,6 +230,7 @@ private:
                 }
             }
         }
+        now_domain.sync(instances.begin(), instances.end());
 #ifdef DESPERATE
         __pmdaCacheDump(stderr, now_domain, 1);
 #endif
@@ -83,6 +83,29 @@ protected:
             metric.type, cpu_info.at(metric.item).ticks.at(metric.instance));
     }
 
+    virtual bool supports_fetch_values() const
+    {
+        return true;
+    }
+
+    virtual void fetch_values(const std::vector<metric_values> &metrics)
+    {
+        // Each metric's instances index a row of ticks, so convert whole rows
+        // at a time, rather than calling fetch_value for every instance.
+        // Rows missing from /proc/stat (such as CPUs since taken offline)
+        // just have no values, rather than failing the whole fetch.
+        for (std::vector<metric_values>::const_iterator iter = metrics.begin();
+             iter != metrics.end(); ++iter)
+        {
+            if (iter->item >= cpu_info.size()) {
+                iter->assign(static_cast<const uint64_t *>(NULL), 0);
+                continue;
+            }
+            const std::vector<uint64_t> &ticks = cpu_info[iter->item].ticks;
+            iter->assign(ticks.empty() ? NULL : &ticks[0], ticks.size());
+        }
+    }
+
     void load_cpu_ticks()
     {
         cpu_info.clear();
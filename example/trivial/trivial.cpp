@@ -14,10 +14,13 @@
  */
 
 #include <pcp-cpp/atom.hpp>
-#include <pcp-cpp/pmda.hpp>
+#include <pcp-cpp/basic_pmda.hpp>
 #include <pcp-cpp/units.hpp>
 
-class trivial : public pcp::pmda {
+class trivial : public pcp::basic_pmda<trivial> {
+
+    // Allow basic_pmda to call fetch_value directly (without virtual dispatch).
+    friend class pcp::basic_pmda<trivial>;
 
 public:
 
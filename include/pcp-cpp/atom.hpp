@@ -13,6 +13,7 @@
 
 #include "config.hpp"
 #include "exception.hpp"
+#include "string_arena.hpp"
 #include "types.hpp"
 
 PCP_CPP_BEGIN_NAMESPACE
@@ -125,6 +126,214 @@ inline pmAtomValue atom<pmValueBlock *>(const atom_type_type type, pmValueBlock
     return atom;
 }
 
+/**
+ * @brief Compile-time pmAtomValue member selection for PM_TYPE_* constants.
+ *
+ * Each specialisation's \c set function stores a value in the pmAtomValue
+ * member appropriate to \a Type.  There is no definition for unsupported
+ * types, so using them fails to compile.
+ *
+ * @tparam Type PM_TYPE_* constant.
+ *
+ * @see atom<Type>(const ValueType)
+ */
+template <int Type> struct atom_traits;
+
+/// @cond internal
+#define PCP_CPP_ATOM_TRAITS(Type, Member, MemberType) \
+    template <> struct atom_traits<Type> { \
+        template <typename ValueType> \
+        static void set(pmAtomValue &atom, const ValueType value) { \
+            atom.Member = static_cast<MemberType>(value); \
+        } \
+    }
+PCP_CPP_ATOM_TRAITS(PM_TYPE_32,               l,   int32_t);
+PCP_CPP_ATOM_TRAITS(PM_TYPE_U32,              ul,  uint32_t);
+PCP_CPP_ATOM_TRAITS(PM_TYPE_64,               ll,  int64_t);
+PCP_CPP_ATOM_TRAITS(PM_TYPE_U64,              ull, uint64_t);
+PCP_CPP_ATOM_TRAITS(PM_TYPE_FLOAT,            f,   float);
+PCP_CPP_ATOM_TRAITS(PM_TYPE_DOUBLE,           d,   double);
+PCP_CPP_ATOM_TRAITS(PM_TYPE_STRING,           cp,  char *);
+PCP_CPP_ATOM_TRAITS(PM_TYPE_AGGREGATE,        vbp, pmValueBlock *);
+PCP_CPP_ATOM_TRAITS(PM_TYPE_AGGREGATE_STATIC, vbp, pmValueBlock *);
+PCP_CPP_ATOM_TRAITS(PM_TYPE_EVENT,            vbp, pmValueBlock *);
+#ifdef PM_TYPE_HIGHRES_EVENT // PM_TYPE_HIGHRES_EVENT added in PCP 3.9.10.
+PCP_CPP_ATOM_TRAITS(PM_TYPE_HIGHRES_EVENT,    vbp, pmValueBlock *);
+#endif
+#undef PCP_CPP_ATOM_TRAITS
+/// @endcond
+
+/**
+ * @brief Caset a value to a PCP pmAtomValue, of a compile-time atom type.
+ *
+ * Unlike atom(const atom_type_type, ValueType), the atom type is fixed at
+ * compile time, so there is no runtime type switch, nor any possibility of a
+ * PM_ERR_TYPE exception; the conversion inlines to a single store, and
+ * unsupported conversions (such as a `double` to `PM_TYPE_STRING`) fail to
+ * compile.  For example:
+ * @code
+ * return pcp::atom<PM_TYPE_U64>(bytes_read);
+ * @endcode
+ *
+ * @tparam Type      PM_TYPE_* constant to convert \a value to.
+ * @tparam ValueType Type of value to set.
+ *
+ * @param value The atom value to set.
+ *
+ * @return A `pmAtomValue` containing \c value of type \c Type.
+ */
+template <int Type, typename ValueType>
+inline pmAtomValue atom(const ValueType value)
+{
+    pmAtomValue atom;
+    atom_traits<Type>::set(atom, value);
+    return atom;
+}
+
+/// @cond internal
+namespace detail {
+
+template <int Type, typename ValueType>
+inline void convert_atoms(const ValueType * const values, const size_t count,
+                          pmAtomValue * const atoms)
+{
+    // A simple indexed loop, with the type resolved, that compilers can unroll
+    // and vectorise.
+    for (size_t index = 0; index < count; ++index) {
+        atom_traits<Type>::set(atoms[index], values[index]);
+    }
+}
+
+template <int Type, typename ValueType>
+inline void convert_atoms(const ValueType * const values, const instance_id_type * const indexes,
+                          const size_t count, pmAtomValue * const atoms)
+{
+    for (size_t index = 0; index < count; ++index) {
+        atom_traits<Type>::set(atoms[index], values[indexes[index]]);
+    }
+}
+
+} // detail namespace.
+/// @endcond
+
+/**
+ * @brief Caset an array of values to PCP pmAtomValues.
+ *
+ * This is the bulk equivalent of atom(const atom_type_type, ValueType), with
+ * the atom type checked once for the whole array, rather than once per value.
+ * Only numeric value types are supported.
+ *
+ * @param type   The atom type to set.
+ * @param values Values to convert.
+ * @param count  Number of \a values to convert.
+ * @param atoms  Array of at least \a count atoms to set.
+ *
+ * @tparam ValueType Type of values to set.
+ *
+ * @throw pcp::exception If \a ValueType cannot be converted to \a type.
+ */
+template <typename ValueType>
+void atoms(const atom_type_type type, const ValueType * const values,
+           const size_t count, pmAtomValue * const atoms)
+{
+    switch (type) {
+        case PM_TYPE_32:     detail::convert_atoms<PM_TYPE_32    >(values, count, atoms); break;
+        case PM_TYPE_U32:    detail::convert_atoms<PM_TYPE_U32   >(values, count, atoms); break;
+        case PM_TYPE_64:     detail::convert_atoms<PM_TYPE_64    >(values, count, atoms); break;
+        case PM_TYPE_U64:    detail::convert_atoms<PM_TYPE_U64   >(values, count, atoms); break;
+        case PM_TYPE_FLOAT:  detail::convert_atoms<PM_TYPE_FLOAT >(values, count, atoms); break;
+        case PM_TYPE_DOUBLE: detail::convert_atoms<PM_TYPE_DOUBLE>(values, count, atoms); break;
+        default:
+            throw pcp::exception(PM_ERR_TYPE);
+    }
+}
+
+/**
+ * @brief Caset selected elements of an array of values to PCP pmAtomValues.
+ *
+ * Sets \c atoms[i] to \c values[indexes[i]] for each \c i less than
+ * \a count, such as when converting only those instances of a metric
+ * selected by a client's profile.
+ *
+ * @param type    The atom type to set.
+ * @param values  Values to convert.
+ * @param indexes Indexes of the \a values to convert.
+ * @param count   Number of \a indexes.
+ * @param atoms   Array of at least \a count atoms to set.
+ *
+ * @tparam ValueType Type of values to set.
+ *
+ * @throw pcp::exception If \a ValueType cannot be converted to \a type.
+ */
+template <typename ValueType>
+void atoms(const atom_type_type type, const ValueType * const values,
+           const instance_id_type * const indexes, const size_t count,
+           pmAtomValue * const atoms)
+{
+    switch (type) {
+        case PM_TYPE_32:     detail::convert_atoms<PM_TYPE_32    >(values, indexes, count, atoms); break;
+        case PM_TYPE_U32:    detail::convert_atoms<PM_TYPE_U32   >(values, indexes, count, atoms); break;
+        case PM_TYPE_64:     detail::convert_atoms<PM_TYPE_64    >(values, indexes, count, atoms); break;
+        case PM_TYPE_U64:    detail::convert_atoms<PM_TYPE_U64   >(values, indexes, count, atoms); break;
+        case PM_TYPE_FLOAT:  detail::convert_atoms<PM_TYPE_FLOAT >(values, indexes, count, atoms); break;
+        case PM_TYPE_DOUBLE: detail::convert_atoms<PM_TYPE_DOUBLE>(values, indexes, count, atoms); break;
+        default:
+            throw pcp::exception(PM_ERR_TYPE);
+    }
+}
+
+/**
+ * @brief Caset a string to a PCP pmAtomValue, via a string arena.
+ *
+ * The string is copied into \a arena, so the resulting atom remains valid
+ * until \a arena is next reset.  When returned from pcp::pmda::fetch_value,
+ * using the PMDA's own arena, the default PMDA_FETCH_STATIC code is correct.
+ *
+ * @param type  The atom type to set; must be PM_TYPE_STRING.
+ * @param value The atom value to set.
+ * @param arena The arena to copy \a value into.
+ *
+ * @return A `pmAtomValue` containing \c value of type \c type.
+ *
+ * @see pcp::pmda::get_string_arena
+ */
+inline pmAtomValue atom(const atom_type_type type, const std::string &value,
+                        string_arena &arena)
+{
+    if (type != PM_TYPE_STRING) {
+        throw pcp::exception(PM_ERR_TYPE);
+    }
+    pmAtomValue atom;
+    atom.cp = arena.store(value);
+    return atom;
+}
+
+#if __cplusplus >= 201703L
+/**
+ * @brief Caset a string to a PCP pmAtomValue, via a string arena.
+ *
+ * @note This function is only available when building with C++17 or later.
+ *
+ * @param type  The atom type to set; must be PM_TYPE_STRING.
+ * @param value The atom value to set.
+ * @param arena The arena to copy \a value into.
+ *
+ * @return A `pmAtomValue` containing \c value of type \c type.
+ *
+ * @see atom(const atom_type_type, const std::string &, string_arena &)
+ */
+inline pmAtomValue atom(const atom_type_type type, const std::string_view value,
+                        string_arena &arena)
+{
+    if (type != PM_TYPE_STRING) {
+        throw pcp::exception(PM_ERR_TYPE);
+    }
+    pmAtomValue atom;
+    atom.cp = arena.store(value);
+    return atom;
+}
+#endif
+
 } // pcp namespace.
 
 PCP_CPP_END_NAMESPACE
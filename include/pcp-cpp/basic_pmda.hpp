@@ -0,0 +1,120 @@
+//            Copyright Paul Colby 2013 - 2018.
+// Distributed under the Boost Software License, Version 1.0.
+//       (See accompanying file LICENSE.md or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+/**
+ * @file
+ * @brief Defines the pcp::basic_pmda class template.
+ */
+
+#ifndef __PCP_CPP_BASIC_PMDA_HPP__
+#define __PCP_CPP_BASIC_PMDA_HPP__
+
+#include "config.hpp"
+#include "pmda.hpp"
+
+PCP_CPP_BEGIN_NAMESPACE
+
+namespace pcp {
+
+/**
+ * @brief Base class for PMDAs with statically dispatched fetch callbacks.
+ *
+ * This class template is a drop-in alternative to deriving from pcp::pmda
+ * directly, using the Curiously Recurring Template Pattern (CRTP).  Agents
+ * derive from `pcp::basic_pmda<Agent>`, and then libpcp's fetch callback is
+ * routed directly to `Agent::on_fetch_callback` and `Agent::fetch_value`,
+ * rather than through virtual function calls.  This allows the compiler to
+ * inline the entire per-value fetch path.  For example:
+ * @code
+ * class trivial : public pcp::basic_pmda<trivial> {
+ *     friend class pcp::basic_pmda<trivial>;
+ *     ...
+ * protected:
+ *     virtual fetch_value_result fetch_value(const metric_id &metric)
+ *     {
+ *         ...
+ *     }
+ * };
+ * @endcode
+ *
+ * All other callbacks, and extension points, behave exactly as for pcp::pmda.
+ *
+ * @note Since the agent's own fetch_value (and on_fetch_callback, if
+ *       overridden) are called directly, agents that declare those functions
+ *       protected or private must befriend `pcp::basic_pmda<Agent>`, as above.
+ *       Agents must also not be further derived from, since any overrides in
+ *       classes derived from \a Agent would be bypassed.
+ *
+ * @tparam Agent The class deriving from this one.
+ */
+template <typename Agent>
+class basic_pmda : public pmda {
+
+protected:
+
+    /**
+     * @brief Fetch the value of a single metric instance.
+     *
+     * This override calls Agent::fetch_value directly.
+     *
+     * @param mdesc The metric to fetch.
+     * @param inst  The instance to fetch.
+     * @param avp   The atom to fetch the value into.
+     *
+     * @return A PMDA fetch callback result, as per pmda::on_fetch_callback.
+     */
+    virtual int on_fetch_callback(pmdaMetric *mdesc, unsigned int inst,
+                                  pmAtomValue *avp)
+    {
+        return fetch_callback<&basic_pmda::dispatch_fetch_value>(mdesc, inst, avp);
+    }
+
+    /**
+     * @brief Fetch a batch of metric values.
+     *
+     * This override calls Agent::fetch_value directly for each value.
+     *
+     * @param metrics The metrics to fetch the values of.
+     *
+     * @see pmda::fetch_values
+     */
+    virtual void fetch_values(const std::vector<metric_values> &metrics)
+    {
+        fetch_each_value<&basic_pmda::dispatch_fetch_value>(metrics);
+    }
+
+    /**
+     * @brief Set static callbacks on a PMDA interface.
+     *
+     * This override sets the same callbacks as pmda::set_callbacks, except for
+     * the fetch callback, which is statically dispatched to \a Agent.
+     *
+     * @param interface The interface to set our callbacks on.
+     */
+    virtual void set_callbacks(pmdaInterface &interface)
+    {
+        pmda::set_callbacks(interface);
+        pmdaSetFetchCallBack(&interface, &callback_fetch_callback);
+    }
+
+private:
+
+    static fetch_value_result dispatch_fetch_value(pmda &agent, const metric_id &metric)
+    {
+        return static_cast<Agent &>(agent).Agent::fetch_value(metric);
+    }
+
+    static int callback_fetch_callback(pmdaMetric *mdesc, unsigned int inst, pmAtomValue *avp)
+    {
+        return static_cast<Agent *>(get_fetch_callback_instance())->Agent::on_fetch_callback(mdesc, inst, avp);
+    }
+
+};
+
+} // pcp namespace.
+
+PCP_CPP_END_NAMESPACE
+
+#endif
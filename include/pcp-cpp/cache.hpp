@@ -15,7 +15,11 @@
 #include "exception.hpp"
 #include "types.hpp"
 
+#include <algorithm>
+#include <cstring>
 #include <sstream>
+#include <string>
+#include <vector>
 
 PCP_CPP_BEGIN_NAMESPACE
 
@@ -61,6 +65,230 @@ struct lookup_result_type {
     int status;                   ///< Entry status, such as PMDA_CACHE_ACTIVE.
 };
 
+/**
+ * @brief Non-owning reference to a string, such as a slice of a larger buffer.
+ *
+ * The pcp::cache functions taking string_ref arguments avoid constructing a
+ * temporary std::string per call.  Keys are passed through to libpcp_pmda
+ * as-is, while names (which libpcp_pmda requires to be null-terminated) are
+ * copied to the stack, unless longer than 255 characters.
+ *
+ * Note, string_ref has no implicit conversions, so that its overloads do
+ * not compete with those taking std::string arguments.
+ */
+struct string_ref {
+    /**
+     * @brief Constructor.
+     *
+     * @param data First character of the string; need not be null-terminated.
+     * @param size Number of characters in the string.
+     */
+    string_ref(const char * const data, const size_t size)
+        : data(data), size(size)
+    {
+
+    }
+
+    const char * data; ///< First character of the string.
+    size_t size;       ///< Number of characters in the string.
+};
+
+/// @cond internal
+namespace detail {
+
+// Null-terminated copy of a string_ref, on the stack where possible.  Names
+// that are already null-terminated are referenced as-is, so generic code can
+// use this for every kind of instance name.
+class terminated_string {
+
+public:
+    explicit terminated_string(const std::string &name) : str(name.c_str())
+    {
+
+    }
+
+    explicit terminated_string(const char * const name) : str(name)
+    {
+
+    }
+
+    explicit terminated_string(const string_ref &ref)
+    {
+        if (ref.size < sizeof(buffer)) {
+            memcpy(buffer, ref.data, ref.size);
+            buffer[ref.size] = '\0';
+            str = buffer;
+        } else {
+            fallback.assign(ref.data, ref.size);
+            str = fallback.c_str();
+        }
+    }
+
+    const char * c_str() const
+    {
+        return str;
+    }
+
+private:
+    char buffer[256];
+    std::string fallback;
+    const char * str;
+
+    terminated_string(const terminated_string &);
+    terminated_string &operator=(const terminated_string &);
+};
+
+} // detail namespace.
+/// @endcond
+
+/**
+ * @brief Lookup a cache entry, by instance ID, without throwing.
+ *
+ * Unlike lookup, this function does not throw on errors (including missing
+ * cache entries), nor format any messages, so suits agents that probe the
+ * cache for entries that are often missing.
+ *
+ * @tparam Type        Type to cast opaque pointers to.
+ *
+ * @param  indom       Instance domain to lookup.
+ * @param  instance_id Instance ID to lookup.
+ *
+ * @return A struct containing the found cache entry details, if any.  The
+ *         struct's \a status is negative (such as PM_ERR_INST) if no cache
+ *         entry was found, in which case its other members are not valid.
+ *
+ * @see lookup
+ * @see pmdaCacheLookup
+ */
+template <typename Type>
+lookup_result_type<Type> try_lookup(const pmInDom indom,
+                                    const instance_id_type instance_id)
+{
+    lookup_result_type<Type> result;
+    void * opaque = NULL;
+    result.name = NULL;
+    result.instance_id = instance_id;
+    result.status = pmdaCacheLookup(indom, instance_id, &result.name, &opaque);
+    result.opaque = static_cast<Type>(opaque);
+    return result;
+}
+
+/**
+ * @brief Lookup a cache entry, by instance name, without throwing.
+ *
+ * @tparam Type        Type to cast opaque pointers to.
+ *
+ * @param  indom       Instance domain to lookup.
+ * @param  name        Instance name to lookup.
+ *
+ * @return A struct containing the found cache entry details, if any.  The
+ *         struct's \a status is negative (such as PM_ERR_INST) if no cache
+ *         entry was found, in which case its other members are not valid.
+ *
+ * @see try_lookup(const pmInDom, const instance_id_type)
+ * @see pmdaCacheLookupName
+ */
+template <typename Type>
+lookup_result_type<Type> try_lookup(const pmInDom indom, const std::string &name)
+{
+    lookup_result_type<Type> result;
+    void * opaque = NULL;
+    int instance_id = static_cast<int>(PM_IN_NULL);
+    result.name = NULL;
+    result.status = pmdaCacheLookupName(indom, name.c_str(), &instance_id, &opaque);
+    result.instance_id = instance_id;
+    result.opaque = static_cast<Type>(opaque);
+    return result;
+}
+
+/**
+ * @brief Lookup a cache entry, by instance name and key, without throwing.
+ *
+ * @tparam Type        Type to cast opaque pointers to.
+ *
+ * @param  indom       Instance domain to lookup.
+ * @param  name        Instance name to lookup.
+ * @param  key         Instance key to lookup.
+ *
+ * @return A struct containing the found cache entry details, if any.  The
+ *         struct's \a status is negative (such as PM_ERR_INST) if no cache
+ *         entry was found, in which case its other members are not valid.
+ *
+ * @see try_lookup(const pmInDom, const instance_id_type)
+ * @see pmdaCacheLookupKey
+ */
+template <typename Type>
+lookup_result_type<Type> try_lookup(const pmInDom indom, const std::string &name,
+                                    const std::string &key)
+{
+    lookup_result_type<Type> result;
+    void * opaque = NULL;
+    int instance_id = static_cast<int>(PM_IN_NULL);
+    result.name = NULL;
+    result.status = pmdaCacheLookupKey(indom, name.c_str(), key.size(),
+                                       key.c_str(), &result.name,
+                                       &instance_id, &opaque);
+    result.instance_id = instance_id;
+    result.opaque = static_cast<Type>(opaque);
+    return result;
+}
+
+/**
+ * @brief Lookup a cache entry, by instance name, without throwing or allocating.
+ *
+ * @tparam Type        Type to cast opaque pointers to.
+ *
+ * @param  indom       Instance domain to lookup.
+ * @param  name        Instance name to lookup.
+ *
+ * @return A struct containing the found cache entry details, if any.
+ *
+ * @see try_lookup(const pmInDom, const std::string &)
+ */
+template <typename Type>
+lookup_result_type<Type> try_lookup(const pmInDom indom, const string_ref &name)
+{
+    const detail::terminated_string terminated_name(name);
+    lookup_result_type<Type> result;
+    void * opaque = NULL;
+    int instance_id = static_cast<int>(PM_IN_NULL);
+    result.name = NULL;
+    result.status = pmdaCacheLookupName(indom, terminated_name.c_str(), &instance_id, &opaque);
+    result.instance_id = instance_id;
+    result.opaque = static_cast<Type>(opaque);
+    return result;
+}
+
+/**
+ * @brief Lookup a cache entry, by instance name and key, without throwing or
+ *        allocating.
+ *
+ * @tparam Type        Type to cast opaque pointers to.
+ *
+ * @param  indom       Instance domain to lookup.
+ * @param  name        Instance name to lookup.
+ * @param  key         Instance key to lookup.
+ *
+ * @return A struct containing the found cache entry details, if any.
+ *
+ * @see try_lookup(const pmInDom, const std::string &, const std::string &)
+ */
+template <typename Type>
+lookup_result_type<Type> try_lookup(const pmInDom indom, const string_ref &name,
+                                    const string_ref &key)
+{
+    const detail::terminated_string terminated_name(name);
+    lookup_result_type<Type> result;
+    void * opaque = NULL;
+    int instance_id = static_cast<int>(PM_IN_NULL);
+    result.name = NULL;
+    result.status = pmdaCacheLookupKey(indom, terminated_name.c_str(), key.size,
+                                       key.data, &result.name, &instance_id, &opaque);
+    result.instance_id = instance_id;
+    result.opaque = static_cast<Type>(opaque);
+    return result;
+}
+
 /**
  * @brief Lookup a cache entry, by instance ID.
  *
@@ -77,6 +305,7 @@ struct lookup_result_type {
  *
  * @return A struct containing the found cache entry details.
  *
+ * @see try_lookup
  * @see pmdaCacheLookup
  */
 template <typename Type>
@@ -84,10 +313,7 @@ lookup_result_type<Type> lookup(const pmInDom indom,
                                 const instance_id_type instance_id,
                                 const lookup_flags flags = require_active)
 {
-    lookup_result_type<Type> result;
-    void * opaque;
-    result.name = NULL;
-    result.status = pmdaCacheLookup(indom, instance_id, &result.name, &opaque);
+    const lookup_result_type<Type> result = try_lookup<Type>(indom, instance_id);
     if (result.status < 0) {
         throw pcp::exception(result.status);
     }
@@ -102,8 +328,6 @@ lookup_result_type<Type> lookup(const pmInDom indom,
         message << ") inactive";
         throw pcp::exception(result.status, message.str());
     }
-    result.instance_id = instance_id;
-    result.opaque = static_cast<Type>(opaque);
     return result;
 }
 
@@ -123,28 +347,23 @@ lookup_result_type<Type> lookup(const pmInDom indom,
  *
  * @return A struct containing the found cache entry details.
  *
+ * @see try_lookup
  * @see pmdaCacheLookupName
  */
 template <typename Type>
 lookup_result_type<Type> lookup(const pmInDom indom, const std::string &name,
                                 const lookup_flags flags = require_active)
 {
-    lookup_result_type<Type> result;
-    void * opaque;
-    int instance_id;
-    result.status = pmdaCacheLookupName(indom, name.c_str(), &instance_id, &opaque);
+    const lookup_result_type<Type> result = try_lookup<Type>(indom, name);
     if (result.status < 0) {
         throw pcp::exception(result.status);
     }
     if ((flags & require_active) && (result.status != PMDA_CACHE_ACTIVE)) {
         std::ostringstream message;
-        message << "Cache entry " << indom << ':' << instance_id
+        message << "Cache entry " << indom << ':' << result.instance_id
                 << " (\"" << name << "\") inactive";
         throw pcp::exception(result.status, message.str());
     }
-    result.name = NULL;
-    result.instance_id = instance_id;
-    result.opaque = static_cast<Type>(opaque);
     return result;
 }
 
@@ -165,6 +384,7 @@ lookup_result_type<Type> lookup(const pmInDom indom, const std::string &name,
  *
  * @return A struct containing the found cache entry details.
  *
+ * @see try_lookup
  * @see pmdaCacheLookupKey
  */
 template <typename Type>
@@ -172,23 +392,87 @@ lookup_result_type<Type> lookup(const pmInDom indom, const std::string &name,
                                 const std::string &key,
                                 const lookup_flags flags = require_active)
 {
-    lookup_result_type<Type> result;
-    void * opaque;
-    int instance_id;
-    result.status = pmdaCacheLookupKey(indom, name.c_str(), key.size(),
-                                       key.c_str(), &result.name,
-                                       &instance_id, &opaque);
+    const lookup_result_type<Type> result = try_lookup<Type>(indom, name, key);
     if (result.status < 0) {
         throw pcp::exception(result.status);
     }
     if ((flags & require_active) && (result.status != PMDA_CACHE_ACTIVE)) {
         std::ostringstream message;
-        message << "Cache entry " << indom << ':' << instance_id
+        message << "Cache entry " << indom << ':' << result.instance_id
                 << " (\"" << name << "\":\"" << key << "\") inactive";
         throw pcp::exception(result.status, message.str());
     }
-    result.instance_id = instance_id;
-    result.opaque = static_cast<Type>(opaque);
+    return result;
+}
+
+/**
+ * @brief Lookup a cache entry, by instance name, without allocating.
+ *
+ * Memory is only allocated if an exception is thrown.
+ *
+ * @tparam Type        Type to cast opaque pointers to.
+ *
+ * @param  indom       Instance domain to lookup.
+ * @param  name        Instance name to lookup.
+ * @param  flags       Optional flags that alter the function's behaviour.
+ *
+ * @throw  pcp::exception  If no cache entry entry found.
+ *
+ * @return A struct containing the found cache entry details.
+ *
+ * @see lookup(const pmInDom, const std::string &, const lookup_flags)
+ */
+template <typename Type>
+lookup_result_type<Type> lookup(const pmInDom indom, const string_ref &name,
+                                const lookup_flags flags = require_active)
+{
+    const lookup_result_type<Type> result = try_lookup<Type>(indom, name);
+    if (result.status < 0) {
+        throw pcp::exception(result.status);
+    }
+    if ((flags & require_active) && (result.status != PMDA_CACHE_ACTIVE)) {
+        std::ostringstream message;
+        message << "Cache entry " << indom << ':' << result.instance_id
+                << " (\"" << std::string(name.data, name.size) << "\") inactive";
+        throw pcp::exception(result.status, message.str());
+    }
+    return result;
+}
+
+/**
+ * @brief Lookup a cache entry, by instance name and key, without allocating.
+ *
+ * Memory is only allocated if an exception is thrown.
+ *
+ * @tparam Type        Type to cast opaque pointers to.
+ *
+ * @param  indom       Instance domain to lookup.
+ * @param  name        Instance name to lookup.
+ * @param  key         Instance key to lookup.
+ * @param  flags       Optional flags that alter the function's behaviour.
+ *
+ * @throw  pcp::exception  If no cache entry entry found.
+ *
+ * @return A struct containing the found cache entry details.
+ *
+ * @see lookup(const pmInDom, const std::string &, const std::string &, const lookup_flags)
+ */
+template <typename Type>
+lookup_result_type<Type> lookup(const pmInDom indom, const string_ref &name,
+                                const string_ref &key,
+                                const lookup_flags flags = require_active)
+{
+    const lookup_result_type<Type> result = try_lookup<Type>(indom, name, key);
+    if (result.status < 0) {
+        throw pcp::exception(result.status);
+    }
+    if ((flags & require_active) && (result.status != PMDA_CACHE_ACTIVE)) {
+        std::ostringstream message;
+        message << "Cache entry " << indom << ':' << result.instance_id
+                << " (\"" << std::string(name.data, name.size) << "\":\""
+                << std::string(key.data, key.size) << "\") inactive";
+        throw pcp::exception(result.status, message.str());
+    }
     return result;
 }
 
@@ -363,6 +647,206 @@ inline instance_id_type store(const pmInDom indom, const std::string &name,
     return result;
 }
 
+/**
+ * @brief Add a item to the cache, without allocating.
+ *
+ * @param  indom   Instance domain to add an entry for.
+ * @param  name    Instance name to add to the cache.
+ * @param  flags   Optional flags to be passed to pmdaCacheStore.
+ * @param  opaque  Optional opaque pointer to be include in the cache entry.
+ *
+ * @throw  pcp::exception  On error.
+ *
+ * @return The instance ID of the stored cache entry.
+ *
+ * @see store(const pmInDom, const std::string &, const int, void * const)
+ */
+inline instance_id_type store(const pmInDom indom, const string_ref &name,
+                              const int flags = PMDA_CACHE_ADD,
+                              void * const opaque = NULL)
+{
+    const detail::terminated_string terminated_name(name);
+    const int result = pmdaCacheStore(indom, flags, terminated_name.c_str(), opaque);
+    if (result < 0) {
+        throw pcp::exception(result);
+    }
+    return result;
+}
+
+/**
+ * @brief Add a item to the cache, without allocating.
+ *
+ * @param  indom   Instance domain to add an entry for.
+ * @param  name    Instance name to add to the cache.
+ * @param  opaque  Optional opaque pointer to be include in the cache entry.
+ * @param  flags   Optional flags to be passed to pmdaCacheStore.
+ *
+ * @throw  pcp::exception  On error.
+ *
+ * @return The instance ID of the stored cache entry.
+ *
+ * @see store(const pmInDom, const std::string &, void * const, const int)
+ */
+inline instance_id_type store(const pmInDom indom, const string_ref &name,
+                              void * const opaque, const int flags = PMDA_CACHE_ADD)
+{
+    return store(indom, name, flags, opaque);
+}
+
+/**
+ * @brief Add a item to the cache, without allocating.
+ *
+ * @param  indom   Instance domain to add an entry for.
+ * @param  name    Instance name to add to the cache.
+ * @param  key     Hint to pass to pmdaCacheStoreKey.  See pmdaCacheStoreKey for
+ *                 details.
+ * @param  flags   Optional flags to be passed to pmdaCacheStore.
+ * @param  opaque  Optional opaque pointer to be include in the cache entry.
+ *
+ * @throw  pcp::exception  On error.
+ *
+ * @return The instance ID of the stored cache entry.
+ *
+ * @see store(const pmInDom, const std::string &, const std::string &, const int, void * const)
+ */
+inline instance_id_type store(const pmInDom indom, const string_ref &name,
+                              const string_ref &key, const int flags = 0,
+                              void * const opaque = NULL)
+{
+    const detail::terminated_string terminated_name(name);
+    const int result = pmdaCacheStoreKey(indom, flags, terminated_name.c_str(),
+                                         key.size, key.data, opaque);
+    if (result < 0) {
+        throw pcp::exception(result);
+    }
+    return result;
+}
+
+/**
+ * @brief Add a item to the cache, without allocating.
+ *
+ * @param  indom   Instance domain to add an entry for.
+ * @param  name    Instance name to add to the cache.
+ * @param  key     Hint to pass to pmdaCacheStoreKey.  See pmdaCacheStoreKey for
+ *                 details.
+ * @param  opaque  Optional opaque pointer to be include in the cache entry.
+ * @param  flags   Optional flags to be passed to pmdaCacheStore.
+ *
+ * @throw  pcp::exception  On error.
+ *
+ * @return The instance ID of the stored cache entry.
+ *
+ * @see store(const pmInDom, const std::string &, const std::string &, void * const, const int)
+ */
+inline instance_id_type store(const pmInDom indom, const string_ref &name,
+                              const string_ref &key, void * const opaque,
+                              const int flags = 0)
+{
+    return store(indom, name, key, flags, opaque);
+}
+
+/**
+ * @brief Structure for return results from the pcp::cache::sync function.
+ */
+struct sync_result_type {
+    size_t added;       ///< Number of entries added to the cache.
+    size_t reactivated; ///< Number of inactive entries made active again.
+    size_t updated;     ///< Number of active entries given new opaque pointers.
+    size_t removed;     ///< Number of active entries made inactive.
+};
+
+/**
+ * @brief Synchronise the cache's active entries with a set of instances.
+ *
+ * This is an alternative to marking all entries inactive (via perform) and
+ * then storing every current instance, for agents that refresh their
+ * instances periodically.  Entries that are already active, with the same
+ * opaque pointer, are left untouched; only added, reactivated, updated and
+ * removed entries are stored.
+ *
+ * Note, since untouched entries are not stored, their timestamps (as used
+ * by pcp::cache::purge) are not refreshed.
+ *
+ * For example:
+ * @code
+ * std::map<std::string, process *> processes = ...;
+ * pcp::cache::sync(indom, processes.begin(), processes.end());
+ * @endcode
+ *
+ * @tparam Iterator Input iterator, whose values' \c first members are the
+ *                  instance names (as std::string, C strings, or
+ *                  string_ref), and whose \c second members are the
+ *                  opaque pointers.
+ *
+ * @param  indom Instance domain to synchronise.
+ * @param  begin First of the current instances.
+ * @param  end   End of the current instances.
+ *
+ * @throw  pcp::exception  On error.
+ *
+ * @return A struct counting the changes made to the cache.
+ *
+ * @see pmdaCacheStore
+ */
+template <typename Iterator>
+sync_result_type sync(const pmInDom indom, Iterator begin, const Iterator end)
+{
+    sync_result_type result = { 0, 0, 0, 0 };
+
+    // Add, reactivate, or update entries, recording all current IDs.
+    std::vector<int> current_ids;
+    for (; begin != end; ++begin) {
+        const detail::terminated_string terminated_name(begin->first);
+        const char * const name = terminated_name.c_str();
+        void * const opaque = begin->second;
+        int instance_id;
+        void * cached_opaque = NULL;
+        const int status = pmdaCacheLookupName(indom, name, &instance_id, &cached_opaque);
+        if ((status < 0) && (status != PM_ERR_INST)) {
+            throw pcp::exception(status);
+        }
+        if ((status == PMDA_CACHE_ACTIVE) && (cached_opaque == opaque)) {
+            current_ids.push_back(instance_id);
+            continue;
+        }
+        instance_id = pmdaCacheStore(indom, PMDA_CACHE_ADD, name, opaque);
+        if (instance_id < 0) {
+            throw pcp::exception(instance_id);
+        }
+        current_ids.push_back(instance_id);
+        if (status == PMDA_CACHE_ACTIVE) {
+            ++result.updated;
+        } else if (status == PMDA_CACHE_INACTIVE) {
+            ++result.reactivated;
+        } else {
+            ++result.added;
+        }
+    }
+
+    // Inactivate any remaining active entries.
+    std::sort(current_ids.begin(), current_ids.end());
+    std::vector<int> stale_ids;
+    perform(indom, PMDA_CACHE_WALK_REWIND);
+    for (int instance_id; (instance_id = pmdaCacheOp(indom, PMDA_CACHE_WALK_NEXT)) >= 0;) {
+        if (!std::binary_search(current_ids.begin(), current_ids.end(), instance_id)) {
+            stale_ids.push_back(instance_id);
+        }
+    }
+    for (std::vector<int>::const_iterator iter = stale_ids.begin();
+         iter != stale_ids.end(); ++iter) {
+        char * name = NULL;
+        int status = pmdaCacheLookup(indom, *iter, &name, NULL);
+        if (status >= 0) {
+            status = pmdaCacheStore(indom, PMDA_CACHE_HIDE, name, NULL);
+        }
+        if (status < 0) {
+            throw pcp::exception(status);
+        }
+        ++result.removed;
+    }
+    return result;
+}
+
 } } // pcp::cache namespace.
 
 PCP_CPP_END_NAMESPACE
@@ -0,0 +1,335 @@
+//            Copyright Paul Colby 2013 - 2018.
+// Distributed under the Boost Software License, Version 1.0.
+//       (See accompanying file LICENSE.md or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+/**
+ * @file
+ * @brief Defines the pcp::cached_instance_domain class.
+ */
+
+#ifndef __PCP_CPP_CACHED_INSTANCE_DOMAIN_HPP__
+#define __PCP_CPP_CACHED_INSTANCE_DOMAIN_HPP__
+
+#include "cache.hpp"
+#include "config.hpp"
+#include "instance_domain.hpp"
+#include "types.hpp"
+
+#include <stdexcept>
+#include <string>
+
+PCP_CPP_BEGIN_NAMESPACE
+
+namespace pcp {
+
+/**
+ * @brief Performance metric instance domain, backed by the PMDA cache.
+ *
+ * This class suits instance domains whose instances come and go at runtime,
+ * such as those managed via pcp::cache::store in PCP's own Simple PMDA.  The
+ * instances (and their names, and opaque pointers) are held only in libpcp's
+ * PMDA cache, which libpcp_pmda then uses directly for instance requests and
+ * fetches.  This class adds just a bitmap of active instance IDs, so that
+ * pcp::pmda's instance validation stays consistent with the cache, without a
+ * second copy of each instance.
+ *
+ * Instances must be added, and removed, via this class's functions (rather
+ * than the pcp::cache functions directly) to keep the bitmap in sync.  The
+ * std::map interface inherited from pcp::instance_domain would bypass the
+ * cache (and otherwise remains empty), so is hidden; use get_instance_count,
+ * contains and get_instance_info, or the pcp::cache functions, to read the
+ * instances.  Since
+ * the cache is keyed by the PCP instance domain, this is only possible once
+ * the PMDA has been initialised.
+ *
+ * @see pcp::cache
+ * @see pmdaCache
+ */
+class cached_instance_domain : public instance_domain {
+
+public:
+
+    /**
+     * @brief [Default] Constructor
+     *
+     * @param domain_id User-defined ID for this instance domain.
+     */
+    explicit cached_instance_domain(domain_id_type domain_id = PM_INDOM_NULL)
+        : instance_domain(domain_id)
+    {
+
+    }
+
+    /**
+     * @brief Functor for setting this instance's domain ID.
+     *
+     * @param domain_id ID for the instance domain.
+     *
+     * @return A reference to this instance domain.
+     */
+    cached_instance_domain& operator()(const domain_id_type domain_id)
+    {
+        instance_domain::operator()(domain_id);
+        return *this;
+    }
+
+    /**
+     * @brief Add, or re-activate, an instance in the cache.
+     *
+     * @param name   Instance name to store.
+     * @param opaque Optional opaque pointer to store with the instance.
+     *
+     * @throw pcp::exception On error.
+     *
+     * @return The instance's ID, as allocated by the cache.
+     *
+     * @see pcp::cache::store
+     */
+    instance_id_type store(const std::string &name, void * const opaque = NULL)
+    {
+        return store_name(name, opaque);
+    }
+
+    /**
+     * @brief Add, or re-activate, an instance in the cache, without
+     *        allocating.
+     *
+     * @param name   Instance name to store.
+     * @param opaque Optional opaque pointer to store with the instance.
+     *
+     * @throw pcp::exception On error.
+     *
+     * @return The instance's ID, as allocated by the cache.
+     *
+     * @see pcp::cache::store
+     */
+    instance_id_type store(const cache::string_ref &name, void * const opaque = NULL)
+    {
+        return store_name(name, opaque);
+    }
+
+    /**
+     * @brief Mark an instance as inactive.
+     *
+     * Inactive instances remain in the cache, keeping their IDs, until purged.
+     *
+     * @param name Instance name to hide.
+     *
+     * @throw pcp::exception On error.
+     *
+     * @return The instance's ID.
+     */
+    instance_id_type hide(const std::string &name)
+    {
+        return hide_name(name);
+    }
+
+    /**
+     * @brief Mark an instance as inactive, without allocating.
+     *
+     * @param name Instance name to hide.
+     *
+     * @throw pcp::exception On error.
+     *
+     * @return The instance's ID.
+     */
+    instance_id_type hide(const cache::string_ref &name)
+    {
+        return hide_name(name);
+    }
+
+    /**
+     * @brief Mark all instances as inactive.
+     *
+     * Typically called before re-storing the currently active instances.
+     *
+     * @throw pcp::exception On error.
+     */
+    void inactivate_all()
+    {
+        cache::perform(get_pm_instance_domain(), PMDA_CACHE_INACTIVE);
+        instances_cleared();
+    }
+
+    /**
+     * @brief Remove instances that have not been stored for some time.
+     *
+     * This bounds the cache's memory use for domains whose instances churn.
+     *
+     * @param recent All instances that have not been stored within this many
+     *               seconds will be removed.
+     *
+     * @throw pcp::exception On error.
+     *
+     * @return The number of instances removed.
+     *
+     * @see pcp::cache::purge
+     */
+    size_t purge(const time_t recent)
+    {
+        const size_t count = cache::purge(get_pm_instance_domain(), recent);
+        if (count > 0) {
+            reindex(); // In case any active instances were purged.
+        }
+        return count;
+    }
+
+    /**
+     * @brief Synchronise this domain with a set of current instances.
+     *
+     * @tparam Iterator Input iterator over (name, opaque pointer) pairs, with
+     *                  names as std::string, C strings, or
+     *                  pcp::cache::string_ref.
+     *
+     * @param begin First of the current instances.
+     * @param end   End of the current instances.
+     *
+     * @throw pcp::exception On error.
+     *
+     * @return A struct counting the changes made to the cache.
+     *
+     * @see pcp::cache::sync
+     */
+    template <typename Iterator>
+    cache::sync_result_type sync(Iterator begin, const Iterator end)
+    {
+        const cache::sync_result_type result = cache::sync(get_pm_instance_domain(), begin, end);
+        if ((result.added > 0) || (result.reactivated > 0) || (result.removed > 0)) {
+            reindex();
+        }
+        return result;
+    }
+
+    virtual size_type get_instance_count() const
+    {
+        const pmInDom indom = get_pm_instance_domain();
+        if (indom == PM_INDOM_NULL) {
+            return 0;
+        }
+        return cache::perform(indom, PMDA_CACHE_SIZE_ACTIVE);
+    }
+
+    virtual instance_info get_instance_info(const instance_id_type instance_id) const
+    {
+        char * name = NULL;
+        if (pmdaCacheLookup(get_pm_instance_domain(), instance_id,
+                            &name, NULL) != PMDA_CACHE_ACTIVE) {
+            throw std::out_of_range("unknown instance");
+        }
+        instance_info info; // The cache holds no descriptions.
+        info.instance_name = name;
+        return info;
+    }
+
+    virtual void get_pmda_instances(pmdaInstid * const instances) const
+    {
+        const pmInDom indom = get_pm_instance_domain();
+        if (indom == PM_INDOM_NULL) {
+            return;
+        }
+        const size_type count = get_instance_count();
+        cache::perform(indom, PMDA_CACHE_WALK_REWIND);
+        for (size_type index = 0; index < count; ++index) {
+            const int instance_id = pmdaCacheOp(indom, PMDA_CACHE_WALK_NEXT);
+            if (instance_id < 0) {
+                break;
+            }
+            instances[index].i_inst = instance_id;
+            instances[index].i_name = NULL;
+            pmdaCacheLookup(indom, instance_id, &instances[index].i_name, NULL);
+        }
+    }
+
+    virtual bool uses_pmda_cache() const
+    {
+        return true;
+    }
+
+protected:
+
+    virtual bool contains_unindexed(const instance_id_type instance_id) const
+    {
+        return (pmdaCacheLookup(get_pm_instance_domain(), instance_id,
+                                NULL, NULL) == PMDA_CACHE_ACTIVE);
+    }
+
+private:
+    // These would modify the unused std::map, and the bitmap, without
+    // touching the cache; use store, hide and inactivate_all instead.
+    using instance_domain::insert;
+    using instance_domain::erase;
+    using instance_domain::clear;
+    using instance_domain::swap;
+
+    // The std::map is always empty, so reading it would mislead.
+    using instance_domain::begin;
+    using instance_domain::end;
+    using instance_domain::rbegin;
+    using instance_domain::rend;
+    using instance_domain::at;
+    using instance_domain::find;
+    using instance_domain::count;
+    using instance_domain::lower_bound;
+    using instance_domain::upper_bound;
+    using instance_domain::equal_range;
+#if __cplusplus >= 201103L
+    using instance_domain::cbegin;
+    using instance_domain::cend;
+    using instance_domain::crbegin;
+    using instance_domain::crend;
+#endif
+    using instance_domain::empty;
+    using instance_domain::size;
+
+    // Rebuild the bitmap from the cache's active instances.
+    void reindex()
+    {
+        const pmInDom indom = get_pm_instance_domain();
+        instances_cleared();
+        cache::perform(indom, PMDA_CACHE_WALK_REWIND);
+        for (int instance_id; (instance_id = pmdaCacheOp(indom, PMDA_CACHE_WALK_NEXT)) >= 0;) {
+            instance_added(instance_id);
+        }
+    }
+
+    template <typename Name>
+    instance_id_type store_name(const Name &name, void * const opaque)
+    {
+        const bool was_active = is_stored(name);
+        const instance_id_type instance_id =
+            cache::store(get_pm_instance_domain(), name, PMDA_CACHE_ADD, opaque);
+        if (!was_active) {
+            instance_added(instance_id);
+        }
+        return instance_id;
+    }
+
+    template <typename Name>
+    instance_id_type hide_name(const Name &name)
+    {
+        const bool was_active = is_stored(name);
+        const instance_id_type instance_id =
+            cache::store(get_pm_instance_domain(), name, PMDA_CACHE_HIDE);
+        if (was_active) {
+            instance_removed(instance_id);
+        }
+        return instance_id;
+    }
+
+    // Is the named instance in this domain (rather than merely in the cache)?
+    template <typename Name>
+    bool is_stored(const Name &name) const
+    {
+        const cache::lookup_result_type<void *> result =
+            cache::try_lookup<void *>(get_pm_instance_domain(), name);
+        return (result.status >= 0) && contains(result.instance_id);
+    }
+
+};
+
+} // pcp namespace.
+
+PCP_CPP_END_NAMESPACE
+
+#endif
@@ -0,0 +1,369 @@
+//            Copyright Paul Colby 2013 - 2018.
+// Distributed under the Boost Software License, Version 1.0.
+//       (See accompanying file LICENSE.md or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+/**
+ * @file
+ * @brief Defines the pcp::collector class.
+ */
+
+#ifndef __PCP_CPP_COLLECTOR_HPP__
+#define __PCP_CPP_COLLECTOR_HPP__
+
+#include "config.hpp"
+#include "exception.hpp"
+
+#include <cassert>
+#include <errno.h>
+#include <exception>
+#include <pthread.h>
+#include <time.h>
+
+PCP_CPP_BEGIN_NAMESPACE
+
+namespace pcp {
+
+/**
+ * @brief Background collector, publishing snapshots of collected values.
+ *
+ * This class runs an agent's data collection on a dedicated thread, so that
+ * slow data sources do not block pmcd's requests.  Derived classes implement
+ * the collect function, which the background thread invokes periodically to
+ * fill in a new snapshot.  Each completed snapshot is then published to the
+ * PMDA thread, which reads the most recently published snapshot via latest.
+ *
+ * Snapshots are held in three pre-allocated buffers: one being read by the
+ * PMDA, one being written by the collector, and one holding the most recently
+ * published snapshot.  Publishing and acquiring snapshots are single atomic
+ * exchanges (or, without GCC-compatible atomic builtins, brief mutex locks),
+ * so neither thread ever waits on the other's work, and fetch latency is
+ * independent of how long collection takes.
+ *
+ * For example, an agent might use a collector like:
+ * @code
+ * class my_collector : public pcp::collector<my_snapshot> {
+ * public:
+ *     virtual ~my_collector() {
+ *         stop(); // Required, before collect is destroyed.
+ *     }
+ *
+ * protected:
+ *     virtual void collect(my_snapshot &snapshot) {
+ *         snapshot.load_average = read_slow_load_average();
+ *     }
+ * };
+ *
+ * class my_pmda : public pcp::pmda {
+ *     my_collector collector;
+ *     const my_snapshot * snapshot;
+ *
+ *     virtual void initialize_pmda(pmdaInterface &interface) {
+ *         pcp::pmda::initialize_pmda(interface);
+ *         collector.start(1000);
+ *     }
+ *
+ *     virtual void begin_fetch_values() {
+ *         snapshot = &collector.latest();
+ *     }
+ *     ...
+ * };
+ * @endcode
+ *
+ * The pcp::pmda class does not own, start or stop collectors; agents do so
+ * themselves, as above.  Since collectors are typically members of the
+ * agent's own class, they are stopped (by their own destructors) before the
+ * pcp::pmda base class is torn down.
+ *
+ * @note Only one thread (typically the PMDA's main thread) may call latest.
+ *
+ * @tparam Snapshot Value-initializable type holding one set of collected
+ *                  values.
+ */
+template <typename Snapshot>
+class collector {
+
+public:
+
+    /**
+     * @brief Constructor.
+     */
+    collector()
+        : buffers(), interval(0), running(false), stopping(false),
+          published_count(0), front_index(0), back_index(1), middle_state(2)
+    {
+        pthread_mutex_init(&mutex, NULL);
+        pthread_mutex_init(&state_mutex, NULL);
+        pthread_condattr_t attributes;
+        pthread_condattr_init(&attributes);
+        pthread_condattr_setclock(&attributes, CLOCK_MONOTONIC);
+        pthread_cond_init(&condition, &attributes);
+        pthread_condattr_destroy(&attributes);
+    }
+
+    /**
+     * @brief Destructor.
+     *
+     * Derived classes must call stop in their own destructors, since by the
+     * time this destructor runs, the derived part of the object has already
+     * been destroyed, so the background thread must no longer be invoking
+     * collect.  This is asserted in debug builds; release builds stop the
+     * thread here as a last resort.
+     */
+    virtual ~collector()
+    {
+        assert(!running && "derived collectors must call stop in their destructors");
+        stop();
+        pthread_cond_destroy(&condition);
+        pthread_mutex_destroy(&state_mutex);
+        pthread_mutex_destroy(&mutex);
+    }
+
+    /**
+     * @brief Start collecting on a background thread.
+     *
+     * The first collection begins immediately, and subsequent collections
+     * begin \a interval_ms milliseconds after the previous one completed.
+     *
+     * @param interval_ms Milliseconds to wait between collections.
+     *
+     * @throw pcp::exception If the collector is already running, or the thread
+     *                       could not be created.
+     */
+    void start(const unsigned long interval_ms)
+    {
+        if (running) {
+            throw pcp::exception(PM_ERR_GENERIC, "collector already running");
+        }
+        interval = interval_ms;
+        stopping = false;
+        const int error = pthread_create(&thread, NULL, &collector::run, this);
+        if (error != 0) {
+            throw pcp::exception(-error, "failed to start collector thread");
+        }
+        running = true;
+    }
+
+#ifndef PCP_CPP_NO_BOOST
+    /**
+     * @brief Start collecting on a background thread.
+     *
+     * @param interval Time to wait between collections.
+     *
+     * @throw pcp::exception If the collector is already running, or the thread
+     *                       could not be created.
+     *
+     * @see start(const unsigned long)
+     */
+    void start(const boost::posix_time::time_duration &interval)
+    {
+        start(interval.total_milliseconds());
+    }
+#endif
+
+    /**
+     * @brief Stop the background thread.
+     *
+     * Waits for any collection in progress to complete.  Does nothing if the
+     * collector is not running.
+     */
+    void stop()
+    {
+        if (!running) {
+            return;
+        }
+        pthread_mutex_lock(&mutex);
+        stopping = true;
+        pthread_cond_signal(&condition);
+        pthread_mutex_unlock(&mutex);
+        pthread_join(thread, NULL);
+        running = false;
+    }
+
+    /**
+     * @brief Is the background thread running?
+     *
+     * @return \c true if the collector has been started, and not yet stopped.
+     */
+    bool is_running() const
+    {
+        return running;
+    }
+
+    /**
+     * @brief Get the most recently published snapshot.
+     *
+     * The returned snapshot remains valid, and unchanged, until the next call
+     * to latest.  Until the first collection has completed, this returns a
+     * value-initialized snapshot.
+     *
+     * @return The most recently published snapshot.
+     */
+    const Snapshot &latest()
+    {
+        if (load_middle_state() & fresh_flag) {
+            front_index = exchange_middle_state(front_index) & index_mask;
+        }
+        return buffers[front_index];
+    }
+
+    /**
+     * @brief Get the number of snapshots published so far.
+     *
+     * @return The number of completed collections.
+     */
+    unsigned long get_published_count() const
+    {
+#ifdef __GNUC__
+        return __sync_fetch_and_add(const_cast<volatile unsigned long *>(&published_count), 0);
+#else
+        pthread_mutex_lock(&state_mutex);
+        const unsigned long count = published_count;
+        pthread_mutex_unlock(&state_mutex);
+        return count;
+#endif
+    }
+
+protected:
+
+    /**
+     * @brief Collect values into a snapshot.
+     *
+     * Invoked on the background thread.  The \a snapshot buffer is re-used
+     * from an earlier collection, so implementations must overwrite (or clear)
+     * all of its contents.  Any exceptions thrown are logged, and the snapshot
+     * is not published.
+     *
+     * @param snapshot Snapshot to fill with newly collected values.
+     */
+    virtual void collect(Snapshot &snapshot) = 0;
+
+private:
+    static const int fresh_flag = 0x4; ///< Middle buffer holds an unread snapshot.
+    static const int index_mask = 0x3; ///< Bits holding the middle buffer index.
+
+    Snapshot buffers[3];          ///< Front, back, and middle snapshot buffers.
+
+    pthread_t thread;             ///< Background collector thread.
+    pthread_mutex_t mutex;        ///< Guards \a stopping for \a condition.
+    mutable pthread_mutex_t state_mutex; ///< Guards snapshot state without atomic builtins.
+    pthread_cond_t condition;     ///< Wakes the collector to stop early.
+    unsigned long interval;       ///< Milliseconds between collections.
+    bool running;                 ///< Background thread has been started.
+    bool stopping;                ///< Background thread should exit.
+    volatile unsigned long published_count; ///< Number of published snapshots.
+
+    int front_index;              ///< Buffer being read; PMDA thread only.
+    int back_index;               ///< Buffer being written; collector only.
+    volatile int middle_state;    ///< Published buffer index, and fresh_flag.
+
+    /**
+     * @brief Atomically read the middle buffer's state.
+     *
+     * Uses GCC's atomic builtins (also supported by Clang and ICC) where
+     * available, and otherwise falls back to \a state_mutex.
+     *
+     * @return The middle buffer's index, and fresh_flag.
+     */
+    int load_middle_state()
+    {
+#ifdef __GNUC__
+        return __sync_fetch_and_add(&middle_state, 0);
+#else
+        pthread_mutex_lock(&state_mutex);
+        const int state = middle_state;
+        pthread_mutex_unlock(&state_mutex);
+        return state;
+#endif
+    }
+
+    /**
+     * @brief Atomically exchange the middle buffer's state, with a full
+     *        memory barrier.
+     *
+     * @param value New state for the middle buffer.
+     *
+     * @return The middle buffer's previous state.
+     */
+    int exchange_middle_state(const int value)
+    {
+#ifdef __GNUC__
+        int expected = middle_state;
+        for (int actual; (actual = __sync_val_compare_and_swap(&middle_state, expected, value)) != expected;) {
+            expected = actual;
+        }
+        return expected;
+#else
+        pthread_mutex_lock(&state_mutex);
+        const int previous = middle_state;
+        middle_state = value;
+        pthread_mutex_unlock(&state_mutex);
+        return previous;
+#endif
+    }
+
+    /**
+     * @brief Collect, and publish, a single snapshot.
+     */
+    void collect_once()
+    {
+        try {
+            collect(buffers[back_index]);
+        } catch (const std::exception &ex) {
+            pmNotifyErr(LOG_ERR, "%s", ex.what());
+            return;
+        } catch (...) {
+            pmNotifyErr(LOG_ERR, "unknown exception in collector");
+            return;
+        }
+        back_index = exchange_middle_state(back_index | fresh_flag) & index_mask;
+#ifdef __GNUC__
+        __sync_fetch_and_add(&published_count, 1);
+#else
+        pthread_mutex_lock(&state_mutex);
+        ++published_count;
+        pthread_mutex_unlock(&state_mutex);
+#endif
+    }
+
+    /**
+     * @brief Background thread's main loop.
+     *
+     * @param self Pointer to the collector instance.
+     *
+     * @return Always \c NULL.
+     */
+    static void * run(void * self)
+    {
+        collector * const instance = static_cast<collector *>(self);
+        pthread_mutex_lock(&instance->mutex);
+        while (!instance->stopping) {
+            pthread_mutex_unlock(&instance->mutex);
+            instance->collect_once();
+            struct timespec deadline;
+            clock_gettime(CLOCK_MONOTONIC, &deadline);
+            deadline.tv_sec += instance->interval / 1000;
+            deadline.tv_nsec += (instance->interval % 1000) * 1000000;
+            if (deadline.tv_nsec >= 1000000000) {
+                deadline.tv_sec += 1;
+                deadline.tv_nsec -= 1000000000;
+            }
+            pthread_mutex_lock(&instance->mutex);
+            while ((!instance->stopping) &&
+                   (pthread_cond_timedwait(&instance->condition, &instance->mutex, &deadline) != ETIMEDOUT));
+        }
+        pthread_mutex_unlock(&instance->mutex);
+        return NULL;
+    }
+
+    // Collectors own a thread, so cannot be copied.
+    collector(const collector &);
+    collector &operator=(const collector &);
+
+};
+
+} // pcp namespace.
+
+PCP_CPP_END_NAMESPACE
+
+#endif
@@ -0,0 +1,419 @@
+//            Copyright Paul Colby 2013 - 2018.
+// Distributed under the Boost Software License, Version 1.0.
+//       (See accompanying file LICENSE.md or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+/**
+ * @file
+ * @brief Defines the pcp::compact_instance_domain class.
+ */
+
+#ifndef __PCP_CPP_COMPACT_INSTANCE_DOMAIN_HPP__
+#define __PCP_CPP_COMPACT_INSTANCE_DOMAIN_HPP__
+
+#include "config.hpp"
+#include "instance_domain.hpp"
+#include "types.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <map>
+#include <stdexcept>
+#include <stdint.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+PCP_CPP_BEGIN_NAMESPACE
+
+namespace pcp {
+
+/**
+ * @brief Performance metric instance domain, with compact storage.
+ *
+ * This class is an alternative to pcp::instance_domain for very large
+ * instance domains (such as per-thread, or per-flow, domains with hundreds of
+ * thousands of instances).  Rather than a std::map node with three strings
+ * per instance, instances are held as a sorted vector of IDs, and a single
+ * blob of null-terminated names, costing just eight bytes per instance in
+ * addition to the name itself.
+ *
+ * Instance descriptions are optional.  Those given explicitly (via the
+ * builder functors) are held separately, for only the instances that have
+ * them.  Otherwise, derived classes may override load_descriptions to load
+ * descriptions lazily, only when actually requested.
+ *
+ * Instances are added via this class's own builder functors, and insert,
+ * erase and clear functions, and read via contains, get_instance_name, and
+ * the positional instance_id_at and instance_name_at functions.  The
+ * std::map interface inherited from pcp::instance_domain is not used, and
+ * remains empty, so is hidden.
+ *
+ * @see pcp::instance_domain
+ */
+class compact_instance_domain : public instance_domain {
+
+public:
+
+    /**
+     * @brief [Default] Constructor
+     *
+     * @param domain_id User-defined ID for this instance domain.
+     */
+    explicit compact_instance_domain(domain_id_type domain_id = PM_INDOM_NULL)
+        : instance_domain(domain_id), erased_name_bytes(0)
+    {
+
+    }
+
+    /**
+     * @brief Functor for setting this instance's domain ID.
+     *
+     * @param domain_id ID for the instance domain.
+     *
+     * @return A reference to this instance domain.
+     */
+    compact_instance_domain& operator()(const domain_id_type domain_id)
+    {
+        instance_domain::operator()(domain_id);
+        return *this;
+    }
+
+    /**
+     * @brief Instance insertion functor.
+     *
+     * @param instance_id ID for the instance to insert.
+     * @param info        Basic instance information.
+     *
+     * @return A reference to this instance domain.
+     */
+    compact_instance_domain& operator()(const instance_id_type instance_id,
+                                        const instance_info &info)
+    {
+        insert(instance_id, info.instance_name, info.short_description,
+               info.verbose_description);
+        return *this;
+    }
+
+    /**
+     * @brief Instance insertion functor.
+     *
+     * @param instance_id         ID for the instance to insert.
+     * @param instance_name       Name of the instance to insert.
+     * @param short_description   Short description of the instance to insert.
+     * @param verbose_description Verbose description of the instance to insert.
+     *
+     * @return A reference to this instance domain.
+     */
+    compact_instance_domain& operator()(const instance_id_type instance_id,
+                                        const std::string &instance_name,
+                                        const std::string &short_description = std::string(),
+                                        const std::string &verbose_description = std::string())
+    {
+        insert(instance_id, instance_name, short_description, verbose_description);
+        return *this;
+    }
+
+    /**
+     * @brief Insert an instance into this domain.
+     *
+     * As for std::map, inserting an instance ID that is already present has
+     * no effect.  Inserting instances in increasing ID order is fastest.
+     *
+     * @param instance_id         ID for the instance to insert.
+     * @param instance_name       Name of the instance to insert.
+     * @param short_description   Short description of the instance to insert.
+     * @param verbose_description Verbose description of the instance to insert.
+     *
+     * @throw std::length_error If the names would exceed 4GB in total.
+     *
+     * @return \c true if the instance was inserted, otherwise \c false.
+     */
+    bool insert(const instance_id_type instance_id,
+                const std::string &instance_name,
+                const std::string &short_description = std::string(),
+                const std::string &verbose_description = std::string())
+    {
+        const std::vector<instance_id_type>::iterator position =
+            std::lower_bound(ids.begin(), ids.end(), instance_id);
+        if ((position != ids.end()) && (*position == instance_id)) {
+            return false;
+        }
+        if (names.size() + instance_name.size() + 1 > std::numeric_limits<uint32_t>::max()) {
+            throw std::length_error("compact instance domain names exceed 4GB");
+        }
+        const uint32_t offset = static_cast<uint32_t>(names.size());
+        const size_t index = position - ids.begin();
+        names.insert(names.end(), instance_name.begin(), instance_name.end());
+        names.push_back('\0');
+        ids.insert(position, instance_id);
+        name_offsets.insert(name_offsets.begin() + index, offset);
+        if ((!short_description.empty()) || (!verbose_description.empty())) {
+            descriptions[instance_id] = std::make_pair(short_description, verbose_description);
+        }
+        instance_added(instance_id);
+        return true;
+    }
+
+    /**
+     * @brief Remove an instance from this domain.
+     *
+     * The removed instance's name is reclaimed once enough names have been
+     * removed to make that worthwhile, or on the next call to shrink_to_fit.
+     *
+     * @param instance_id ID of the instance to remove.
+     *
+     * @return The number of instances removed (zero or one).
+     */
+    size_type erase(const instance_id_type instance_id)
+    {
+        const std::vector<instance_id_type>::iterator position =
+            std::lower_bound(ids.begin(), ids.end(), instance_id);
+        if ((position == ids.end()) || (*position != instance_id)) {
+            return 0;
+        }
+        const size_t index = position - ids.begin();
+        erased_name_bytes += strlen(&names[name_offsets[index]]) + 1;
+        ids.erase(position);
+        name_offsets.erase(name_offsets.begin() + index);
+        descriptions.erase(instance_id);
+        if (erased_name_bytes > names.size() / 2) {
+            compact_names();
+        }
+        instance_removed(instance_id);
+        return 1;
+    }
+
+    /**
+     * @brief Remove all instances from this domain.
+     */
+    void clear()
+    {
+        ids.clear();
+        name_offsets.clear();
+        names.clear();
+        descriptions.clear();
+        erased_name_bytes = 0;
+        instances_cleared();
+    }
+
+    /**
+     * @brief Get the number of instances in this domain.
+     *
+     * @return The number of instances in this domain.
+     */
+    size_type size() const
+    {
+        return ids.size();
+    }
+
+    /**
+     * @brief Is this domain empty?
+     *
+     * @return \c true if this domain has no instances, otherwise \c false.
+     */
+    bool empty() const
+    {
+        return ids.empty();
+    }
+
+    /**
+     * @brief Get the ID of the instance at a given position.
+     *
+     * @param index Position of the instance, in instance ID order.
+     *
+     * @return The instance's ID.
+     */
+    instance_id_type instance_id_at(const size_type index) const
+    {
+        return ids[index];
+    }
+
+    /**
+     * @brief Get the name of the instance at a given position.
+     *
+     * @param index Position of the instance, in instance ID order.
+     *
+     * @return The instance's name, valid until this domain next changes.
+     */
+    const char * instance_name_at(const size_type index) const
+    {
+        return &names[name_offsets[index]];
+    }
+
+    /**
+     * @brief Get the name of an instance.
+     *
+     * @param instance_id ID of the instance.
+     *
+     * @return The instance's name, valid until this domain next changes, or
+     *         \c NULL if this domain does not contain \a instance_id.
+     */
+    const char * get_instance_name(const instance_id_type instance_id) const
+    {
+        const std::vector<instance_id_type>::const_iterator position =
+            std::lower_bound(ids.begin(), ids.end(), instance_id);
+        if ((position == ids.end()) || (*position != instance_id)) {
+            return NULL;
+        }
+        return instance_name_at(position - ids.begin());
+    }
+
+    /**
+     * @brief Get the full information for an instance.
+     *
+     * Descriptions given when the instance was inserted are returned as-is.
+     * Otherwise, they are loaded via load_descriptions.
+     *
+     * @param instance_id ID of the instance.
+     *
+     * @throw std::out_of_range If this domain does not contain \a instance_id.
+     *
+     * @return The instance's information.
+     */
+    virtual instance_info get_instance_info(const instance_id_type instance_id) const
+    {
+        const char * const name = get_instance_name(instance_id);
+        if (name == NULL) {
+            throw std::out_of_range("unknown instance");
+        }
+        instance_info info;
+        info.instance_name = name;
+        const description_map::const_iterator iter = descriptions.find(instance_id);
+        if (iter != descriptions.end()) {
+            info.short_description = iter->second.first;
+            info.verbose_description = iter->second.second;
+        } else {
+            load_descriptions(instance_id, info.short_description, info.verbose_description);
+        }
+        return info;
+    }
+
+    /**
+     * @brief Reserve storage for a number of instances.
+     *
+     * @param instance_count  Number of instances to reserve storage for.
+     * @param name_characters Total length of all instance names to reserve
+     *                        storage for, excluding null terminators.
+     */
+    void reserve(const size_type instance_count, const size_t name_characters)
+    {
+        ids.reserve(instance_count);
+        name_offsets.reserve(instance_count);
+        names.reserve(name_characters + instance_count);
+    }
+
+    /**
+     * @brief Release all unused storage.
+     *
+     * This reclaims the names of removed instances, and any excess capacity.
+     * Since the names may move, this counts as a change to this domain.
+     */
+    void shrink_to_fit()
+    {
+        compact_names();
+        std::vector<instance_id_type>(ids).swap(ids);
+        std::vector<uint32_t>(name_offsets).swap(name_offsets);
+        std::vector<char>(names).swap(names);
+        instances_moved();
+    }
+
+    virtual size_type get_instance_count() const
+    {
+        return ids.size();
+    }
+
+    virtual void get_pmda_instances(pmdaInstid * const instances) const
+    {
+        for (size_t index = 0; index < ids.size(); ++index) {
+            instances[index].i_inst = ids[index];
+            instances[index].i_name = const_cast<char *>(instance_name_at(index));
+        }
+    }
+
+protected:
+
+    /**
+     * @brief Load an instance's descriptions on demand.
+     *
+     * Derived classes may override this function to load instance
+     * descriptions lazily, for instances that were inserted without them.
+     *
+     * This base implementation loads nothing, and returns \c false.
+     *
+     * @param instance_id         ID of the instance to load descriptions for.
+     * @param short_description   Short description to load.
+     * @param verbose_description Verbose description to load.
+     *
+     * @return \c true if any descriptions were loaded, otherwise \c false.
+     */
+    virtual bool load_descriptions(const instance_id_type instance_id,
+                                   std::string &short_description,
+                                   std::string &verbose_description) const
+    {
+        PCP_CPP_UNUSED(instance_id)
+        PCP_CPP_UNUSED(short_description)
+        PCP_CPP_UNUSED(verbose_description)
+        return false;
+    }
+
+    virtual bool contains_unindexed(const instance_id_type instance_id) const
+    {
+        return std::binary_search(ids.begin(), ids.end(), instance_id);
+    }
+
+private:
+    // The inherited std::map is always empty; see instance_id_at and
+    // get_instance_name instead.
+    using instance_domain::begin;
+    using instance_domain::end;
+    using instance_domain::rbegin;
+    using instance_domain::rend;
+    using instance_domain::at;
+    using instance_domain::find;
+    using instance_domain::count;
+    using instance_domain::lower_bound;
+    using instance_domain::upper_bound;
+    using instance_domain::equal_range;
+#if __cplusplus >= 201103L
+    using instance_domain::cbegin;
+    using instance_domain::cend;
+    using instance_domain::crbegin;
+    using instance_domain::crend;
+#endif
+    using instance_domain::swap;
+
+    /// @brief Explicit descriptions, as (short, verbose) pairs, by instance ID.
+    typedef std::map<instance_id_type, std::pair<std::string, std::string> > description_map;
+
+    std::vector<instance_id_type> ids;   ///< Instance IDs, in increasing order.
+    std::vector<uint32_t> name_offsets;  ///< Offsets into \a names, parallel to \a ids.
+    std::vector<char> names;             ///< Null-terminated instance names.
+    size_t erased_name_bytes;            ///< Bytes of \a names no longer referenced.
+    description_map descriptions;        ///< Explicit instance descriptions.
+
+    // Rebuild the names blob without the names of removed instances.
+    void compact_names()
+    {
+        if (erased_name_bytes == 0) {
+            return;
+        }
+        std::vector<char> compacted;
+        compacted.reserve(names.size() - erased_name_bytes);
+        for (size_t index = 0; index < name_offsets.size(); ++index) {
+            const char * const name = &names[name_offsets[index]];
+            name_offsets[index] = static_cast<uint32_t>(compacted.size());
+            compacted.insert(compacted.end(), name, name + strlen(name) + 1);
+        }
+        names.swap(compacted);
+        erased_name_bytes = 0;
+    }
+
+};
+
+} // pcp namespace.
+
+PCP_CPP_END_NAMESPACE
+
+#endif
@@ -75,11 +75,13 @@
 #if !defined PM_VERSION_CURRENT || PM_VERSION_CURRENT < PM_VERSION(4,0,0)
 #define pmID_cluster(pmid) pmid_cluster(pmid)
 #define pmID_item(pmid) pmid_item(pmid)
+#define pmInProfile __pmInProfile
 #define pmInResult __pmInResult
 #define pmNotifyErr __pmNotifyErr
 #define pmPathSeparator __pmPathSeparator
 #define pmProfile __pmProfile
 #define pmSetProgname(program) __pmSetProgname(program)
+#define pmStuffValue __pmStuffValue
 #endif
 
 /// PMDA interface version to use; defaults to "latest".
@@ -14,7 +14,11 @@
 #include "config.hpp"
 #include "types.hpp"
 
+#include <climits>
+#include <cstring>
 #include <map>
+#include <stdint.h>
+#include <vector>
 
 PCP_CPP_BEGIN_NAMESPACE
 
@@ -29,12 +33,202 @@ struct instance_info {
     std::string verbose_description; ///< Instance domain verbose description.
 };
 
+/// @cond internal
+namespace detail {
+
+// Open-addressing hash tables of an instance domain's instances, by name and
+// by ID, built from a snapshot of the domain's instances.  Copies start out
+// empty, since the snapshot's names belong to the original domain.
+class instance_lookup_table {
+
+public:
+    instance_lookup_table()
+        : generation(0), built(false)
+    {
+
+    }
+
+    instance_lookup_table(const instance_lookup_table &)
+        : generation(0), built(false)
+    {
+
+    }
+
+    instance_lookup_table &operator=(const instance_lookup_table &)
+    {
+        built = false;
+        return *this;
+    }
+
+    bool is_current(const unsigned long domain_generation) const
+    {
+        return built && (generation == domain_generation);
+    }
+
+    // Resizes the snapshot, for the caller to fill, in instance ID order.
+    pmdaInstid * prepare(const size_t count)
+    {
+        built = false;
+        instances.resize(count);
+        return instances.empty() ? NULL : &instances[0];
+    }
+
+    // Rebuilds both hash tables from the (filled) snapshot.
+    void build(const unsigned long domain_generation)
+    {
+        size_t capacity = 8;
+        while (capacity < instances.size() * 2) {
+            capacity *= 2;
+        }
+        name_slots.assign(capacity, 0);
+        id_slots.assign(capacity, 0);
+        for (size_t index = 0; index < instances.size(); ++index) {
+            // As for pmdaInstance, the first of any duplicate names wins.
+            size_t slot = find_name_slot(instances[index].i_name);
+            if (name_slots[slot] == 0) {
+                name_slots[slot] = static_cast<uint32_t>(index + 1);
+            }
+            slot = find_id_slot(instances[index].i_inst);
+            id_slots[slot] = static_cast<uint32_t>(index + 1);
+        }
+        generation = domain_generation;
+        built = true;
+    }
+
+    const pmdaInstid * find(const char * const name) const
+    {
+        const uint32_t entry = name_slots[find_name_slot(name)];
+        return (entry == 0) ? NULL : &instances[entry - 1];
+    }
+
+    const pmdaInstid * find(const instance_id_type instance_id) const
+    {
+        const uint32_t entry = id_slots[find_id_slot(instance_id)];
+        return (entry == 0) ? NULL : &instances[entry - 1];
+    }
+
+private:
+    std::vector<pmdaInstid> instances; // Snapshot of the domain's instances.
+    std::vector<uint32_t> name_slots;  // Index into instances, plus one; 0 if empty.
+    std::vector<uint32_t> id_slots;    // Index into instances, plus one; 0 if empty.
+    unsigned long generation;          // Domain generation of the snapshot.
+    bool built;                        // Whether the hash tables are valid.
+
+    // Returns the slot holding name, or else the empty slot to insert it at.
+    size_t find_name_slot(const char * const name) const
+    {
+        uint32_t hash = 2166136261u; // 32-bit FNV-1a.
+        for (const char * c = name; *c != '\0'; ++c) {
+            hash = (hash ^ static_cast<unsigned char>(*c)) * 16777619u;
+        }
+        const size_t mask = name_slots.size() - 1;
+        for (size_t slot = hash & mask; ; slot = (slot + 1) & mask) {
+            const uint32_t entry = name_slots[slot];
+            if ((entry == 0) || (strcmp(instances[entry - 1].i_name, name) == 0)) {
+                return slot;
+            }
+        }
+    }
+
+    // Returns the slot holding instance_id, or else the empty slot to insert it at.
+    size_t find_id_slot(const instance_id_type instance_id) const
+    {
+        uint32_t hash = static_cast<uint32_t>(instance_id) * 2654435761u;
+        hash ^= hash >> 16;
+        const size_t mask = id_slots.size() - 1;
+        for (size_t slot = hash & mask; ; slot = (slot + 1) & mask) {
+            const uint32_t entry = id_slots[slot];
+            if ((entry == 0) || (instances[entry - 1].i_inst == static_cast<int>(instance_id))) {
+                return slot;
+            }
+        }
+    }
+
+};
+
+} // detail namespace.
+/// @endcond
+
 /**
  * @brief Performance metric instance domain.
+ *
+ * In addition to the std::map of instances, each instance domain maintains a
+ * dense bitmap of its instance IDs, so that the pcp::pmda class
+ * can validate fetched and stored instances with a single bit test.  The
+ * std::map is inherited privately, with only its read-only members made
+ * public, so that instances can only be modified via this class's own insert,
+ * erase, clear and swap functions, which keep the bitmap in sync.
+ *
+ * Derived classes that hold their instances elsewhere, such as
+ * pcp::compact_instance_domain and pcp::cached_instance_domain, leave the
+ * std::map empty, and hide its members.  So code handling any kind of domain,
+ * via an instance_domain reference, should use contains, get_instance_count
+ * and get_instance_info, rather than the std::map members.
+ *
+ * Instance domains may be modified after the PMDA has been initialized. Each
+ * modification bumps the domain's generation (see get_generation), and the
+ * pcp::pmda class then re-syncs its pmdaIndom table from the domain at the
+ * start of the next fetch or instance request.  Modifications must be made
+ * on the PMDA's own thread, such as in pcp::pmda::begin_fetch_values.
  */
-class instance_domain : public std::map<instance_id_type, const instance_info> {
+class instance_domain : private std::map<instance_id_type, const instance_info> {
+
+    /// @brief Instances stored by std::map.
+    typedef std::map<instance_id_type, const instance_info> map_type;
 
 public:
+    /// @cond
+    typedef map_type::key_type key_type;
+    typedef map_type::mapped_type mapped_type;
+    typedef map_type::value_type value_type;
+    typedef map_type::key_compare key_compare;
+    typedef map_type::value_compare value_compare;
+    typedef map_type::allocator_type allocator_type;
+    typedef map_type::reference reference;
+    typedef map_type::const_reference const_reference;
+    typedef map_type::pointer pointer;
+    typedef map_type::const_pointer const_pointer;
+    typedef map_type::iterator iterator;
+    typedef map_type::const_iterator const_iterator;
+    typedef map_type::reverse_iterator reverse_iterator;
+    typedef map_type::const_reverse_iterator const_reverse_iterator;
+    typedef map_type::size_type size_type;
+    typedef map_type::difference_type difference_type;
+
+    // The read-only std::map members; the instances themselves are const, so
+    // even the non-const iterators cannot modify them.
+    using map_type::begin;
+    using map_type::end;
+    using map_type::rbegin;
+    using map_type::rend;
+    using map_type::empty;
+    using map_type::size;
+    using map_type::max_size;
+    using map_type::at;
+    using map_type::find;
+    using map_type::count;
+    using map_type::lower_bound;
+    using map_type::upper_bound;
+    using map_type::equal_range;
+    using map_type::key_comp;
+    using map_type::value_comp;
+    using map_type::get_allocator;
+#if __cplusplus >= 201103L
+    using map_type::cbegin;
+    using map_type::cend;
+    using map_type::crbegin;
+    using map_type::crend;
+#endif
+    /// @endcond
+
+    /**
+     * @brief Largest instance ID to be indexed by the bitmap.
+     *
+     * Instance IDs greater than this are still valid, but
+     * are checked via the slower std::map lookup instead, so that a single
+     * large instance ID cannot make the bitmap arbitrarily large.
+     */
+    static const instance_id_type max_indexed_instance_id = (1 << 20) - 1;
 
     /**
      * @brief [Default] Constructor
@@ -45,7 +239,9 @@ public:
      */
     explicit instance_domain(domain_id_type domain_id = PM_INDOM_NULL)
         : domain_id(domain_id),
-          pm_instance_domain(PM_INDOM_NULL)
+          pm_instance_domain(PM_INDOM_NULL),
+          unindexed_count(0),
+          generation(0)
     {
 
     }
@@ -180,9 +376,392 @@ public:
         return pm_instance_domain;
     }
 
+    /**
+     * @brief Does this domain contain a given instance?
+     *
+     * This is equivalent to `count(instance_id) > 0`, but for indexed
+     * instance IDs, requires only a single bit test.
+     *
+     * @param instance_id ID of the instance to check for.
+     *
+     * @return \c true if this domain contains \a instance_id, otherwise
+     *         \c false.
+     */
+    bool contains(const instance_id_type instance_id) const
+    {
+        if (is_indexed(instance_id)) {
+            const size_t word = static_cast<size_t>(instance_id) / bits_per_word;
+            return (word < index.size()) &&
+                   ((index[word] & bit_mask(instance_id)) != 0);
+        }
+        return (unindexed_count > 0) && contains_unindexed(instance_id);
+    }
+
+    /**
+     * @brief Lookup an instance by name.
+     *
+     * This is a constant-time lookup into hash tables that are built on first
+     * use, and rebuilt on first use after this domain changes.  The pcp::pmda
+     * class uses this function to resolve instance names for PCP clients.
+     *
+     * @param instance_name Name of the instance to lookup.
+     * @param instance_id   ID of the instance, if found.
+     *
+     * @return \c true if this domain contains an instance named
+     *         \a instance_name, otherwise \c false.
+     */
+    bool lookup_instance_id(const char * const instance_name,
+                            instance_id_type &instance_id) const
+    {
+        const pmdaInstid * const instance = get_lookup_table().find(instance_name);
+        if (instance == NULL) {
+            return false;
+        }
+        instance_id = instance->i_inst;
+        return true;
+    }
+
+    /**
+     * @brief Lookup an instance's name by ID.
+     *
+     * @param instance_id ID of the instance to lookup.
+     *
+     * @return The instance's name, valid until this domain next changes, or
+     *         \c NULL if this domain does not contain \a instance_id.
+     *
+     * @see lookup_instance_id
+     */
+    const char * lookup_instance_name(const instance_id_type instance_id) const
+    {
+        const pmdaInstid * const instance = get_lookup_table().find(instance_id);
+        return (instance == NULL) ? NULL : instance->i_name;
+    }
+
+    /**
+     * @brief Get this domain's generation.
+     *
+     * The generation is incremented by every change to this domain's
+     * instances, so may be compared against a previous value to cheaply tell
+     * whether the domain has changed since.
+     *
+     * @return This domain's generation.
+     */
+    unsigned long get_generation() const
+    {
+        return generation;
+    }
+
+    /**
+     * @brief Insert an instance into this domain.
+     *
+     * @param value Instance to insert.
+     *
+     * @return A pair, as per std::map::insert.
+     */
+    std::pair<iterator, bool> insert(const value_type &value)
+    {
+        const std::pair<iterator, bool> result = map_type::insert(value);
+        if (result.second) {
+            instance_added(value.first);
+        }
+        return result;
+    }
+
+    /**
+     * @brief Insert an instance into this domain.
+     *
+     * @param hint  Position hint, as per std::map::insert.
+     * @param value Instance to insert.
+     *
+     * @return An iterator to the (possibly pre-existing) instance.
+     */
+    iterator insert(const iterator hint, const value_type &value)
+    {
+        const size_type old_size = size();
+        const iterator result = map_type::insert(hint, value);
+        if (size() != old_size) {
+            instance_added(value.first);
+        }
+        return result;
+    }
+
+    /**
+     * @brief Insert a range of instances into this domain.
+     *
+     * @param first Start of the range to insert.
+     * @param last  End of the range to insert.
+     */
+    template <typename InputIterator>
+    void insert(InputIterator first, const InputIterator last)
+    {
+        for (; first != last; ++first) {
+            insert(*first);
+        }
+    }
+
+    /**
+     * @brief Remove an instance from this domain.
+     *
+     * @param position Instance to remove.
+     */
+    void erase(const iterator position)
+    {
+        const instance_id_type instance_id = position->first;
+        map_type::erase(position);
+        instance_removed(instance_id);
+    }
+
+    /**
+     * @brief Remove an instance from this domain.
+     *
+     * @param instance_id ID of the instance to remove.
+     *
+     * @return The number of instances removed (zero or one).
+     */
+    size_type erase(const instance_id_type instance_id)
+    {
+        const iterator iter = find(instance_id);
+        if (iter == end()) {
+            return 0;
+        }
+        erase(iter);
+        return 1;
+    }
+
+    /**
+     * @brief Remove a range of instances from this domain.
+     *
+     * @param first Start of the range to remove.
+     * @param last  End of the range to remove.
+     */
+    void erase(iterator first, const iterator last)
+    {
+        while (first != last) {
+            erase(first++);
+        }
+    }
+
+    /**
+     * @brief Remove all instances from this domain.
+     */
+    void clear()
+    {
+        map_type::clear();
+        instances_cleared();
+    }
+
+    /**
+     * @brief Swap instances with another instance domain.
+     *
+     * Only the instances, and their index, are swapped; the domain IDs are
+     * left unchanged, and both domains' generations are incremented.
+     *
+     * @param other Instance domain to swap instances with.
+     */
+    void swap(instance_domain &other)
+    {
+        map_type::swap(other);
+        index.swap(other.index);
+        std::swap(unindexed_count, other.unindexed_count);
+        ++generation;
+        ++other.generation;
+    }
+
+    /**
+     * @brief Destructor.
+     */
+    virtual ~instance_domain()
+    {
+
+    }
+
+    /**
+     * @brief Get the number of instances in this domain.
+     *
+     * This is equivalent to size(), but is also correct for derived classes
+     * that store their instances elsewhere, such as pcp::compact_instance_domain.
+     *
+     * @return The number of instances in this domain.
+     */
+    virtual size_type get_instance_count() const
+    {
+        return size();
+    }
+
+    /**
+     * @brief Get the full information for an instance.
+     *
+     * This function is used by the pcp::pmda class to serve, and export,
+     * instance help text.  Derived classes that store their instances
+     * elsewhere must override this function.
+     *
+     * @param instance_id ID of the instance.
+     *
+     * @throw std::out_of_range If this domain does not contain \a instance_id.
+     *
+     * @return The instance's information.
+     */
+    virtual instance_info get_instance_info(const instance_id_type instance_id) const
+    {
+        return at(instance_id);
+    }
+
+    /**
+     * @brief Get this domain's instances as PCP instance IDs and names.
+     *
+     * This function is used by the pcp::pmda class to fill its pmdaIndom
+     * tables.  The names remain valid until this domain next changes.
+     *
+     * @param instances Array of at least get_instance_count() elements to
+     *                  fill, in instance ID order.
+     */
+    virtual void get_pmda_instances(pmdaInstid * const instances) const
+    {
+        pmdaInstid * instance = instances;
+        for (const_iterator iter = begin(); iter != end(); ++iter, ++instance) {
+            instance->i_inst = iter->first;
+            instance->i_name = const_cast<char *>(iter->second.instance_name.c_str());
+        }
+    }
+
+    /**
+     * @brief Are this domain's instances held in the PMDA cache?
+     *
+     * If so, the pcp::pmda class passes an empty pmdaIndom table to pmdaInit,
+     * and leaves libpcp_pmda to serve the domain from its cache instead.
+     *
+     * @return \c true if this domain's instances are held in the PMDA cache,
+     *         otherwise \c false.
+     *
+     * @see pcp::cached_instance_domain
+     */
+    virtual bool uses_pmda_cache() const
+    {
+        return false;
+    }
+
+protected:
+
+    /**
+     * @brief Does this domain contain a given instance, not in the bitmap?
+     *
+     * Derived classes that store their instances elsewhere must override this
+     * function to search their own storage.
+     *
+     * @param instance_id ID of the instance to check for.
+     *
+     * @return \c true if this domain contains \a instance_id, otherwise
+     *         \c false.
+     */
+    virtual bool contains_unindexed(const instance_id_type instance_id) const
+    {
+        return (find(instance_id) != end());
+    }
+
+    /**
+     * @brief Record that an instance has been added to this domain.
+     *
+     * Derived classes that store their instances elsewhere must call this
+     * function for each instance they add, to keep the bitmap and generation
+     * in sync.
+     *
+     * @param instance_id ID of the instance added.
+     */
+    void instance_added(const instance_id_type instance_id)
+    {
+        add_to_index(instance_id);
+        ++generation;
+    }
+
+    /**
+     * @brief Record that an instance has been removed from this domain.
+     *
+     * @param instance_id ID of the instance removed.
+     *
+     * @see instance_added
+     */
+    void instance_removed(const instance_id_type instance_id)
+    {
+        remove_from_index(instance_id);
+        ++generation;
+    }
+
+    /**
+     * @brief Record that this domain's instance names have moved in memory.
+     *
+     * @see instance_added
+     */
+    void instances_moved()
+    {
+        ++generation;
+    }
+
+    /**
+     * @brief Record that all instances have been removed from this domain.
+     *
+     * @see instance_added
+     */
+    void instances_cleared()
+    {
+        index.clear();
+        unindexed_count = 0;
+        ++generation;
+    }
+
 private:
+    /// @brief Bitmap word type.
+    typedef unsigned long word_type;
+
+    /// @brief Number of bits in each bitmap word.
+    static const size_t bits_per_word = sizeof(word_type) * CHAR_BIT;
+
     domain_id_type domain_id;   ///< User-defined ID for this instance.
     pmInDom pm_instance_domain; ///< PCP modified ID for this instance.
+    std::vector<word_type> index; ///< Bitmap of indexed instance IDs.
+    size_type unindexed_count;    ///< Number of instances not in \a index.
+    unsigned long generation;     ///< Incremented on every change to instances.
+    mutable detail::instance_lookup_table lookup_table; ///< Lazily built name and ID hashes.
+
+    const detail::instance_lookup_table &get_lookup_table() const
+    {
+        if (!lookup_table.is_current(generation)) {
+            get_pmda_instances(lookup_table.prepare(get_instance_count()));
+            lookup_table.build(generation);
+        }
+        return lookup_table;
+    }
+
+    static bool is_indexed(const instance_id_type instance_id)
+    {
+        return (instance_id <= max_indexed_instance_id);
+    }
+
+    static word_type bit_mask(const instance_id_type instance_id)
+    {
+        return word_type(1) << (static_cast<size_t>(instance_id) % bits_per_word);
+    }
+
+    void add_to_index(const instance_id_type instance_id)
+    {
+        if (!is_indexed(instance_id)) {
+            ++unindexed_count;
+            return;
+        }
+        const size_t word = static_cast<size_t>(instance_id) / bits_per_word;
+        if (word >= index.size()) {
+            index.resize(word + 1, 0);
+        }
+        index[word] |= bit_mask(instance_id);
+    }
+
+    void remove_from_index(const instance_id_type instance_id)
+    {
+        if (!is_indexed(instance_id)) {
+            --unindexed_count;
+            return;
+        }
+        index[static_cast<size_t>(instance_id) / bits_per_word] &= ~bit_mask(instance_id);
+    }
 };
 
 } // pcp namespace.
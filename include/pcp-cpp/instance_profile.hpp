@@ -0,0 +1,194 @@
+//            Copyright Paul Colby 2013 - 2018.
+// Distributed under the Boost Software License, Version 1.0.
+//       (See accompanying file LICENSE.md or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+/**
+ * @file
+ * @brief Defines the pcp::instance_profile class.
+ */
+
+#ifndef __PCP_CPP_INSTANCE_PROFILE_HPP__
+#define __PCP_CPP_INSTANCE_PROFILE_HPP__
+
+#include "config.hpp"
+#include "types.hpp"
+
+#include <algorithm>
+#include <vector>
+
+PCP_CPP_BEGIN_NAMESPACE
+
+namespace pcp {
+
+/**
+ * @brief Decoded client instance profile.
+ *
+ * A client's instance profile determines which instances of each instance
+ * domain the client wants values for.  For each instance domain, a profile
+ * either includes, or excludes, all instances by default, with a list of
+ * instances being exceptions to that default.
+ *
+ * This class decodes a pmProfile into sorted per-domain instance lists, so
+ * that agents can cheaply check whether an instance is wanted before spending
+ * effort collecting its values.  And when a client wants only a handful of
+ * instances from a very large domain, agents can iterate over just those
+ * instances, via includes_by_default and get_exceptions.
+ *
+ * @see pmInProfile
+ */
+class instance_profile {
+
+public:
+
+    /**
+     * @brief Constructor.
+     *
+     * Constructs a profile that includes all instances.
+     */
+    instance_profile()
+        : default_state(PM_PROFILE_INCLUDE)
+    {
+
+    }
+
+    /**
+     * @brief Constructor.
+     *
+     * @param profile Profile to decode; may be \c NULL to include all
+     *                instances.
+     */
+    explicit instance_profile(const pmProfile * const profile)
+        : default_state(PM_PROFILE_INCLUDE)
+    {
+        assign(profile);
+    }
+
+    /**
+     * @brief Replace this profile with a decoded copy of \a profile.
+     *
+     * Storage from previous assignments is re-used where possible.
+     *
+     * @param profile Profile to decode; may be \c NULL to include all
+     *                instances.
+     */
+    void assign(const pmProfile * const profile)
+    {
+        if (profile == NULL) {
+            default_state = PM_PROFILE_INCLUDE;
+            domains.clear();
+            return;
+        }
+        default_state = profile->state;
+        domains.resize(profile->profile_len);
+        for (int index = 0; index < profile->profile_len; ++index) {
+            const pmInDomProfile &source = profile->profile[index];
+            domain_profile &domain = domains[index];
+            domain.indom = source.indom;
+            domain.state = source.state;
+            domain.exceptions.assign(source.instances, source.instances + source.instances_len);
+            std::sort(domain.exceptions.begin(), domain.exceptions.end());
+        }
+    }
+
+    /**
+     * @brief Is an instance included in this profile?
+     *
+     * @param indom    Instance domain of the instance to check.
+     * @param instance Instance ID to check.
+     *
+     * @return \c true if values for \a instance are wanted.
+     */
+    bool includes(const pmInDom indom, const instance_id_type instance) const
+    {
+        const domain_profile * const domain = find(indom);
+        if (domain == NULL) {
+            return (default_state == PM_PROFILE_INCLUDE);
+        }
+        const bool listed = std::binary_search(
+            domain->exceptions.begin(), domain->exceptions.end(), instance);
+        return listed == (domain->state == PM_PROFILE_EXCLUDE);
+    }
+
+    /**
+     * @brief Does this profile include every instance of every domain?
+     *
+     * @return \c true if no instances are excluded.
+     */
+    bool includes_all() const
+    {
+        if (default_state != PM_PROFILE_INCLUDE) {
+            return false;
+        }
+        for (std::vector<domain_profile>::const_iterator iter = domains.begin();
+             iter != domains.end(); ++iter) {
+            if ((iter->state != PM_PROFILE_INCLUDE) || (!iter->exceptions.empty())) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /**
+     * @brief Are unlisted instances of a domain included by default?
+     *
+     * When this returns \c false, the only instances included are those
+     * returned by get_exceptions.
+     *
+     * @param indom Instance domain to check.
+     *
+     * @return \c true if instances not returned by get_exceptions are
+     *         included.
+     */
+    bool includes_by_default(const pmInDom indom) const
+    {
+        const domain_profile * const domain = find(indom);
+        return (domain == NULL) ? (default_state == PM_PROFILE_INCLUDE)
+                                : (domain->state == PM_PROFILE_INCLUDE);
+    }
+
+    /**
+     * @brief Get the instances that are exceptions to a domain's default.
+     *
+     * @param indom Instance domain to get exceptions for.
+     *
+     * @return Sorted instance IDs that are excluded, if includes_by_default
+     *         returns \c true, otherwise included.
+     */
+    const std::vector<instance_id_type> &get_exceptions(const pmInDom indom) const
+    {
+        static const std::vector<instance_id_type> none;
+        const domain_profile * const domain = find(indom);
+        return (domain == NULL) ? none : domain->exceptions;
+    }
+
+private:
+    /// @brief Decoded profile for a single instance domain.
+    struct domain_profile {
+        pmInDom indom;                            ///< Instance domain.
+        int state;                                ///< PM_PROFILE_INCLUDE or PM_PROFILE_EXCLUDE.
+        std::vector<instance_id_type> exceptions; ///< Sorted instances listed in the profile.
+    };
+
+    int default_state;                   ///< State for domains not in the profile.
+    std::vector<domain_profile> domains; ///< Per-domain profiles.
+
+    const domain_profile * find(const pmInDom indom) const
+    {
+        // Profiles rarely list more than a few domains, so a linear scan wins.
+        for (std::vector<domain_profile>::const_iterator iter = domains.begin();
+             iter != domains.end(); ++iter) {
+            if (iter->indom == indom) {
+                return &*iter;
+            }
+        }
+        return NULL;
+    }
+
+};
+
+} // pcp namespace.
+
+PCP_CPP_END_NAMESPACE
+
+#endif
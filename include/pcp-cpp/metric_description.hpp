@@ -13,6 +13,7 @@
 
 #include "config.hpp"
 #include "exception.hpp"
+#include "metric_source.hpp"
 #include "types.hpp"
 
 #include <assert.h>
@@ -63,6 +64,7 @@ struct metric_description {
     std::string verbose_description;  ///< This metric's verbose description.
     void * const opaque;              ///< Opaque value to track with this metric.
     metric_flags flags;               ///< Optional flags for this metric.
+    metric_source source;             ///< Optional source to read values from.
 
     /**
      * @brief Constructor
@@ -76,6 +78,11 @@ struct metric_description {
      * @param verbose_description Verbose description.
      * @param opaque              Opaque value to track.
      * @param flags               Optional metric flags.
+     * @param source              Optional source to read values from, instead
+     *                            of calling the PMDA's fetch_value function.
+     *
+     * @throw pcp::exception If \a source's values cannot be converted to
+     *                       \a type.
      */
     metric_description(const std::string &metric_name,
                        const atom_type_type type,
@@ -85,7 +92,8 @@ struct metric_description {
                        const std::string &short_description = std::string(),
                        const std::string &verbose_description = std::string(),
                        void * const opaque = NULL,
-                       const metric_flags flags = static_cast<metric_flags>(0))
+                       const metric_flags flags = static_cast<metric_flags>(0),
+                       const metric_source &source = metric_source())
         : metric_name(metric_name),
           type(type),
           semantic(semantic),
@@ -94,9 +102,10 @@ struct metric_description {
           short_description(short_description),
           verbose_description(verbose_description),
           opaque(opaque),
-          flags(flags)
+          flags(flags),
+          source(source)
     {
-
+        this->source.resolve(type);
     }
 
     /**
@@ -263,6 +272,46 @@ public:
         return *this;
     }
 
+    /**
+     * @brief Bound metric insertion functor.
+     *
+     * This functor allows for chained insertion of metrics into this cluster,
+     * with values read directly from \a source.
+     *
+     * @param item_id             ID for the metric being inserted.
+     * @param metric_name         Metric name.
+     * @param type                Atom type.
+     * @param semantic            PCP semantic.
+     * @param units               PCP units.
+     * @param source              Source to read values from.
+     * @param domain              Optional instance domain.
+     * @param short_description   Short description.
+     * @param verbose_description Verbose description.
+     * @param opaque              Opaque value to track.
+     * @param flags               Optional metric flags.
+     *
+     * @return A reference to this metric cluster.
+     *
+     * @see pcp::bind_to
+     */
+    metric_cluster& operator()(const item_id_type item_id,
+                               const std::string &metric_name,
+                               const atom_type_type type,
+                               const semantic_type semantic,
+                               const pmUnits &units,
+                               const metric_source &source,
+                               instance_domain * const domain = NULL,
+                               const std::string &short_description = std::string(),
+                               const std::string &verbose_description = std::string(),
+                               void * const opaque = NULL,
+                               const metric_flags flags = static_cast<metric_flags>(0))
+    {
+        insert(value_type(item_id, metric_description(metric_name, type, semantic,
+            units, domain, short_description, verbose_description, opaque,
+            flags, source)));
+        return *this;
+    }
+
 private:
     const cluster_id_type cluster_id; ///< The ID of this cluster.
     const std::string cluster_name;   ///< The name of this cluster.
@@ -445,6 +494,108 @@ public:
         return *this;
     }
 
+    /**
+     * @brief Bound metric description insertion functor.
+     *
+     * This functor inserts a metric description, with values read directly
+     * from \a source, in the most recently inserted cluster.  For example:
+     * @code
+     * (0, "numfetch", pcp::type<uint32_t>(), PM_SEM_COUNTER,
+     *     pcp::units(0,0,1, 0,0,PM_COUNT_ONE), pcp::bind_to(&numfetch))
+     * @endcode
+     *
+     * The cluster insertion function must be called at least once prior to
+     * calling this, or any of the other metric description insertion functors,
+     * otherwise an exception will be throw.
+     *
+     * @param item_id             Metric ID.
+     * @param metric_name         Metric name.
+     * @param type                Metric atom type.
+     * @param semantic            PCP metric semantic.
+     * @param units               PCP metric units.
+     * @param source              Source to read values from.
+     * @param flags               Optional metric flags.
+     * @param domain              Optional metric instance domain.
+     * @param short_description   Short metric description.
+     * @param verbose_description Verbose metric description.
+     * @param opaque              Optional opaque pointer to track.
+     *
+     * @throw pcp::exception If no metric cluster has been inserted yet.
+     *
+     * @return A reference to this metrics_description object.
+     *
+     * @see pcp::bind_to
+     */
+    metrics_description& operator()(const item_id_type item_id,
+                                    const std::string &metric_name,
+                                    const atom_type_type type,
+                                    const semantic_type semantic,
+                                    const pmUnits &units,
+                                    const metric_source &source,
+                                    const metric_flags flags,
+                                    instance_domain * const domain = NULL,
+                                    const std::string &short_description = std::string(),
+                                    const std::string &verbose_description = std::string(),
+                                    void * const opaque = NULL)
+    {
+        if (most_recent_cluster == end()) {
+            throw pcp::exception(PM_ERR_GENERIC, "no cluster to add metric to");
+        }
+        most_recent_cluster->second(item_id, metric_name, type, semantic,
+                                    units, source, domain, short_description,
+                                    verbose_description, opaque, flags);
+        return *this;
+    }
+
+    /**
+     * @brief Bound metric description insertion functor.
+     *
+     * This functor inserts a metric description, with values read directly
+     * from \a source, in the most recently inserted cluster.
+     *
+     * The cluster insertion function must be called at least once prior to
+     * calling this, or any of the other metric description insertion functors,
+     * otherwise an exception will be throw.
+     *
+     * @param item_id             Metric ID.
+     * @param metric_name         Metric name.
+     * @param type                Metric atom type.
+     * @param semantic            PCP metric semantic.
+     * @param units               PCP metric units.
+     * @param source              Source to read values from.
+     * @param domain              Optional metric instance domain.
+     * @param short_description   Short metric description.
+     * @param verbose_description Verbose metric description.
+     * @param opaque              Optional opaque pointer to track.
+     * @param flags               Optional metric flags.
+     *
+     * @throw pcp::exception If no metric cluster has been inserted yet.
+     *
+     * @return A reference to this metrics_description object.
+     *
+     * @see pcp::bind_to
+     */
+    metrics_description& operator()(const item_id_type item_id,
+                                    const std::string &metric_name,
+                                    const atom_type_type type,
+                                    const semantic_type semantic,
+                                    const pmUnits &units,
+                                    const metric_source &source,
+                                    instance_domain * const domain = NULL,
+                                    const std::string &short_description = std::string(),
+                                    const std::string &verbose_description = std::string(),
+                                    void * const opaque = NULL,
+                                    const metric_flags flags = static_cast<metric_flags>(0))
+    {
+        if (most_recent_cluster == end()) {
+            throw pcp::exception(PM_ERR_GENERIC, "no cluster to add metric to");
+        }
+        most_recent_cluster->second(item_id, metric_name, type, semantic,
+                                    units, source, domain, short_description,
+                                    verbose_description, opaque, flags);
+        return *this;
+    }
+
 private:
     iterator most_recent_cluster; ///< The most-recently inserted cluster.
 };
@@ -0,0 +1,335 @@
+//            Copyright Paul Colby 2013 - 2018.
+// Distributed under the Boost Software License, Version 1.0.
+//       (See accompanying file LICENSE.md or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+/**
+ * @file
+ * @brief Defines the pcp::metric_source class, and pcp::bind_to functions.
+ */
+
+#ifndef __PCP_CPP_METRIC_SOURCE_HPP__
+#define __PCP_CPP_METRIC_SOURCE_HPP__
+
+#include "atom.hpp"
+#include "config.hpp"
+#include "exception.hpp"
+#include "types.hpp"
+
+#if __cplusplus >= 201103L
+#include <atomic>
+#include <memory>
+#include <utility>
+#endif
+
+PCP_CPP_BEGIN_NAMESPACE
+
+namespace pcp {
+
+/**
+ * @brief Source of a metric's value, read directly by the PMDA framework.
+ *
+ * A metric bound to a source (via one of the pcp::bind_to functions) is
+ * served by reading the source, without calling the PMDA's fetch_value or
+ * fetch_values functions.  When a numeric source is registered with a metric,
+ * its atom conversion is resolved (and validated) once, so that each read is
+ * a single call through a function pointer, with no runtime type switch.
+ *
+ * Sources do not own the variables (or functions) they read, so those must
+ * outlive the metrics bound to them.  A bound metric reports the same value
+ * for every instance, so sources are typically used for singular metrics.
+ *
+ * @see pcp::bind_to
+ */
+class metric_source {
+
+public:
+
+    /**
+     * @brief Constructor.
+     *
+     * Constructs an unbound source.
+     */
+    metric_source()
+        : reader(NULL), resolver(NULL)
+    {
+        target.object = NULL;
+    }
+
+    /**
+     * @brief Is this source bound to a value?
+     *
+     * @return \c true if this source is bound, otherwise \c false.
+     */
+    bool is_bound() const
+    {
+        return (reader != NULL);
+    }
+
+    /**
+     * @brief Read this source's current value.
+     *
+     * @param type Atom type to convert the value to.
+     *
+     * @throw pcp::exception If the value cannot be converted to \a type.
+     *
+     * @return The current value.
+     */
+    pmAtomValue read(const atom_type_type type) const
+    {
+        return reader(target, type);
+    }
+
+    /**
+     * @brief Resolve this source's atom conversion for a metric's type.
+     *
+     * Called by metric_description when the source is registered, so that
+     * subsequent reads convert directly to \a type.  Sources of non-numeric
+     * values are left unchanged.
+     *
+     * @param type Atom type that this source will be read as.
+     *
+     * @throw pcp::exception If this source's values cannot be converted to
+     *                       \a type.
+     */
+    void resolve(const atom_type_type type)
+    {
+        if (resolver != NULL) {
+            reader = resolver(type);
+        }
+    }
+
+    /// @cond internal
+    /// @brief Type-erased variable, or function, to read.
+    union target_type {
+        const volatile void * object; ///< Variable to read.
+        void (*function)();           ///< Getter function to call.
+    };
+
+    /// @brief Function to read, and convert, a target's value.
+    typedef pmAtomValue (*reader_type)(const target_type &target,
+                                       const atom_type_type type);
+
+    /// @brief Function to choose a reader for a fixed atom type.
+    typedef reader_type (*resolver_type)(const atom_type_type type);
+
+    metric_source(const reader_type reader, const resolver_type resolver,
+                  const target_type &target)
+        : reader(reader), resolver(resolver), target(target)
+    {
+
+    }
+
+#if __cplusplus >= 201103L
+    metric_source(const reader_type reader, const resolver_type resolver,
+                  const std::shared_ptr<void> &owner)
+        : reader(reader), resolver(resolver), owner(owner)
+    {
+        target.object = owner.get();
+    }
+#endif
+    /// @endcond
+
+private:
+    reader_type reader;          ///< Reads the target; \c NULL if unbound.
+    resolver_type resolver;      ///< Resolves type-specific readers; may be \c NULL.
+    target_type target;          ///< Variable, or function, to read.
+#if __cplusplus >= 201103L
+    std::shared_ptr<void> owner; ///< Owns copied getter functors.
+#endif
+
+};
+
+/// @cond internal
+namespace detail {
+
+// Each getter policy reads a value of type value_type from a target.
+
+template <typename ValueType>
+struct variable_getter {
+    typedef ValueType value_type;
+    static ValueType get(const metric_source::target_type &target)
+    {
+        return *static_cast<const volatile ValueType *>(target.object);
+    }
+};
+
+template <typename ValueType>
+struct function_getter {
+    typedef ValueType value_type;
+    static ValueType get(const metric_source::target_type &target)
+    {
+        return reinterpret_cast<ValueType (*)()>(target.function)();
+    }
+};
+
+#if __cplusplus >= 201103L
+template <typename ValueType>
+struct atomic_getter {
+    typedef ValueType value_type;
+    static ValueType get(const metric_source::target_type &target)
+    {
+        return static_cast<const volatile std::atomic<ValueType> *>(
+            target.object)->load(std::memory_order_relaxed);
+    }
+};
+
+template <typename Getter>
+struct functor_getter {
+    typedef decltype(std::declval<Getter &>()()) value_type;
+    static value_type get(const metric_source::target_type &target)
+    {
+        // The functor is a private copy, so may be mutable.
+        return (*static_cast<Getter *>(const_cast<void *>(target.object)))();
+    }
+};
+#endif
+
+// Reads via the runtime atom type switch.
+template <typename Getter>
+pmAtomValue read(const metric_source::target_type &target, const atom_type_type type)
+{
+    return pcp::atom(type, Getter::get(target));
+}
+
+// Reads via a compile-time atom type.
+template <typename Getter, int Type>
+pmAtomValue read_as(const metric_source::target_type &target, const atom_type_type)
+{
+    return pcp::atom<Type>(Getter::get(target));
+}
+
+// Resolves numeric values to compile-time conversions.
+template <typename Getter, typename ValueType = typename Getter::value_type>
+struct resolver {
+    static metric_source::reader_type resolve(const atom_type_type type)
+    {
+        switch (type) {
+            case PM_TYPE_32:     return &read_as<Getter, PM_TYPE_32>;
+            case PM_TYPE_U32:    return &read_as<Getter, PM_TYPE_U32>;
+            case PM_TYPE_64:     return &read_as<Getter, PM_TYPE_64>;
+            case PM_TYPE_U64:    return &read_as<Getter, PM_TYPE_U64>;
+            case PM_TYPE_FLOAT:  return &read_as<Getter, PM_TYPE_FLOAT>;
+            case PM_TYPE_DOUBLE: return &read_as<Getter, PM_TYPE_DOUBLE>;
+            default:
+                throw pcp::exception(PM_ERR_TYPE);
+        }
+    }
+};
+
+// Non-numeric values keep the runtime conversion.
+template <typename Getter>
+struct resolver<Getter, char *> {
+    static metric_source::reader_type resolve(const atom_type_type)
+    {
+        return &read<Getter>;
+    }
+};
+
+template <typename Getter>
+struct resolver<Getter, pmValueBlock *> {
+    static metric_source::reader_type resolve(const atom_type_type)
+    {
+        return &read<Getter>;
+    }
+};
+
+template <typename Getter>
+metric_source make_source(const metric_source::target_type &target)
+{
+    return metric_source(&read<Getter>, &resolver<Getter>::resolve, target);
+}
+
+} // detail namespace.
+/// @endcond
+
+/**
+ * @brief Bind a metric to a variable.
+ *
+ * For example:
+ * @code
+ * (0, "numfetch", pcp::type<uint32_t>(), PM_SEM_COUNTER,
+ *     pcp::units(0,0,1, 0,0,PM_COUNT_ONE), pcp::bind_to(&numfetch))
+ * @endcode
+ *
+ * @tparam ValueType Type of the variable; see pcp::atom.
+ *
+ * @param variable Variable to read on each fetch; must outlive the metric.
+ *
+ * @return A source reading \a variable.
+ */
+template <typename ValueType>
+metric_source bind_to(const volatile ValueType * const variable)
+{
+    metric_source::target_type target;
+    target.object = variable;
+    return detail::make_source<detail::variable_getter<ValueType> >(target);
+}
+
+/**
+ * @brief Bind a metric to a getter function.
+ *
+ * @tparam ValueType Type returned by \a getter; see pcp::atom.
+ *
+ * @param getter Function to call on each fetch.
+ *
+ * @return A source calling \a getter.
+ */
+template <typename ValueType>
+metric_source bind_to(ValueType (* const getter)())
+{
+    metric_source::target_type target;
+    target.function = reinterpret_cast<void (*)()>(getter);
+    return detail::make_source<detail::function_getter<ValueType> >(target);
+}
+
+#if __cplusplus >= 201103L
+/**
+ * @brief Bind a metric to an atomic variable.
+ *
+ * The variable is read with relaxed memory ordering, which suits counters
+ * updated by other threads.
+ *
+ * @note This function is only available when building with C++11 or later.
+ *
+ * @tparam ValueType Type held by the variable; see pcp::atom.
+ *
+ * @param variable Variable to read on each fetch; must outlive the metric.
+ *
+ * @return A source reading \a variable.
+ */
+template <typename ValueType>
+metric_source bind_to(const volatile std::atomic<ValueType> * const variable)
+{
+    metric_source::target_type target;
+    target.object = variable;
+    return detail::make_source<detail::atomic_getter<ValueType> >(target);
+}
+
+/**
+ * @brief Bind a metric to a getter functor, such as a lambda.
+ *
+ * The functor is copied, and the copy is shared by all copies of the source.
+ *
+ * @note This function is only available when building with C++11 or later.
+ *
+ * @tparam Getter Callable type, returning a type supported by pcp::atom.
+ *
+ * @param getter Functor to call on each fetch.
+ *
+ * @return A source calling (a copy of) \a getter.
+ */
+template <typename Getter>
+metric_source bind_getter(Getter getter)
+{
+    typedef detail::functor_getter<Getter> getter_type;
+    return metric_source(&detail::read<getter_type>, &detail::resolver<getter_type>::resolve,
+                         std::make_shared<Getter>(std::move(getter)));
+}
+#endif
+
+} // pcp namespace.
+
+PCP_CPP_END_NAMESPACE
+
+#endif
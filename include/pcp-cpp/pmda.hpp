@@ -12,20 +12,29 @@
 #ifndef __PCP_CPP_PMDA_HPP__
 #define __PCP_CPP_PMDA_HPP__
 
+#include "atom.hpp"
 #include "config.hpp"
 #include "exception.hpp"
 #include "instance_domain.hpp"
+#include "instance_profile.hpp"
 #include "metric_description.hpp"
+#include "static_schema.hpp"
+#include "string_arena.hpp"
+#include "units.hpp"
+#include "value_block.hpp"
 
 #include <algorithm>
 #include <fstream>
 #include <iostream>
+#include <limits>
+#include <new>
 #include <set>
 #include <sstream>
 #include <stack>
 #include <stdexcept>
 #include <stdint.h>
 #include <string>
+#include <time.h>
 #include <vector>
 
 PCP_CPP_BEGIN_NAMESPACE
@@ -54,6 +63,10 @@ public:
      * }
      * @endcode
      *
+     * A single DSO may host more than one PMDA, by calling this function once
+     * from each of its DSO entry points.  Each PMDA registers itself against
+     * its own PMDA extension, so callbacks are routed to the right instance.
+     *
      * @param interface PMDA interface point provided by PCP as part of the DSO
      *                  initialisation process.
      */
@@ -117,18 +130,60 @@ protected:
      */
     struct fetch_value_result {
         pmAtomValue atom; ///< Atom value.
-        int code; ///< PMDA fetch code describing atom's memory allocation.
+        int code; ///< PMDA fetch code describing atom's memory allocation, or
+                  ///< a negative PCP error code.
 
         /**
          * @brief Constructor.
          *
          * @param atom PCP atom value.
          * @param code Optional code to return to PCP. Should be one of the
-         *             PMDA_FETCH_* constants.
+         *             PMDA_FETCH_* constants, or a negative PCP error code.
          */
         fetch_value_result(const pmAtomValue &atom,
                            const int code = PMDA_FETCH_STATIC)
             : atom(atom), code(code) { }
+
+        /**
+         * @brief Create a result indicating that no value is available.
+         *
+         * This is equivalent to throwing `pcp::exception(PMDA_FETCH_NOVALUES)`
+         * but without the cost of constructing and unwinding an exception,
+         * so is preferable for sparse metrics.
+         *
+         * @return A result with code `PMDA_FETCH_NOVALUES`.
+         */
+        static fetch_value_result no_value()
+        {
+            return error(PMDA_FETCH_NOVALUES);
+        }
+
+        /**
+         * @brief Create a result indicating that an error occurred.
+         *
+         * This is equivalent to throwing `pcp::exception(pm_error_code)`,
+         * except that no error message is logged.
+         *
+         * @param pm_error_code PCP error code.
+         *
+         * @return A result with code \a pm_error_code.
+         */
+        static fetch_value_result error(const int pm_error_code)
+        {
+            pmAtomValue atom;
+            atom.ull = 0;
+            return fetch_value_result(atom, pm_error_code);
+        }
+
+        /**
+         * @brief Does this result hold a value?
+         *
+         * @return \c true if this result holds a value, otherwise \c false.
+         */
+        bool has_value() const
+        {
+            return (code > PMDA_FETCH_NOVALUES);
+        }
     };
 
     /**
@@ -144,18 +199,193 @@ protected:
         void * opaque;             ///< Opaque pointer.
     };
 
+    /**
+     * @brief Flattened details of a supported metric.
+     *
+     * These entries are held in a flat table, built by initialize_pmda, so that
+     * the per-value fetch, store and text paths can resolve a metric without
+     * walking the supported_metrics maps.
+     *
+     * @see lookup_metric
+     */
+    struct metric_lookup_entry {
+        const metric_description * description; ///< Full description; \c NULL if unsupported.
+        instance_domain * domain;                ///< Optional instance domain.
+        atom_type_type type;                     ///< Atom type.
+        metric_flags flags;                      ///< Metric flags.
+        const metric_source * source;            ///< Bound value source; \c NULL if unbound.
+        const pmdaIndom * static_domain;         ///< Static instance domain; see get_static_schema.
+        const pmdaIndom * indom_table;           ///< Instance domain table passed to pmdaInit, if any.
+        const instance_domain * static_index;    ///< Bitmap index of \a static_domain's instance IDs.
+    };
+
+    /**
+     * @brief Values of a single metric, to be filled in by fetch_values.
+     *
+     * The \c instances, \c atoms and \c codes arrays each hold \c count
+     * elements, and are owned by the pcp::pmda base class.
+     *
+     * @see fetch_values
+     */
+    struct metric_values {
+        cluster_id_type cluster;            ///< Cluster ID.
+        item_id_type item;                  ///< Item ID.
+        atom_type_type type;                ///< Expected atom type.
+        void * opaque;                      ///< Opaque pointer.
+        size_t count;                       ///< Number of values requested.
+        const instance_id_type * instances; ///< Requested instance IDs.
+        pmAtomValue * atoms;                ///< Atom values to fill in.
+        int * codes;                        ///< PMDA fetch codes; initially PMDA_FETCH_STATIC.
+
+        /**
+         * @brief Set all requested values from an array indexed by instance ID.
+         *
+         * Converts \c values[instance] for every requested instance in bulk,
+         * via pcp::atoms.  Instances not less than \a value_count are given
+         * no value.  Singular metrics (with the PM_IN_NULL instance) are
+         * set from \c values[0].
+         *
+         * For example, to serve per-CPU counters held in a vector:
+         * @code
+         * iter->assign(ticks.empty() ? NULL : &ticks[0], ticks.size());
+         * @endcode
+         *
+         * @param values      Numeric values, indexed by instance ID.
+         * @param value_count Number of \a values.
+         *
+         * @throw pcp::exception If \a ValueType cannot be converted to \c type.
+         */
+        template <typename ValueType>
+        void assign(const ValueType * const values, const size_t value_count) const
+        {
+            if ((count == 1) && (instances[0] == PM_IN_NULL)) {
+                if (value_count > 0) {
+                    pcp::atoms(type, values, 1, atoms);
+                } else {
+                    codes[0] = PMDA_FETCH_NOVALUES;
+                }
+                return;
+            }
+
+            // Typically all instances are requested, and instance IDs are
+            // dense, so most (if not all) values can be converted as-is.
+            size_t contiguous = 0;
+            while ((contiguous < count) && (contiguous < value_count) &&
+                   (instances[contiguous] == contiguous)) {
+                ++contiguous;
+            }
+            pcp::atoms(type, values, contiguous, atoms);
+            if (contiguous == count) {
+                return;
+            }
+
+            // Gather the rest, omitting any out of range.
+            size_t in_range = contiguous;
+            for (size_t index = contiguous; index < count; ++index) {
+                if (instances[index] < value_count) {
+                    ++in_range;
+                } else {
+                    codes[index] = PMDA_FETCH_NOVALUES;
+                }
+            }
+            if (in_range == count) {
+                pcp::atoms(type, values, instances + contiguous, count - contiguous,
+                           atoms + contiguous);
+                return;
+            }
+            for (size_t index = contiguous; index < count; ++index) {
+                if (instances[index] < value_count) {
+                    pcp::atoms(type, values, instances + index, 1, atoms + index);
+                }
+            }
+        }
+    };
+
+    /**
+     * @brief Metrics requested by a single fetch, as passed to
+     *        begin_fetch_values(const fetch_request &).
+     */
+    struct fetch_request {
+        std::vector<cluster_id_type> clusters; ///< Requested clusters, sorted and unique.
+        std::vector<pmID> metrics;             ///< Requested metrics, sorted and unique.
+
+        /**
+         * @brief Does this request include any metrics from a cluster?
+         *
+         * @param cluster Cluster ID to check for.
+         *
+         * @return \c true if \a cluster was requested.
+         */
+        bool includes(const cluster_id_type cluster) const
+        {
+            return std::binary_search(clusters.begin(), clusters.end(), cluster);
+        }
+
+        /**
+         * @brief Does this request include a metric?
+         *
+         * @param cluster Cluster ID of the metric to check for.
+         * @param item    Item ID of the metric to check for.
+         *
+         * @return \c true if the metric was requested.
+         */
+        bool includes(const cluster_id_type cluster, const item_id_type item) const
+        {
+            return std::binary_search(metrics.begin(), metrics.end(),
+                                      PMDA_PMID(cluster, item), &compare_metrics);
+        }
+
+        /**
+         * @brief Order metric IDs by cluster, then item, ignoring domain.
+         *
+         * @param a First metric ID to compare.
+         * @param b Second metric ID to compare.
+         *
+         * @return \c true if \a a sorts before \a b.
+         */
+        static bool compare_metrics(const pmID a, const pmID b)
+        {
+            return (pmID_cluster(a) < pmID_cluster(b)) ||
+                   ((pmID_cluster(a) == pmID_cluster(b)) && (pmID_item(a) < pmID_item(b)));
+        }
+    };
+
     /// @brief  A simple vector of strings.
     typedef std::vector<std::string> string_vector;
 
+    /**
+     * @brief Constructor.
+     */
+    pmda()
+        : schema(NULL),
+          default_refresh_interval(0),
+          last_refresh(0),
+          refreshed(false),
+          profile_generation(complete_profile),
+          profile_changes(0),
+          batch_result(NULL),
+          batch_result_capacity(0),
+          batch_any_sources(false),
+          self_instrumented(false),
+          self_cluster(0),
+          self_operations(0xFFFD),
+          self_exceptions(0xFFFE),
+          self_latency_buckets(0xFFFF)
+    {
+        memset(&self_counters, 0, sizeof(self_counters));
+    }
+
     /**
      * @brief Destructor.
      */
     virtual ~pmda()
     {
+        unregister_instance();
         while (!free_on_destruction.empty()) {
             free(free_on_destruction.top());
             free_on_destruction.pop();;
         }
+        free(batch_result);
     }
 
     /**
@@ -169,6 +399,20 @@ protected:
         return instance;
     }
 
+    /**
+     * @brief Get the PMDA instance to handle a fetch callback.
+     *
+     * libpcp's fetch callbacks do not identify the PMDA extension being
+     * fetched, so this is the instance currently handling a fetch request, if
+     * any, otherwise the same as get_instance().
+     *
+     * @return A pointer to the PMDA instance to handle a fetch callback.
+     */
+    static pmda * get_fetch_callback_instance() {
+        pmda * const agent = get_fetching_instance();
+        return (agent == NULL) ? instance : agent;
+    }
+
     /**
      * @brief Set the single PMDA instance.
      *
@@ -190,6 +434,65 @@ protected:
         return old_instance;
     }
 
+    /**
+     * @brief Get the PMDA instance registered for a PMDA extension.
+     *
+     * Each PMDA registers itself against its pmdaExt struct when initialized
+     * (see register_instance), which allows more than one PMDA to be hosted
+     * in the same process, such as several DSO agents in a single library.
+     * All static callbacks use this function to route requests to the right
+     * PMDA instance.
+     *
+     * Registered PMDAs are searched linearly, since there are typically only a
+     * few of them, so the single-PMDA case costs a single comparison.
+     *
+     * @param pmda The PMDA extension to get the PMDA instance for.
+     *
+     * @return A pointer to the PMDA instance registered for \a pmda, if any,
+     *         otherwise the same as get_instance().
+     *
+     * @see register_instance
+     */
+    static pmda * get_instance(const pmdaExt * const pmda) {
+        const std::vector<registered_instance> &instances = get_registered_instances();
+        for (std::vector<registered_instance>::const_iterator iter = instances.begin();
+             iter != instances.end(); ++iter) {
+            if (iter->extension == pmda) {
+                return iter->agent;
+            }
+        }
+        return instance;
+    }
+
+    /**
+     * @brief Register this PMDA instance for a PMDA extension.
+     *
+     * This function is called by initialize_pmda, once pmdaInit has set up
+     * \a pmda.  Instances are unregistered automatically on destruction.
+     *
+     * @note Like set_instance, this function is not thread safe, and is only
+     *       intended to be called while initializing PMDAs.
+     *
+     * @param pmda The PMDA extension to route callbacks from.
+     *
+     * @see get_instance(const pmdaExt *)
+     */
+    void register_instance(const pmdaExt * const pmda) {
+        if (pmda == NULL) {
+            return;
+        }
+        std::vector<registered_instance> &instances = get_registered_instances();
+        for (std::vector<registered_instance>::iterator iter = instances.begin();
+             iter != instances.end(); ++iter) {
+            if (iter->extension == pmda) {
+                iter->agent = this;
+                return;
+            }
+        }
+        const registered_instance registration = { pmda, this };
+        instances.push_back(registration);
+    }
+
 #ifndef PCP_CPP_NO_BOOST
     /**
      * @brief Get the default path to this PMDA's optional configuration file.
@@ -343,11 +646,13 @@ protected:
         pmdaMain(&interface);
 
         // Free the instance domains and metrics allocated in initialize_pmda.
-        for (int index = 0; index < interface.version.two.ext->e_nindoms; ++index) {
-            delete [] interface.version.two.ext->e_indoms[index].it_set;
+        if (schema == NULL) {
+            for (int index = 0; index < interface.version.two.ext->e_nindoms; ++index) {
+                delete [] interface.version.two.ext->e_indoms[index].it_set;
+            }
+            delete[] interface.version.two.ext->e_indoms;
+            delete[] interface.version.two.ext->e_metrics;
         }
-        delete[] interface.version.two.ext->e_indoms;
-        delete[] interface.version.two.ext->e_metrics;
     }
 
 #ifdef PCP_CPP_NO_BOOST
@@ -532,7 +837,7 @@ protected:
         #define PCP_CPP_EXPORT(type, func) \
         if (options.count("export-" type) > 0) { \
             if (supported_metrics.empty()) { \
-                supported_metrics = get_supported_metrics(); \
+                supported_metrics = get_all_supported_metrics(); \
             } \
             const string_vector &filenames = options.at("export-" type).as<string_vector>(); \
             for (string_vector::const_iterator iter = filenames.begin(); iter != filenames.end(); ++iter) { \
@@ -855,10 +1160,22 @@ protected:
      */
     virtual void initialize_pmda(pmdaInterface &interface)
     {
+        // Use the agent's compile-time tables, if it has any.
+        schema = get_static_schema();
+        if (schema != NULL) {
+            set_callbacks(interface);
+            pmdaInit(&interface, schema->indoms, schema->indom_count,
+                     schema->metrics, schema->metric_count);
+            register_instance(interface.version.two.ext);
+            build_static_metric_lookup_table();
+            return;
+        }
+
         // Setup the instance domain and metrics tables. These will be
         // assigned to members of the interface struct (by pmdaInit), so they
         // must remain valid as long as the interface does.
-        supported_metrics = get_supported_metrics();
+        supported_metrics = get_all_supported_metrics();
+        build_metric_lookup_table();
         const std::pair<size_t,size_t> counts = count_metrics(supported_metrics);
         const size_t indom_count = counts.second;
         const size_t metric_count = counts.first;
@@ -907,8 +1224,9 @@ protected:
         // Assign our callback function pointers to the interface struct.
         set_callbacks(interface);
 
-        // Initialize the PMDA interface.
+        // Initialize the PMDA interface, and route its callbacks to us.
         pmdaInit(&interface, indom_table, indom_count, metric_table, metric_count);
+        register_instance(interface.version.two.ext);
 
         // Record the pmdaIndom values as updated by pmdaInit.
         for (size_t indom_index = 0; indom_index < indom_count; ++indom_index) {
@@ -916,6 +1234,19 @@ protected:
             domain->set_pm_instance_domain(indom_table[indom_index].it_indom);
             this->instance_domains.insert(std::make_pair(domain->get_domain_id(), domain));
             this->instance_domains.insert(std::make_pair(domain->get_pm_instance_domain(), domain));
+            const synced_instance_domain synced = {
+                domain, &indom_table[indom_index],
+                static_cast<size_t>(indom_table[indom_index].it_numinst), domain->get_generation()
+            };
+            synced_instance_domains.push_back(synced);
+        }
+        for (std::vector<metric_lookup_entry>::iterator iter = metric_lookup_table.begin();
+             iter != metric_lookup_table.end(); ++iter) {
+            if (iter->domain != NULL) {
+                const std::vector<instance_domain *>::const_iterator domain =
+                    std::find(instance_domains.begin(), instance_domains.end(), iter->domain);
+                iter->indom_table = &indom_table[domain - instance_domains.begin()];
+            }
         }
 
         // Suppress a scan-build (Clang status analyzer) 'potential leak of memory' warning. This
@@ -929,6 +1260,69 @@ protected:
         #endif
     }
 
+    /**
+     * @brief Lookup a supported metric by cluster and item IDs.
+     *
+     * This is a constant-time lookup into the flat table built by
+     * initialize_pmda, so is suitable for use on per-value code paths.
+     *
+     * @param cluster Cluster ID of the metric to lookup.
+     * @param item    Item ID of the metric to lookup.
+     *
+     * @throw std::out_of_range If the metric is not supported by this PMDA.
+     *
+     * @return The flattened details of the requested metric.
+     */
+    const metric_lookup_entry &lookup_metric(const cluster_id_type cluster,
+                                             const item_id_type item) const
+    {
+        const metric_lookup_entry * const entry = find_metric(cluster, item);
+        if (entry == NULL) {
+            throw std::out_of_range("unsupported metric");
+        }
+        return *entry;
+    }
+
+    /**
+     * @brief Find a supported metric by cluster and item IDs.
+     *
+     * This is the non-throwing equivalent of lookup_metric.
+     *
+     * @param cluster Cluster ID of the metric to find.
+     * @param item    Item ID of the metric to find.
+     *
+     * @return The flattened details of the requested metric, or \c NULL if the
+     *         metric is not supported by this PMDA.
+     */
+    const metric_lookup_entry * find_metric(const cluster_id_type cluster,
+                                            const item_id_type item) const
+    {
+        if (static_cast<size_t>(cluster) + 1 < metric_lookup_offsets.size()) {
+            const size_t index = metric_lookup_offsets[cluster] + item;
+            if ((index < metric_lookup_offsets[cluster + 1]) &&
+                (metric_lookup_table[index].description != NULL)) {
+                return &metric_lookup_table[index];
+            }
+        }
+        return NULL;
+    }
+
+    /**
+     * @brief Lookup a supported metric by PMID.
+     *
+     * @param pmid PMID of the metric to lookup.
+     *
+     * @throw std::out_of_range If the metric is not supported by this PMDA.
+     *
+     * @return The flattened details of the requested metric.
+     *
+     * @see lookup_metric(cluster_id_type, item_id_type)
+     */
+    const metric_lookup_entry &lookup_metric(const pmID pmid) const
+    {
+        return lookup_metric(pmID_cluster(pmid), pmID_item(pmid));
+    }
+
     /**
      * @brief Get descriptions of all of the metrics supported by this PMDA.
      *
@@ -939,108 +1333,479 @@ protected:
      */
     virtual pcp::metrics_description get_supported_metrics() = 0;
 
+    /**
+     * @brief Get compile-time metric and instance domain tables.
+     *
+     * Derived classes whose metrics are fixed at compile time may override
+     * this function to return static tables, built with the
+     * PCP_CPP_STATIC_METRIC and PCP_CPP_STATIC_INDOM macros.  For example:
+     * @code
+     * virtual const pcp::static_schema * get_static_schema()
+     * {
+     *     static pmdaMetric metrics[] = {
+     *         PCP_CPP_STATIC_METRIC(0, 0, uint32_t, PM_INDOM_NULL, PM_SEM_COUNTER,
+     *                               PMDA_PMUNITS(0,0,1, 0,0,PM_COUNT_ONE))
+     *     };
+     *     static const pcp::static_schema schema = pcp::make_static_schema(metrics);
+     *     return &schema;
+     * }
+     * @endcode
+     *
+     * The tables are then passed directly to pmdaInit, and get_supported_metrics
+     * is never called (so may simply return an empty metrics_description).
+     * Since static tables carry no names or help text, such PMDAs must ship
+     * their own PMNS and help files, and do not support bound metrics, storable
+     * metrics, or self-instrumentation.
+     *
+     * This base implementation returns \c NULL.
+     *
+     * @return Static tables, or \c NULL to use get_supported_metrics instead.
+     *
+     * @see pcp::static_schema
+     */
+    virtual const static_schema * get_static_schema()
+    {
+        return NULL;
+    }
+
+    /**
+     * @brief Should this PMDA report metrics about its own performance?
+     *
+     * Derived classes may override this function to return \c true, in which
+     * case an extra "pmda" cluster, with ID get_self_instrumentation_cluster,
+     * is added to the supported metrics.  It reports this PMDA's fetch and
+     * value counts, callback counts and latencies (in total, and as
+     * histograms), and the number of exceptions caught, by type.  Its instance
+     * domains use IDs 0xFFFD to 0xFFFF, which the PMDA's own instance domains
+     * must therefore not use.
+     *
+     * The counters are fixed-size members updated by the PMDA thread, so the
+     * overhead is a pair of clock reads, and a few increments, per callback.
+     *
+     * This base implementation returns \c false.
+     *
+     * @return \c true to add self-instrumentation metrics, otherwise \c false.
+     */
+    virtual bool supports_self_instrumentation() const
+    {
+        return false;
+    }
+
+    /**
+     * @brief Get the cluster ID to use for self-instrumentation metrics.
+     *
+     * Derived classes may override this function if their own metrics already
+     * use the default cluster.
+     *
+     * This base implementation returns 4095, the largest cluster ID PCP
+     * supports.
+     *
+     * @return The cluster ID reserved for self-instrumentation metrics.
+     *
+     * @see supports_self_instrumentation
+     */
+    virtual cluster_id_type get_self_instrumentation_cluster() const
+    {
+        return 4095;
+    }
+
     /**
      * @brief Begin fetching values.
      *
      * Derived classes may override this function to perform any actions they
      * wish to perform at the start of each batch of fetch of metric values.
      *
+     * If any refresh intervals have been set, this function is only called
+     * when the data collected by its previous call has expired.
+     *
      * This base implementation performs no actions.
+     *
+     * @see begin_fetch_values(const fetch_request &)
+     * @see set_refresh_interval
      */
     virtual void begin_fetch_values() { }
 
     /**
-     * @brief Fetch an individual metric value.
-     *
-     * Derived classes must implment this function to fetch individual metric
-     * values.
+     * @brief Begin fetching values for a specific set of metrics.
      *
-     * If the requested metric value is not found, or some other error occurs,
-     * implementations should throw an appropriate pcp::exception, such as
-     * `pcp::exception(PMDA_FETCH_NOVALUES)`.
+     * Derived classes may override this function to collect only the data
+     * needed for the metrics being requested, instead of refreshing all of
+     * their data sources on every fetch.
      *
-     * Otherwise, the a valid atom value should be returned, encapsulated in a
-     * fetch_value_result struct.  Typically the \c code value of the returned
-     * struct should be left as `PMDA_FETCH_STATIC`. However, advanced PMDAs may
-     * use any of the `PMDA_FETCH_*` constants, such as `PMDA_FETCH_DYNAMIC`.
+     * Only metrics whose data has expired (see set_refresh_interval) are
+     * included in \a request.  Freshness is tracked per metric, so collecting
+     * only the metrics in \a request is safe; a metric is not considered
+     * fresh merely because another metric in its cluster was refreshed.  If
+     * no requested metrics have expired, this function is not called at all.
      *
-     * Note, implementations should not return `PMDA_FETCH_NOVALUES` - in that
-     * case, they should throw `pcp::exception(PMDA_FETCH_NOVALUES)` instead.
+     * This base implementation simply calls begin_fetch_values().
      *
-     * @param metric The metric to fetch the value of.
+     * @param request The clusters, and metrics, being fetched.
+     */
+    virtual void begin_fetch_values(const fetch_request &request)
+    {
+        PCP_CPP_UNUSED(request);
+        begin_fetch_values();
+    }
+
+    /**
+     * @brief Set the default minimum interval between data refreshes.
      *
-     * @throw pcp::exception on error, or if the requested metric is not
-     *                       currently available.
+     * This interval applies to all metric clusters that do not have their own
+     * interval set.  See set_refresh_interval(cluster_id_type, unsigned long)
+     * for details.
      *
-     * @return The value of the requested metric.
+     * @param milliseconds Minimum refresh interval, in milliseconds.
      */
-    virtual fetch_value_result fetch_value(const metric_id &metric) = 0;
+    void set_refresh_interval(const unsigned long milliseconds)
+    {
+        default_refresh_interval = milliseconds;
+    }
 
     /**
-     * @brief Store an in situ value.
+     * @brief Set the minimum interval between data refreshes for a cluster.
      *
-     * Derived classes may override this function to allow PCP to request metric
-     * values to be stored.
+     * Metrics that were refreshed within their cluster's minimum refresh
+     * interval are left out of the request passed to begin_fetch_values, and
+     * when every metric in a fetch was refreshed that recently,
+     * begin_fetch_values is not called at all; values are served from the
+     * previously collected data.  So when many clients, such as pmlogger, pmie
+     * and various dashboards, poll the same PMDA, collection costs scale with
+     * the refresh interval rather than with the number of clients.
      *
-     * This base implementation throws `pcp::exception(PM_ERR_PERMISSION)`.
+     * Values collected while the client's instance profile excluded some
+     * instances are only served to clients sending that same profile (see
+     * get_instance_profile), so agents may safely skip excluded instances.
      *
-     * @note Unless `PCP_CPP_NO_ID_VALIDITY_CHECKS` has been defined, this
-     *       function will not be called for any metric that did not include
-     *       the `storable_metric` flag in the get_supported_metrics result.
+     * The default interval is zero, that is, refresh on every fetch.
      *
-     * @param metric The metric to store.
-     * @param value  The value to store.
+     * @param cluster      Cluster to set the minimum refresh interval for.
+     * @param milliseconds Minimum refresh interval, in milliseconds.
      *
-     * @throw pcp::exception on error.
+     * @see get_refresh_age
      */
-    virtual void store_value(const metric_id &metric, const int &value)
+    void set_refresh_interval(const cluster_id_type cluster,
+                              const unsigned long milliseconds)
     {
-        PCP_CPP_UNUSED(metric)
-        PCP_CPP_UNUSED(value)
-        throw pcp::exception(PM_ERR_PERMISSION);
+        refresh_intervals[cluster] = milliseconds;
     }
 
+#ifndef PCP_CPP_NO_BOOST
     /**
-     * @brief Store an ex situ value.
-     *
-     * Derived classes may override this function to allow PCP to request metric
-     * values to be stored.
+     * @brief Set the default minimum interval between data refreshes.
      *
-     * This base implementation throws `pcp::exception(PM_ERR_PERMISSION)`.
-     *
-     * @note Unless `PCP_CPP_NO_ID_VALIDITY_CHECKS` has been defined, this
-     *       function will not be called for any metric that did not include
-     *       the `storable_metric` flag in the get_supported_metrics result.
+     * @note This function is only available if Boost support is enabled.
      *
-     * @param metric The metric to store.
-     * @param value  The value to store.
+     * @param interval Minimum refresh interval.
      *
-     * @throw pcp::exception on error.
+     * @see set_refresh_interval(unsigned long)
      */
-    virtual void store_value(const metric_id &metric,
-                             const pmValueBlock * const value)
+    void set_refresh_interval(const boost::posix_time::time_duration &interval)
     {
-        PCP_CPP_UNUSED(metric)
-        PCP_CPP_UNUSED(value)
-        throw pcp::exception(PM_ERR_PERMISSION);
+        set_refresh_interval(interval.total_milliseconds());
     }
 
-    /* Virtual PMDA callback functions below here. You probably don't
-     * want to override any of these, but you can if you want to. */
-
-#if PCP_CPP_PMDA_INTERFACE_VERSION >= 6
-    /// Inform the agent about security aspects of a client connection,
-    /// such as the authenticated userid.  Passed in a client identifier,
-    /// numeric PCP_ATTR, pointer to the associated value, and the length
-    /// of the value.
-    virtual int on_attribute(int ctx, int attr, const char *value,
-                             int length, pmdaExt *pmda)
+    /**
+     * @brief Set the minimum interval between data refreshes for a cluster.
+     *
+     * @note This function is only available if Boost support is enabled.
+     *
+     * @param cluster  Cluster to set the minimum refresh interval for.
+     * @param interval Minimum refresh interval.
+     *
+     * @see set_refresh_interval(cluster_id_type, unsigned long)
+     */
+    void set_refresh_interval(const cluster_id_type cluster,
+                              const boost::posix_time::time_duration &interval)
     {
-        return pmdaAttribute(ctx, attr, value, length, pmda);
+        set_refresh_interval(cluster, interval.total_milliseconds());
     }
 #endif
 
-#if PCP_CPP_PMDA_INTERFACE_VERSION >= 4
+    /**
+     * @brief Get the minimum interval between data refreshes for a cluster.
+     *
+     * @param cluster Cluster to get the minimum refresh interval for.
+     *
+     * @return The cluster's minimum refresh interval, in milliseconds.
+     */
+    unsigned long get_refresh_interval(const cluster_id_type cluster) const
+    {
+        const std::map<cluster_id_type, unsigned long>::const_iterator iter =
+            refresh_intervals.find(cluster);
+        return (iter == refresh_intervals.end()) ? default_refresh_interval : iter->second;
+    }
+
+    /**
+     * @brief Get the age of the most recently collected data.
+     *
+     * Derived classes may use this to report how stale the values being
+     * served are, such as via a metric of their own.
+     *
+     * @return Milliseconds since begin_fetch_values was last called, or the
+     *         maximum `unsigned long` value if it has not been called yet.
+     */
+    unsigned long get_refresh_age() const
+    {
+        return refreshed ? static_cast<unsigned long>(monotonic_milliseconds() - last_refresh)
+                         : std::numeric_limits<unsigned long>::max();
+    }
+
+    /**
+     * @brief Get the age of the most recently collected data for a cluster.
+     *
+     * @param cluster Cluster to get the data age for.
+     *
+     * @return Milliseconds since begin_fetch_values was last called with a
+     *         request including \a cluster, or the maximum `unsigned long`
+     *         value if it has not been yet.
+     */
+    unsigned long get_refresh_age(const cluster_id_type cluster) const
+    {
+        return ((cluster < cluster_refresh_times.size()) &&
+                (cluster_refresh_times[cluster] != never_refreshed))
+            ? static_cast<unsigned long>(monotonic_milliseconds() - cluster_refresh_times[cluster])
+            : std::numeric_limits<unsigned long>::max();
+    }
+
+    /**
+     * @brief Get the current client's instance profile.
+     *
+     * Derived classes may use this, such as in begin_fetch_values, to avoid
+     * collecting values for instances the client does not want, since such
+     * values would be dropped from the fetch result anyway.
+     *
+     * Values collected under a profile that excludes any instances are only
+     * treated as fresh (see set_refresh_interval) for fetches sent with that
+     * same profile; other clients trigger a refresh of their own.
+     *
+     * @return The instance profile most recently sent by pmcd.
+     */
+    const instance_profile &get_instance_profile() const
+    {
+        return current_profile;
+    }
+
+    /**
+     * @brief Get this PMDA's per-fetch string arena.
+     *
+     * The arena is reset at the start of each fetch, so strings stored in it
+     * may be returned from fetch_value (or fetch_values) with the default
+     * PMDA_FETCH_STATIC code, without any per-value heap allocation.  For
+     * example:
+     * @code
+     * return pcp::atom(metric.type, process->command_line, get_string_arena());
+     * @endcode
+     *
+     * @return This PMDA's string arena.
+     */
+    string_arena &get_string_arena()
+    {
+        return fetch_strings;
+    }
+
+    /**
+     * @brief Get this PMDA's per-fetch value block pool.
+     *
+     * Like the string arena, the pool is reset at the start of each fetch, so
+     * aggregate value blocks built in it may be returned from fetch_value (or
+     * fetch_values) with the default PMDA_FETCH_STATIC code.
+     *
+     * @return This PMDA's value block pool.
+     *
+     * @see pcp::value_block_pool
+     */
+    value_block_pool &get_value_block_pool()
+    {
+        return fetch_blocks;
+    }
+
+    /**
+     * @brief Fetch an individual metric value.
+     *
+     * Derived classes must implment this function to fetch individual metric
+     * values.
+     *
+     * If the requested metric value is not found, implementations should
+     * return fetch_value_result::no_value(). If some other error occurs,
+     * implementations may either return fetch_value_result::error, or throw
+     * an appropriate pcp::exception. Throwing remains supported, including
+     * `pcp::exception(PMDA_FETCH_NOVALUES)`, but is much more expensive.
+     *
+     * Otherwise, the a valid atom value should be returned, encapsulated in a
+     * fetch_value_result struct.  Typically the \c code value of the returned
+     * struct should be left as `PMDA_FETCH_STATIC`. However, advanced PMDAs may
+     * use any of the `PMDA_FETCH_*` constants, such as `PMDA_FETCH_DYNAMIC`.
+     *
+     * @param metric The metric to fetch the value of.
+     *
+     * @throw pcp::exception on error, or if the requested metric is not
+     *                       currently available.
+     *
+     * @return The value of the requested metric.
+     */
+    virtual fetch_value_result fetch_value(const metric_id &metric) = 0;
+
+    /**
+     * @brief Should metric values be fetched in batches via fetch_values?
+     *
+     * Derived classes may override this function to return \c true, in which
+     * case each fetch request is served by a single call to fetch_values,
+     * rather than via PCP's pmdaFetch function calling fetch_value once for
+     * every requested metric instance.
+     *
+     * This base implementation returns \c false.
+     *
+     * @return \c true if fetch_values should be used, otherwise \c false.
+     *
+     * @see fetch_values
+     */
+    virtual bool supports_fetch_values() const
+    {
+        return false;
+    }
+
+    /**
+     * @brief Fetch a batch of metric values.
+     *
+     * This function is only called if supports_fetch_values returns \c true.
+     * It is given every requested metric, along with all instances selected
+     * by the current client's profile, and should fill in the \c atoms array
+     * of each metric_values entry.
+     *
+     * Each value's fetch code defaults to `PMDA_FETCH_STATIC`, so values that
+     * are present need only be stored. Set a value's code to
+     * `PMDA_FETCH_NOVALUES` to omit it, `PMDA_FETCH_DYNAMIC` if the atom
+     * points to memory that should be freed once used, or to a negative PCP
+     * error code to report that error for the whole metric.
+     *
+     * This base implementation calls fetch_value once for each value, and so
+     * is mostly useful for derived classes that only handle some metrics in
+     * bulk, deferring the rest to this implementation.
+     *
+     * @param metrics The metrics to fetch the values of.
+     *
+     * @throw pcp::exception on error, in which case the entire fetch fails.
+     *
+     * @see supports_fetch_values
+     */
+    virtual void fetch_values(const std::vector<metric_values> &metrics)
+    {
+        fetch_each_value<&pmda::dispatch_fetch_value>(metrics);
+    }
+
+    /// @brief Function to fetch a single metric value from an agent.
+    typedef fetch_value_result (*fetch_value_function)(pmda &agent,
+                                                       const metric_id &metric);
+
+    /**
+     * @brief Fetch a batch of metric values, one value at a time.
+     *
+     * This is the implementation of the base fetch_values function, with the
+     * per-value fetch function fixed at compile time, so that derived classes
+     * such as pcp::basic_pmda may have calls to \a Fetch inlined.
+     *
+     * @tparam Fetch Function to fetch each individual value.
+     *
+     * @param metrics The metrics to fetch the values of.
+     */
+    template <fetch_value_function Fetch>
+    void fetch_each_value(const std::vector<metric_values> &metrics)
+    {
+        for (std::vector<metric_values>::const_iterator iter = metrics.begin();
+             iter != metrics.end(); ++iter)
+        {
+            metric_id id;
+            id.cluster = iter->cluster;
+            id.item = iter->item;
+            id.type = iter->type;
+            id.opaque = iter->opaque;
+            for (size_t index = 0; index < iter->count; ++index) {
+                id.instance = iter->instances[index];
+                try {
+                    const fetch_value_result result = Fetch(*this, id);
+                    iter->atoms[index] = result.atom;
+                    iter->codes[index] = result.code;
+                } catch (const pcp::exception &ex) {
+                    ++self_counters.exceptions[self_pcp_exception];
+                    if (ex.error_code() != PMDA_FETCH_NOVALUES) {
+                        pmNotifyErr(LOG_ERR, "%s", ex.what());
+                    }
+                    iter->codes[index] = ex.error_code();
+                } catch (const std::exception &ex) {
+                    ++self_counters.exceptions[self_std_exception];
+                    pmNotifyErr(LOG_ERR, "%s", ex.what());
+                    iter->codes[index] = PM_ERR_GENERIC;
+                }
+            }
+        }
+    }
+
+    /**
+     * @brief Store an in situ value.
+     *
+     * Derived classes may override this function to allow PCP to request metric
+     * values to be stored.
+     *
+     * This base implementation throws `pcp::exception(PM_ERR_PERMISSION)`.
+     *
+     * @note Unless `PCP_CPP_NO_ID_VALIDITY_CHECKS` has been defined, this
+     *       function will not be called for any metric that did not include
+     *       the `storable_metric` flag in the get_supported_metrics result.
+     *
+     * @param metric The metric to store.
+     * @param value  The value to store.
+     *
+     * @throw pcp::exception on error.
+     */
+    virtual void store_value(const metric_id &metric, const int &value)
+    {
+        PCP_CPP_UNUSED(metric)
+        PCP_CPP_UNUSED(value)
+        throw pcp::exception(PM_ERR_PERMISSION);
+    }
+
+    /**
+     * @brief Store an ex situ value.
+     *
+     * Derived classes may override this function to allow PCP to request metric
+     * values to be stored.
+     *
+     * This base implementation throws `pcp::exception(PM_ERR_PERMISSION)`.
+     *
+     * @note Unless `PCP_CPP_NO_ID_VALIDITY_CHECKS` has been defined, this
+     *       function will not be called for any metric that did not include
+     *       the `storable_metric` flag in the get_supported_metrics result.
+     *
+     * @param metric The metric to store.
+     * @param value  The value to store.
+     *
+     * @throw pcp::exception on error.
+     */
+    virtual void store_value(const metric_id &metric,
+                             const pmValueBlock * const value)
+    {
+        PCP_CPP_UNUSED(metric)
+        PCP_CPP_UNUSED(value)
+        throw pcp::exception(PM_ERR_PERMISSION);
+    }
+
+    /* Virtual PMDA callback functions below here. You probably don't
+     * want to override any of these, but you can if you want to. */
+
+#if PCP_CPP_PMDA_INTERFACE_VERSION >= 6
+    /// Inform the agent about security aspects of a client connection,
+    /// such as the authenticated userid.  Passed in a client identifier,
+    /// numeric PCP_ATTR, pointer to the associated value, and the length
+    /// of the value.
+    virtual int on_attribute(int ctx, int attr, const char *value,
+                             int length, pmdaExt *pmda)
+    {
+        return pmdaAttribute(ctx, attr, value, length, pmda);
+    }
+#endif
+
+#if PCP_CPP_PMDA_INTERFACE_VERSION >= 4
     /// If traverse == 0, return the names of all the descendent children
     ///     and their status, given a named metric in a dynamic subtree of
     /// the PMNS (this is the pmGetChildren or pmGetChildrenStatus variant).
@@ -1064,11 +1829,45 @@ protected:
     virtual int on_fetch(int numpmid, pmID *pmidlist, pmResult **resp,
                          pmdaExt *pmda)
     {
+        fetch_strings.reset();
+        fetch_blocks.reset();
         try {
-            begin_fetch_values();
+            const uint64_t now = monotonic_milliseconds();
+            if (build_fetch_request(now, numpmid, pmidlist)) {
+                const uint64_t start = begin_self_timing();
+                begin_fetch_values(current_fetch_request);
+                end_self_timing(self_begin_fetch_values, start);
+                for (std::vector<cluster_id_type>::const_iterator iter = current_fetch_request.clusters.begin();
+                     iter != current_fetch_request.clusters.end(); ++iter) {
+                    cluster_refresh_times[*iter] = now;
+                }
+                for (std::vector<pmID>::const_iterator iter = current_fetch_request.metrics.begin();
+                     iter != current_fetch_request.metrics.end(); ++iter) {
+                    metric_refresh * const refresh = find_metric_refresh(*iter);
+                    if (refresh != NULL) {
+                        const metric_lookup_entry &entry = metric_lookup_table[refresh - &metric_refreshes[0]];
+                        refresh->time = now;
+                        refresh->profile = ((entry.domain == NULL) && (entry.static_domain == NULL))
+                            ? complete_profile : profile_generation;
+                    }
+                }
+                last_refresh = now;
+                refreshed = true;
+            }
+            // Apply any instance changes, including those just made by
+            // begin_fetch_values, before pmdaFetch walks the indom tables.
+            sync_instance_domains();
         } catch (const pcp::exception &ex) {
+            ++self_counters.exceptions[self_pcp_exception];
             pmNotifyErr(LOG_ERR, "%s", ex.what());
             return ex.error_code();
+        } catch (const std::bad_alloc &ex) {
+            ++self_counters.exceptions[self_std_exception];
+            pmNotifyErr(LOG_ERR, "%s", ex.what());
+            return PM_ERR_GENERIC;
+        }
+        if (supports_fetch_values()) {
+            return batch_fetch(numpmid, pmidlist, resp);
         }
         return pmdaFetch(numpmid, pmidlist, resp, pmda);
     }
@@ -1076,6 +1875,28 @@ protected:
     /// @brief Fetch the value of a single metric instance.
     virtual int on_fetch_callback(pmdaMetric *mdesc, unsigned int inst,
                                   pmAtomValue *avp)
+    {
+        return fetch_callback<&pmda::dispatch_fetch_value>(mdesc, inst, avp);
+    }
+
+    /**
+     * @brief Fetch the value of a single metric instance.
+     *
+     * This is the implementation of the base on_fetch_callback function, with
+     * the fetch function fixed at compile time, so that derived classes such
+     * as pcp::basic_pmda may have calls to \a Fetch inlined.
+     *
+     * @tparam Fetch Function to fetch the value, unless it is read from a
+     *               bound source, or is a self-instrumentation metric.
+     *
+     * @param mdesc The metric to fetch.
+     * @param inst  The instance to fetch.
+     * @param avp   The atom to fetch the value into.
+     *
+     * @return A PMDA fetch callback result, as per on_fetch_callback.
+     */
+    template <fetch_value_function Fetch>
+    int fetch_callback(pmdaMetric *mdesc, unsigned int inst, pmAtomValue *avp)
     {
         try {
             // Setup the metric ID.
@@ -1087,15 +1908,23 @@ protected:
 
 #ifdef PCP_CPP_NO_ID_VALIDITY_CHECKS
             id.type = PM_TYPE_UNKNOWN;
+            const metric_lookup_entry * const metric = find_metric(id.cluster, id.item);
+            const metric_source * const source = (metric == NULL) ? NULL : metric->source;
 #else
-            const metric_description &description =
-                supported_metrics.at(id.cluster).at(id.item);
-            id.type = description.type;
-            validate_instance(description, inst);
+            const metric_lookup_entry &metric = lookup_metric(id.cluster, id.item);
+            id.type = metric.type;
+            validate_instance(metric, inst);
+            const metric_source * const source = metric.source;
 #endif
 
-            // Fetch the metric value.
-            const fetch_value_result result = fetch_value(id);
+            // Fetch the metric value, reading bound sources directly.
+            const fetch_value_result result = (source != NULL)
+                ? fetch_value_result(source->read(mdesc->m_desc.type))
+                : (self_instrumented && (id.cluster == self_cluster))
+                ? fetch_self_value(id) : Fetch(*this, id);
+            if (!result.has_value()) {
+                return result.code; // PMDA_FETCH_NOVALUES or PM_ERR_*.
+            }
             *avp = result.atom;
 #if PCP_CPP_PMDA_INTERFACE_VERSION <= 2
             return 0; // "No error" for PMDA interface 2.
@@ -1105,26 +1934,45 @@ protected:
             return result.code; // PMDA_FETCH_* values for inerfaces 5+
 #endif
         } catch (const pcp::exception &ex) {
+            ++self_counters.exceptions[self_pcp_exception];
             if (ex.error_code() != PMDA_FETCH_NOVALUES) {
                 pmNotifyErr(LOG_ERR, "%s", ex.what());
             }
             return ex.error_code();
         } catch (const std::out_of_range &ex) {
+            ++self_counters.exceptions[self_out_of_range_exception];
             pmNotifyErr(LOG_DEBUG, "%s:%d:%s %s", __FILE__, __LINE__, __FUNCTION__, ex.what());
             return PM_ERR_PMID; // Unknown or illegal metric identifier.
         } catch (const std::exception &ex) {
+            ++self_counters.exceptions[self_std_exception];
             pmNotifyErr(LOG_ERR, "%s", ex.what());
             return PM_ERR_GENERIC;
         } catch (...) {
+            ++self_counters.exceptions[self_unknown_exception];
             pmNotifyErr(LOG_ERR, "unknown exception in on_fetch_callback");
             return PM_ERR_GENERIC;
         }
     }
 
     /// @brief Return description of instances and instance domains.
+    ///
+    /// Single name-to-ID, and ID-to-name, lookups are answered from the
+    /// instance domain's hash tables; all other requests (and any lookups
+    /// that miss, such as names matched only up to their first space) are
+    /// handled by pmdaInstance.
     virtual int on_instance(pmInDom indom, int inst, char *name,
                             pmInResult **result, pmdaExt *pmda)
     {
+        try {
+            sync_instance_domains();
+            if (lookup_instance(indom, inst, name, result)) {
+                return 0;
+            }
+        } catch (const std::exception &ex) {
+            ++self_counters.exceptions[self_std_exception];
+            pmNotifyErr(LOG_ERR, "%s", ex.what());
+            return PM_ERR_GENERIC;
+        }
         return pmdaInstance(indom, inst, name, result, pmda);
     }
 
@@ -1147,7 +1995,12 @@ protected:
     /// @brief Store the instance profile away for the next fetch.
     virtual int on_profile(pmProfile *prof, pmdaExt *pmda)
     {
-        return pmdaProfile(prof, pmda);
+        const int result = pmdaProfile(prof, pmda);
+        if (result >= 0) {
+            current_profile.assign(prof);
+            profile_generation = current_profile.includes_all() ? complete_profile : ++profile_changes;
+        }
+        return result;
     }
 
     /// @brief Store a value into a metric.
@@ -1169,13 +2022,12 @@ protected:
                 for (int instance_index = 0; instance_index < value_set->numval; ++instance_index) {
                     id.instance = value_set->vlist[instance_index].inst;
 #ifndef PCP_CPP_NO_ID_VALIDITY_CHECKS
-                    const metric_description &description =
-                        supported_metrics.at(id.cluster).at(id.item);
-                    id.type = description.type;
+                    const metric_lookup_entry &metric = lookup_metric(id.cluster, id.item);
+                    id.type = metric.type;
 
-                    validate_instance(description, id.instance);
+                    validate_instance(metric, id.instance);
 
-                    if (!(description.flags & pcp::storable_metric)) {
+                    if (!(metric.flags & pcp::storable_metric)) {
                         // Metric does not support storing values.
                         throw pcp::exception(PM_ERR_PERMISSION);
                     }
@@ -1192,17 +2044,21 @@ protected:
                 return 0; // >= 0 implies success
             }
         } catch (const pcp::exception &ex) {
+            ++self_counters.exceptions[self_pcp_exception];
             if (ex.error_code() != PMDA_FETCH_NOVALUES) {
                 pmNotifyErr(LOG_ERR, "%s", ex.what());
             }
             return ex.error_code();
         } catch (const std::out_of_range &ex) {
+            ++self_counters.exceptions[self_out_of_range_exception];
             pmNotifyErr(LOG_DEBUG, "%s:%d:%s %s", __FILE__, __LINE__, __FUNCTION__, ex.what());
             return PM_ERR_PMID; // Unknown or illegal metric identifier.
         } catch (const std::exception &ex) {
+            ++self_counters.exceptions[self_std_exception];
             pmNotifyErr(LOG_ERR, "%s", ex.what());
             return PM_ERR_GENERIC;
         } catch (...) {
+            ++self_counters.exceptions[self_unknown_exception];
             pmNotifyErr(LOG_ERR, "unknown exception in on_fetch_callback");
             return PM_ERR_GENERIC;
         }
@@ -1215,8 +2071,7 @@ protected:
         try {
             const bool get_one_line = ((type & PM_TEXT_ONELINE) == PM_TEXT_ONELINE);
             if ((type & PM_TEXT_PMID) == PM_TEXT_PMID) {
-                const metric_description &description =
-                    supported_metrics.at(pmID_cluster(ident)).at(pmID_item(ident));
+                const metric_description &description = *lookup_metric(ident).description;
                 const std::string &text = get_one_line
                     ? description.short_description.empty()
                         ? description.verbose_description
@@ -1230,8 +2085,8 @@ protected:
                 *buffer = strdup(text.c_str());
                 return 0; // >= 0 implies success.
             } else if ((type & PM_TEXT_INDOM) == PM_TEXT_INDOM) {
-                const pcp::instance_info &info =
-                    instance_domains.at(pmInDom_domain(ident))->at(pmInDom_serial(ident));
+                const pcp::instance_info info = instance_domains.at(
+                    pmInDom_domain(ident))->get_instance_info(pmInDom_serial(ident));
                 const std::string &text = get_one_line
                     ? info.short_description.empty()
                         ? info.verbose_description
@@ -1248,16 +2103,20 @@ protected:
                 pmNotifyErr(LOG_NOTICE, "unknown text type 0x%x", type);
             }
         } catch (const pcp::exception &ex) {
+            ++self_counters.exceptions[self_pcp_exception];
             if (ex.error_code() != PM_ERR_TEXT) {
                 pmNotifyErr(LOG_NOTICE, "%s", ex.what());
             } else {
                 pmNotifyErr(LOG_DEBUG, "%s:%d:%s %s", __FILE__, __LINE__, __FUNCTION__, ex.what());
             }
         } catch (const std::out_of_range &ex) {
+            ++self_counters.exceptions[self_out_of_range_exception];
             pmNotifyErr(LOG_DEBUG, "%s:%d:%s %s", __FILE__, __LINE__, __FUNCTION__, ex.what());
         } catch (const std::exception &ex) {
+            ++self_counters.exceptions[self_std_exception];
             pmNotifyErr(LOG_NOTICE, "%s", ex.what());
         } catch (...) {
+            ++self_counters.exceptions[self_unknown_exception];
             pmNotifyErr(LOG_ERR, "unknown exception in on_text");
             return PM_ERR_GENERIC;
         }
@@ -1299,9 +2158,143 @@ protected:
 
 private:
     static pmda * instance;
+
+    /// @brief A PMDA instance, and the PMDA extension it is registered for.
+    struct registered_instance {
+        const pmdaExt * extension; ///< PMDA extension.
+        pmda * agent;              ///< PMDA instance handling \a extension.
+    };
+
+    // Function-local statics, so this header needs no extra definitions.
+    static std::vector<registered_instance> &get_registered_instances()
+    {
+        static std::vector<registered_instance> instances;
+        return instances;
+    }
+
+    // The instance currently within a fetch callback, since libpcp's fetch
+    // callback does not identify the PMDA extension being fetched.
+    static pmda * &get_fetching_instance()
+    {
+        static pmda * agent = NULL;
+        return agent;
+    }
+
+    // Sets the fetching instance for its lifetime, restoring the previous
+    // one afterwards, even if the fetch throws.
+    class fetching_instance_guard {
+    public:
+        explicit fetching_instance_guard(pmda * const agent)
+            : previous(get_fetching_instance())
+        {
+            get_fetching_instance() = agent;
+        }
+
+        ~fetching_instance_guard()
+        {
+            get_fetching_instance() = previous;
+        }
+
+    private:
+        pmda * const previous;
+
+        fetching_instance_guard(const fetching_instance_guard &);
+        fetching_instance_guard &operator=(const fetching_instance_guard &);
+    };
+
+    void unregister_instance()
+    {
+        std::vector<registered_instance> &instances = get_registered_instances();
+        for (std::vector<registered_instance>::iterator iter = instances.begin();
+             iter != instances.end();) {
+            iter = (iter->agent == this) ? instances.erase(iter) : (iter + 1);
+        }
+        if (get_fetching_instance() == this) {
+            get_fetching_instance() = NULL;
+        }
+    }
+
+    static fetch_value_result dispatch_fetch_value(pmda &agent, const metric_id &metric)
+    {
+        return agent.fetch_value(metric);
+    }
+
     std::stack<void *> free_on_destruction;
     std::map<pmInDom, instance_domain *> instance_domains;
 
+    /// @brief An instance domain, and the pmdaIndom last synced from it.
+    struct synced_instance_domain {
+        const instance_domain * domain; ///< Instance domain to sync from.
+        pmdaIndom * indom;              ///< pmdaIndom (as passed to pmdaInit) to sync to.
+        size_t capacity;                ///< Number of elements allocated for \a indom's \c it_set.
+        unsigned long generation;       ///< Generation of \a domain last synced.
+    };
+    std::vector<synced_instance_domain> synced_instance_domains;
+
+    std::vector<metric_lookup_entry> metric_lookup_table;
+    std::vector<size_t> metric_lookup_offsets;
+    const static_schema * schema;
+    std::vector<instance_domain> static_instance_indexes; ///< Parallel to schema->indoms.
+    std::map<cluster_id_type, unsigned long> refresh_intervals;
+    unsigned long default_refresh_interval;
+    uint64_t last_refresh;
+    bool refreshed;
+    std::vector<uint64_t> cluster_refresh_times;
+    /// @brief When, and under which instance profile, a metric was refreshed.
+    struct metric_refresh {
+        uint64_t time;         ///< Refresh time, or never_refreshed.
+        unsigned long profile; ///< profile_generation at \a time.
+    };
+    std::vector<metric_refresh> metric_refreshes; ///< Parallel to metric_lookup_table.
+    unsigned long profile_generation; ///< complete_profile, or a serial unique to current_profile.
+    unsigned long profile_changes;
+    fetch_request current_fetch_request;
+    instance_profile current_profile;
+    string_arena fetch_strings;
+    value_block_pool fetch_blocks;
+    static const uint64_t never_refreshed = static_cast<uint64_t>(-1);
+    static const unsigned long complete_profile = 0;
+
+    // Working storage for batch_fetch, reused from one fetch to the next.
+    pmResult * batch_result;
+    int batch_result_capacity;
+    std::vector<metric_values> batch_metrics;
+    std::vector<const metric_source *> batch_sources;
+    bool batch_any_sources;
+    std::vector<int> batch_statuses;
+    std::vector<instance_id_type> batch_instances;
+    std::vector<pmAtomValue> batch_atoms;
+    std::vector<int> batch_codes;
+    std::vector<metric_values> batch_agent_metrics;
+
+    // Self-instrumentation; see supports_self_instrumentation.
+    enum self_operation {
+        self_begin_fetch_values, self_fetch, self_instance, self_text, self_store,
+        self_operation_count
+    };
+    enum self_exception {
+        self_pcp_exception, self_out_of_range_exception, self_std_exception,
+        self_unknown_exception, self_exception_count
+    };
+    enum self_item {
+        self_fetches_item, self_values_item, self_exceptions_item, self_calls_item,
+        self_latency_item, self_histogram_item // One histogram item per operation.
+    };
+    static const size_t self_latency_bucket_count = 8; // Decades from <10us to >=10s.
+    struct {
+        uint64_t fetches;
+        uint64_t values;
+        uint64_t exceptions[self_exception_count];
+        uint64_t calls[self_operation_count];
+        uint64_t latency[self_operation_count]; // Microseconds.
+        uint64_t histogram[self_operation_count][self_latency_bucket_count];
+    } self_counters;
+    bool self_instrumented;
+    cluster_id_type self_cluster;
+    instance_domain self_operations;
+    instance_domain self_exceptions;
+    instance_domain self_latency_buckets;
+
     void export_domain_header(const std::string &filename) const
     {
         // Open the output file.
@@ -1373,13 +2366,19 @@ private:
         for (std::map<domain_id_type, const instance_domain *>::const_iterator indom = instances.begin();
              indom != instances.end(); ++indom)
         {
-            for (instance_domain::const_iterator instance = indom->second->begin();
-                 instance != indom->second->end(); ++instance)
+            // Enumerate via the domain's virtual functions, since derived
+            // domains may hold their instances outside of the std::map.
+            std::vector<pmdaInstid> ids(indom->second->get_instance_count());
+            if (!ids.empty()) {
+                indom->second->get_pmda_instances(&ids[0]);
+            }
+            for (std::vector<pmdaInstid>::const_iterator id = ids.begin(); id != ids.end(); ++id)
             {
-                stream << "@ " << indom->first << '.' << instance->first
-                       << ' ' << instance->second.short_description << std::endl;
-                if (!instance->second.verbose_description.empty()) {
-                    stream << instance->second.verbose_description << std::endl;
+                const instance_info info = indom->second->get_instance_info(id->i_inst);
+                stream << "@ " << indom->first << '.' << id->i_inst
+                       << ' ' << info.short_description << std::endl;
+                if (!info.verbose_description.empty()) {
+                    stream << info.verbose_description << std::endl;
                 }
                 stream << std::endl;
             }
@@ -1528,40 +2527,689 @@ private:
         return std::pair<size_t, size_t>(metric_count, instance_domains.size());
     }
 
+    void build_metric_lookup_table()
+    {
+        // The table holds one contiguous run of entries per cluster, indexed
+        // by item ID, with the offsets of each cluster's run held separately.
+        // Clusters not supported by this PMDA have empty runs.
+        const metric_lookup_entry unsupported = {
+            NULL, NULL, PM_TYPE_UNKNOWN, static_cast<metric_flags>(0), NULL, NULL, NULL, NULL };
+        metric_lookup_table.clear();
+        metric_lookup_offsets.assign(1, 0);
+        for (metrics_description::const_iterator metrics_iter = supported_metrics.begin();
+             metrics_iter != supported_metrics.end(); ++metrics_iter)
+        {
+            const metric_cluster &cluster = metrics_iter->second;
+            metric_lookup_offsets.resize(metrics_iter->first + 1, metric_lookup_table.size());
+            const size_t offset = metric_lookup_table.size();
+            if (!cluster.empty()) {
+                metric_lookup_table.resize(offset + cluster.rbegin()->first + 1, unsupported);
+            }
+            for (metric_cluster::const_iterator cluster_iter = cluster.begin();
+                 cluster_iter != cluster.end(); ++cluster_iter)
+            {
+                metric_lookup_entry &entry = metric_lookup_table[offset + cluster_iter->first];
+                entry.description = &cluster_iter->second;
+                entry.domain = cluster_iter->second.domain;
+                entry.type = cluster_iter->second.type;
+                entry.flags = cluster_iter->second.flags;
+                entry.source = cluster_iter->second.source.is_bound()
+                    ? &cluster_iter->second.source : NULL;
+                entry.static_domain = NULL;
+                entry.indom_table = NULL; // Set once pmdaInit has run.
+                entry.static_index = NULL;
+            }
+            metric_lookup_offsets.push_back(metric_lookup_table.size());
+        }
+        const metric_refresh unrefreshed = { never_refreshed, complete_profile };
+        metric_refreshes.assign(metric_lookup_table.size(), unrefreshed);
+    }
+
+    void build_static_metric_lookup_table()
+    {
+        // As for build_metric_lookup_table, but from the static tables, which
+        // need not be sorted. Static metrics have no description of their own,
+        // so all share a single empty one, which marks them as supported.
+        static const metric_description description(
+            std::string(), PM_TYPE_UNKNOWN, PM_SEM_DISCRETE, pcp::units(0,0,0, 0,0,0));
+        const metric_lookup_entry unsupported = {
+            NULL, NULL, PM_TYPE_UNKNOWN, static_cast<metric_flags>(0), NULL, NULL, NULL, NULL };
+        std::vector<item_id_type> cluster_sizes;
+        for (size_t index = 0; index < schema->metric_count; ++index) {
+            const pmID pmid = schema->metrics[index].m_desc.pmid;
+            if (pmID_cluster(pmid) >= cluster_sizes.size()) {
+                cluster_sizes.resize(pmID_cluster(pmid) + 1, 0);
+            }
+            cluster_sizes[pmID_cluster(pmid)] = std::max<item_id_type>(
+                cluster_sizes[pmID_cluster(pmid)], pmID_item(pmid) + 1);
+        }
+        metric_lookup_offsets.assign(1, 0);
+        for (size_t cluster = 0; cluster < cluster_sizes.size(); ++cluster) {
+            metric_lookup_offsets.push_back(metric_lookup_offsets.back() + cluster_sizes[cluster]);
+        }
+        metric_lookup_table.assign(metric_lookup_offsets.back(), unsupported);
+        // Index each static domain's instance IDs once, so that validating an
+        // instance is a bitmap test, instead of a scan of the domain's it_set.
+        static_instance_indexes.assign(schema->indom_count, instance_domain());
+        for (size_t indom = 0; indom < schema->indom_count; ++indom) {
+            const pmdaIndom &source = schema->indoms[indom];
+            for (int index = 0; index < source.it_numinst; ++index) {
+                static_instance_indexes[indom](source.it_set[index].i_inst, instance_info());
+            }
+        }
+        const metric_refresh unrefreshed = { never_refreshed, complete_profile };
+        metric_refreshes.assign(metric_lookup_table.size(), unrefreshed);
+        for (size_t index = 0; index < schema->metric_count; ++index) {
+            const pmDesc &desc = schema->metrics[index].m_desc;
+            metric_lookup_entry &entry = metric_lookup_table[
+                metric_lookup_offsets[pmID_cluster(desc.pmid)] + pmID_item(desc.pmid)];
+            entry.description = &description;
+            entry.type = desc.type;
+            for (size_t indom = 0; (desc.indom != PM_INDOM_NULL) && (indom < schema->indom_count); ++indom) {
+                if (schema->indoms[indom].it_indom == desc.indom) {
+                    entry.static_domain = &schema->indoms[indom];
+                    entry.indom_table = entry.static_domain;
+                    entry.static_index = &static_instance_indexes[indom];
+                }
+            }
+        }
+    }
+
     static inline pmdaIndom allocate_pmda_indom(const instance_domain &domain)
     {
         pmdaIndom indom;
         indom.it_indom = domain.get_domain_id();
-        indom.it_numinst = domain.size();
-        indom.it_set = new pmdaInstid [domain.size()];
-        size_t index = 0;
-        for (instance_domain::const_iterator iter = domain.begin(); iter != domain.end(); ++iter, ++index) {
-            indom.it_set[index].i_inst = iter->first;
-            indom.it_set[index].i_name = const_cast<char *>(iter->second.instance_name.c_str());
+        if (domain.uses_pmda_cache()) {
+            indom.it_numinst = 0; // Served from the cache by libpcp_pmda.
+            indom.it_set = NULL;
+            return indom;
         }
+        indom.it_numinst = domain.get_instance_count();
+        indom.it_set = new pmdaInstid [domain.get_instance_count()];
+        domain.get_pmda_instances(indom.it_set);
         return indom;
     }
 
-    static inline void validate_instance(const metric_description &description,
+    /**
+     * @brief Answer a single instance lookup from an instance domain's hash tables.
+     *
+     * @param indom  PCP instance domain to lookup.
+     * @param inst   Instance ID to lookup, or PM_IN_NULL to lookup by \a name.
+     * @param name   Instance name to lookup, or \c NULL to lookup by \a inst.
+     * @param result Result to allocate, as per pmdaInstance, if found.
+     *
+     * @throw std::bad_alloc If \a result could not be allocated.
+     *
+     * @return \c true if \a result was set, otherwise \c false.
+     */
+    bool lookup_instance(const pmInDom indom, const int inst, const char * const name,
+                         pmInResult ** const result) const
+    {
+        if ((inst == static_cast<int>(PM_IN_NULL)) == (name == NULL)) {
+            return false; // Listing all instances, or an unsupported request.
+        }
+        const std::map<pmInDom, instance_domain *>::const_iterator domain =
+            instance_domains.find(indom);
+        if ((domain == instance_domains.end()) || (domain->second->uses_pmda_cache()) ||
+            (domain->second->get_pm_instance_domain() != indom)) {
+            return false;
+        }
+
+        instance_id_type instance_id = 0;
+        const char * instance_name = NULL;
+        if (name != NULL) {
+            if (!domain->second->lookup_instance_id(name, instance_id)) {
+                return false;
+            }
+        } else if ((instance_name = domain->second->lookup_instance_name(inst)) == NULL) {
+            return false;
+        }
+
+        pmInResult * const in_result = static_cast<pmInResult *>(malloc(sizeof(pmInResult)));
+        if (in_result == NULL) {
+            throw std::bad_alloc();
+        }
+        in_result->indom = indom;
+        in_result->numinst = 1;
+        in_result->instlist = NULL;
+        in_result->namelist = NULL;
+        if (name != NULL) {
+            in_result->instlist = static_cast<int *>(malloc(sizeof(int)));
+            if (in_result->instlist != NULL) {
+                in_result->instlist[0] = instance_id;
+            }
+        } else {
+            in_result->namelist = static_cast<char **>(malloc(sizeof(char *)));
+            if (in_result->namelist != NULL) {
+                in_result->namelist[0] = strdup(instance_name);
+            }
+        }
+        if ((in_result->instlist == NULL) &&
+            ((in_result->namelist == NULL) || (in_result->namelist[0] == NULL))) {
+            free(in_result->namelist);
+            free(in_result);
+            throw std::bad_alloc();
+        }
+        *result = in_result;
+        return true;
+    }
+
+    /*
+     * Apply changes made to instance domains since the last sync to their
+     * pmdaIndom tables, in place.  Each it_set array is only reallocated when
+     * it needs to grow, in which case its capacity is doubled, so domains that
+     * churn around a steady size cause no allocations at all.
+     */
+    void sync_instance_domains()
+    {
+        for (std::vector<synced_instance_domain>::iterator iter = synced_instance_domains.begin();
+             iter != synced_instance_domains.end(); ++iter) {
+            const instance_domain &domain = *iter->domain;
+            if ((domain.get_generation() == iter->generation) || (domain.uses_pmda_cache())) {
+                continue;
+            }
+            const size_t count = domain.get_instance_count();
+            if (count > iter->capacity) {
+                const size_t capacity = std::max(count, iter->capacity * 2);
+                pmdaInstid * const instances = new pmdaInstid [capacity];
+                delete [] iter->indom->it_set;
+                iter->indom->it_set = instances;
+                iter->capacity = capacity;
+            }
+            domain.get_pmda_instances(iter->indom->it_set);
+            iter->indom->it_numinst = static_cast<int>(count);
+            iter->generation = domain.get_generation();
+        }
+    }
+
+    metrics_description get_all_supported_metrics()
+    {
+        metrics_description metrics = get_supported_metrics();
+        self_instrumented = supports_self_instrumentation();
+        if (!self_instrumented) {
+            return metrics;
+        }
+        self_cluster = get_self_instrumentation_cluster();
+        if (metrics.find(self_cluster) != metrics.end()) {
+            throw pcp::exception(PM_ERR_GENERIC,
+                "self-instrumentation cluster is already used by this PMDA");
+        }
+        for (metrics_description::const_iterator cluster = metrics.begin();
+             cluster != metrics.end(); ++cluster) {
+            for (metric_cluster::const_iterator metric = cluster->second.begin();
+                 metric != cluster->second.end(); ++metric) {
+                const instance_domain * const domain = metric->second.domain;
+                if ((domain != NULL) &&
+                    ((domain->get_domain_id() == self_operations.get_domain_id()) ||
+                     (domain->get_domain_id() == self_exceptions.get_domain_id()) ||
+                     (domain->get_domain_id() == self_latency_buckets.get_domain_id()))) {
+                    throw pcp::exception(PM_ERR_GENERIC,
+                        "self-instrumentation instance domain is already used by this PMDA");
+                }
+            }
+        }
+        const char * const operation_names[self_operation_count] = {
+            "begin_fetch_values", "fetch", "instance", "text", "store" };
+        self_operations.clear();
+        for (int index = 0; index < self_operation_count; ++index) {
+            self_operations(index, operation_names[index]);
+        }
+        self_exceptions.clear();
+        self_exceptions(self_pcp_exception, "pcp::exception")
+                       (self_out_of_range_exception, "std::out_of_range")
+                       (self_std_exception, "std::exception")
+                       (self_unknown_exception, "unknown");
+        self_latency_buckets.clear();
+        self_latency_buckets(0, "10us")(1, "100us")(2, "1ms")(3, "10ms")
+                            (4, "100ms")(5, "1s")(6, "10s")(7, "inf");
+
+        const pmUnits count = pcp::units(0,0,1, 0,0,PM_COUNT_ONE);
+        metrics(self_cluster, "pmda")
+            (self_fetches_item, "fetches", PM_TYPE_U64, PM_SEM_COUNTER, count, NULL,
+             "Number of fetch requests handled")
+            (self_values_item, "values", PM_TYPE_U64, PM_SEM_COUNTER, count, NULL,
+             "Number of metric values returned by fetch requests")
+            (self_exceptions_item, "exceptions", PM_TYPE_U64, PM_SEM_COUNTER, count,
+             &self_exceptions, "Number of exceptions caught, by type")
+            (self_calls_item, "calls", PM_TYPE_U64, PM_SEM_COUNTER, count,
+             &self_operations, "Number of calls, by operation")
+            (self_latency_item, "latency", PM_TYPE_U64, PM_SEM_COUNTER,
+             pcp::units(0,1,0, 0,PM_TIME_USEC,0), &self_operations,
+             "Total time spent, by operation");
+        for (int index = 0; index < self_operation_count; ++index) {
+            metrics(self_histogram_item + index,
+                    std::string(operation_names[index]) + "_latency", PM_TYPE_U64,
+                    PM_SEM_COUNTER, count, &self_latency_buckets,
+                    std::string("Histogram of ") + operation_names[index] + " latencies",
+                    "Number of calls, by latency upper bound.");
+        }
+        return metrics;
+    }
+
+    inline uint64_t begin_self_timing() const
+    {
+        return self_instrumented ? monotonic_microseconds() : 0;
+    }
+
+    inline void end_self_timing(const self_operation operation, const uint64_t start)
+    {
+        if (self_instrumented) {
+            const uint64_t elapsed = monotonic_microseconds() - start;
+            size_t bucket = 0;
+            for (uint64_t bound = 10; (elapsed >= bound) && (bucket < self_latency_bucket_count - 1);
+                 bound *= 10) {
+                ++bucket;
+            }
+            ++self_counters.calls[operation];
+            self_counters.latency[operation] += elapsed;
+            ++self_counters.histogram[operation][bucket];
+        }
+    }
+
+    void count_self_values(const int result, pmResult ** const resp)
+    {
+        if (self_instrumented) {
+            ++self_counters.fetches;
+            if ((result >= 0) && (*resp != NULL)) {
+                for (int index = 0; index < (*resp)->numpmid; ++index) {
+                    if ((*resp)->vset[index]->numval > 0) {
+                        self_counters.values += (*resp)->vset[index]->numval;
+                    }
+                }
+            }
+        }
+    }
+
+    fetch_value_result fetch_self_value(const metric_id &metric) const
+    {
+        const uint64_t * counter = NULL;
+        if (metric.item == self_fetches_item) {
+            counter = &self_counters.fetches;
+        } else if (metric.item == self_values_item) {
+            counter = &self_counters.values;
+        } else if ((metric.item == self_exceptions_item) && (metric.instance < self_exception_count)) {
+            counter = &self_counters.exceptions[metric.instance];
+        } else if ((metric.item == self_calls_item) && (metric.instance < self_operation_count)) {
+            counter = &self_counters.calls[metric.instance];
+        } else if ((metric.item == self_latency_item) && (metric.instance < self_operation_count)) {
+            counter = &self_counters.latency[metric.instance];
+        } else if ((metric.item >= self_histogram_item) &&
+                   (metric.item < self_histogram_item + self_operation_count) &&
+                   (metric.instance < self_latency_bucket_count)) {
+            counter = &self_counters.histogram[metric.item - self_histogram_item][metric.instance];
+        }
+        if (counter == NULL) {
+            return fetch_value_result::error(PM_ERR_PMID);
+        }
+        pmAtomValue atom;
+        atom.ull = *counter;
+        return fetch_value_result(atom);
+    }
+
+    // Fetch the values of self-instrumentation and bound metrics, copying
+    // all other metrics to agent_metrics. Returns false if there were none.
+    bool fetch_internal_values(const std::vector<metric_values> &metrics,
+                               const std::vector<const metric_source *> &sources,
+                               std::vector<metric_values> &agent_metrics) const
+    {
+        bool any_internal_metrics = false;
+        agent_metrics.clear();
+        for (std::vector<metric_values>::const_iterator iter = metrics.begin();
+             iter != metrics.end(); ++iter)
+        {
+            const metric_source * const source = sources[iter - metrics.begin()];
+            if (source != NULL) {
+                any_internal_metrics = true;
+                for (size_t index = 0; index < iter->count; ++index) {
+                    try {
+                        iter->atoms[index] = source->read(iter->type);
+                    } catch (const pcp::exception &ex) {
+                        // Most likely a type mismatch, so report it per metric.
+                        iter->codes[index] = ex.error_code();
+                    }
+                }
+                continue;
+            }
+            if ((!self_instrumented) || (iter->cluster != self_cluster)) {
+                agent_metrics.push_back(*iter);
+                continue;
+            }
+            any_internal_metrics = true;
+            metric_id id;
+            id.cluster = iter->cluster;
+            id.item = iter->item;
+            id.type = iter->type;
+            id.opaque = iter->opaque;
+            for (size_t index = 0; index < iter->count; ++index) {
+                id.instance = iter->instances[index];
+                const fetch_value_result result = fetch_self_value(id);
+                iter->atoms[index] = result.atom;
+                iter->codes[index] = result.code;
+            }
+        }
+        return any_internal_metrics;
+    }
+
+    static inline void validate_instance(const metric_lookup_entry &metric,
+                                         const unsigned int instance)
+    {
+        if (metric.static_domain == NULL) {
+            validate_instance(metric.domain, instance);
+            return;
+        }
+#ifndef PCP_CPP_NO_ID_VALIDITY_CHECKS
+        if (instance == PM_INDOM_NULL) {
+            // Instance required, but none provided.
+            throw pcp::exception(PM_ERR_INDOM);
+        }
+        if (!metric.static_index->contains(instance)) {
+            // Instance provided, but not one we've registered.
+            throw pcp::exception(PM_ERR_INST);
+        }
+#endif
+    }
+
+    static inline void validate_instance(const instance_domain * const domain,
                                          const unsigned int instance)
     {
 #ifndef PCP_CPP_NO_ID_VALIDITY_CHECKS
         if (instance != PM_INDOM_NULL) {
-            if (description.domain == NULL) {
+            if (domain == NULL) {
                 // Instance provided, but non required.
                 throw pcp::exception(PM_ERR_INDOM);
             }
-            if (description.domain->count(instance) <= 0) {
+            if (!domain->contains(instance)) {
                 // Instance provided, but not one we've registered.
                 throw pcp::exception(PM_ERR_INST);
             }
-        } else if (description.domain != NULL) {
+        } else if (domain != NULL) {
             // Instance required, but none provided.
             throw pcp::exception(PM_ERR_INDOM);
         }
 #endif
     }
 
+    static uint64_t monotonic_milliseconds()
+    {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return static_cast<uint64_t>(now.tv_sec) * 1000 + now.tv_nsec / 1000000;
+    }
+
+    static uint64_t monotonic_microseconds()
+    {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return static_cast<uint64_t>(now.tv_sec) * 1000000 + now.tv_nsec / 1000;
+    }
+
+    metric_refresh * find_metric_refresh(const pmID pmid)
+    {
+        const metric_lookup_entry * const entry = find_metric(pmID_cluster(pmid), pmID_item(pmid));
+        return (entry == NULL) ? NULL : &metric_refreshes[entry - &metric_lookup_table[0]];
+    }
+
+    bool is_fresh(const metric_refresh &refresh, const cluster_id_type cluster,
+                  const uint64_t now) const
+    {
+        // Values collected under a restrictive instance profile may be missing
+        // instances other profiles want, so are only shared with clients
+        // sending that same profile.
+        return (refresh.time != never_refreshed) &&
+               (now - refresh.time < get_refresh_interval(cluster)) &&
+               ((refresh.profile == complete_profile) || (refresh.profile == profile_generation));
+    }
+
+    bool build_fetch_request(const uint64_t now, const int numpmid, const pmID * const pmidlist)
+    {
+        current_fetch_request.clusters.clear();
+        current_fetch_request.metrics.clear();
+        for (int index = 0; index < numpmid; ++index) {
+            const cluster_id_type cluster = pmID_cluster(pmidlist[index]);
+            if (self_instrumented && (cluster == self_cluster)) {
+                continue; // Served from counters; nothing to collect.
+            }
+            if (cluster >= cluster_refresh_times.size()) {
+                cluster_refresh_times.resize(cluster + 1, static_cast<uint64_t>(never_refreshed));
+            }
+            // Metrics not supported by this PMDA have no data of their own to
+            // go stale, so fall back to their cluster's refresh time.
+            const metric_refresh * const refresh = find_metric_refresh(pmidlist[index]);
+            const metric_refresh cluster_refresh = { cluster_refresh_times[cluster], complete_profile };
+            if (!is_fresh((refresh == NULL) ? cluster_refresh : *refresh, cluster, now)) {
+                current_fetch_request.metrics.push_back(pmidlist[index]);
+            }
+        }
+        if (current_fetch_request.metrics.empty()) {
+            return false;
+        }
+
+        std::vector<pmID> &metrics = current_fetch_request.metrics;
+        std::sort(metrics.begin(), metrics.end(), &fetch_request::compare_metrics);
+        metrics.erase(std::unique(metrics.begin(), metrics.end()), metrics.end());
+        for (std::vector<pmID>::const_iterator iter = metrics.begin(); iter != metrics.end(); ++iter) {
+            const cluster_id_type cluster = pmID_cluster(*iter);
+            if (current_fetch_request.clusters.empty() ||
+                (current_fetch_request.clusters.back() != cluster)) {
+                current_fetch_request.clusters.push_back(cluster);
+            }
+        }
+        return true;
+    }
+
+    int batch_fetch(const int numpmid, const pmID * const pmidlist,
+                    pmResult ** const resp)
+    {
+        // Grow the result skeleton if needed. Like pmdaFetch, we own the
+        // pmResult itself, while PCP frees its value sets once sent.
+        if ((batch_result == NULL) || (numpmid > batch_result_capacity)) {
+            pmResult * const result = static_cast<pmResult *>(realloc(batch_result,
+                sizeof(pmResult) + std::max(numpmid - 1, 0) * sizeof(pmValueSet *)));
+            if (result == NULL) {
+                return -oserror();
+            }
+            batch_result = result;
+            batch_result_capacity = numpmid;
+        }
+
+        // Gather the requested metrics, then fetch all of their values in one
+        // go. Self-instrumentation and bound metrics are served here, and not
+        // passed on to the derived class.
+        bool gathered = false;
+        try {
+            gather_batch_metrics(numpmid, pmidlist);
+            gathered = true;
+            if ((self_instrumented || batch_any_sources) &&
+                fetch_internal_values(batch_metrics, batch_sources, batch_agent_metrics)) {
+                if (!batch_agent_metrics.empty()) {
+                    fetch_values(batch_agent_metrics);
+                }
+            } else {
+                fetch_values(batch_metrics);
+            }
+        } catch (const pcp::exception &ex) {
+            ++self_counters.exceptions[self_pcp_exception];
+            pmNotifyErr(LOG_ERR, "%s", ex.what());
+            if (gathered) {
+                release_dynamic_atoms(batch_metrics.begin(), batch_metrics.end());
+            }
+            return ex.error_code();
+        } catch (const std::exception &ex) {
+            ++self_counters.exceptions[self_std_exception];
+            pmNotifyErr(LOG_ERR, "%s", ex.what());
+            if (gathered) {
+                release_dynamic_atoms(batch_metrics.begin(), batch_metrics.end());
+            }
+            return PM_ERR_GENERIC;
+        }
+
+        // Build the result's value sets directly from the fetched values.
+        batch_result->timestamp.tv_sec = 0;
+        batch_result->timestamp.tv_usec = 0;
+        batch_result->numpmid = numpmid;
+        std::vector<metric_values>::const_iterator unused_values = batch_metrics.begin();
+        for (int pmid_index = 0; pmid_index < numpmid; ++pmid_index) {
+            const int status = batch_statuses[pmid_index];
+            const size_t count = (status < 0) ? 0 : batch_metrics[status].count;
+            pmValueSet * const value_set = static_cast<pmValueSet *>(malloc(
+                sizeof(pmValueSet) + ((count == 0) ? 0 : count - 1) * sizeof(pmValue)));
+            if (value_set == NULL) {
+                const int error = -oserror();
+                for (int index = 0; index < pmid_index; ++index) {
+                    free_value_set(batch_result->vset[index]);
+                }
+                release_dynamic_atoms(unused_values, batch_metrics.end());
+                return error;
+            }
+            value_set->pmid = pmidlist[pmid_index];
+            value_set->numval = (status < 0) ? status : 0;
+            value_set->valfmt = PM_VAL_INSITU;
+            if (status >= 0) {
+                fill_value_set(*value_set, *unused_values++);
+            }
+            batch_result->vset[pmid_index] = value_set;
+        }
+        *resp = batch_result;
+        return 0;
+    }
+
+    // Gather the requested metrics, and their profile-selected instances.
+    void gather_batch_metrics(const int numpmid, const pmID * const pmidlist)
+    {
+        // Array pointers are assigned afterwards, as the vectors may grow.
+        batch_metrics.clear();
+        batch_sources.clear();
+        batch_any_sources = false;
+        batch_statuses.resize(numpmid);
+        batch_instances.clear();
+        for (int pmid_index = 0; pmid_index < numpmid; ++pmid_index) {
+            const metric_lookup_entry * const metric = find_metric(
+                pmID_cluster(pmidlist[pmid_index]), pmID_item(pmidlist[pmid_index]));
+            if (metric == NULL) {
+                batch_statuses[pmid_index] = PM_ERR_PMID;
+                continue;
+            }
+            metric_values values;
+            values.cluster = pmID_cluster(pmidlist[pmid_index]);
+            values.item = pmID_item(pmidlist[pmid_index]);
+            values.type = metric->type;
+            values.opaque = metric->description->opaque;
+            values.count = batch_instances.size(); // Offset, for now.
+            if ((metric->domain != NULL) && (metric->domain->uses_pmda_cache())) {
+                // The cache's active instances.
+                const pmInDom indom = metric->domain->get_pm_instance_domain();
+                pmdaCacheOp(indom, PMDA_CACHE_WALK_REWIND);
+                for (int inst; (inst = pmdaCacheOp(indom, PMDA_CACHE_WALK_NEXT)) >= 0;) {
+                    if (current_profile.includes(indom, inst)) {
+                        batch_instances.push_back(inst);
+                    }
+                }
+            } else if (metric->indom_table != NULL) {
+                // The (already synced) table passed to pmdaInit.
+                const pmdaIndom &indom = *metric->indom_table;
+                for (int index = 0; index < indom.it_numinst; ++index) {
+                    if (current_profile.includes(indom.it_indom, indom.it_set[index].i_inst)) {
+                        batch_instances.push_back(indom.it_set[index].i_inst);
+                    }
+                }
+            } else {
+                batch_instances.push_back(PM_IN_NULL);
+            }
+            batch_statuses[pmid_index] = batch_metrics.size();
+            batch_metrics.push_back(values);
+            batch_sources.push_back(metric->source);
+            batch_any_sources |= (metric->source != NULL);
+        }
+        pmAtomValue zero;
+        memset(&zero, 0, sizeof(zero));
+        batch_atoms.assign(batch_instances.size(), zero);
+        batch_codes.assign(batch_instances.size(), PMDA_FETCH_STATIC);
+        for (std::vector<metric_values>::iterator iter = batch_metrics.begin();
+             iter != batch_metrics.end(); ++iter)
+        {
+            const size_t offset = iter->count;
+            const std::vector<metric_values>::iterator next = iter + 1;
+            iter->count = ((next == batch_metrics.end()) ? batch_instances.size() : next->count) - offset;
+            iter->instances = (iter->count == 0) ? NULL : &batch_instances[offset];
+            iter->atoms = (iter->count == 0) ? NULL : &batch_atoms[offset];
+            iter->codes = (iter->count == 0) ? NULL : &batch_codes[offset];
+        }
+    }
+
+    static void fill_value_set(pmValueSet &value_set, const metric_values &values)
+    {
+        for (size_t index = 0; index < values.count; ++index) {
+            if (values.codes[index] < 0) {
+                // Report the first error for the whole metric, as pmdaFetch does.
+                release_dynamic_atoms(values, index);
+                free_values(value_set);
+                value_set.numval = values.codes[index];
+                return;
+            }
+            if (values.codes[index] == PMDA_FETCH_NOVALUES) {
+                continue;
+            }
+            pmValue &value = value_set.vlist[value_set.numval];
+            const int format = pmStuffValue(&values.atoms[index], &value, values.type);
+            if (format < 0) {
+                release_dynamic_atoms(values, index);
+                free_values(value_set);
+                value_set.numval = format;
+                return;
+            }
+            if ((values.codes[index] == PMDA_FETCH_DYNAMIC) && (format == PM_VAL_DPTR)) {
+                // The value was copied, so release the agent's original.
+                free_dynamic_atom(values.atoms[index], values.type);
+            }
+            value.inst = values.instances[index];
+            value_set.valfmt = format;
+            value_set.numval++;
+        }
+    }
+
+    static void free_dynamic_atom(pmAtomValue &atom, const atom_type_type type)
+    {
+        if (type == PM_TYPE_STRING) {
+            free(atom.cp);
+        } else if (type == PM_TYPE_AGGREGATE) {
+            free(atom.vbp);
+        }
+    }
+
+    static void release_dynamic_atoms(const metric_values &values, const size_t first)
+    {
+        for (size_t index = first; index < values.count; ++index) {
+            if (values.codes[index] == PMDA_FETCH_DYNAMIC) {
+                free_dynamic_atom(values.atoms[index], values.type);
+            }
+        }
+    }
+
+    static void release_dynamic_atoms(std::vector<metric_values>::const_iterator begin,
+                                      const std::vector<metric_values>::const_iterator end)
+    {
+        for (; begin != end; ++begin) {
+            release_dynamic_atoms(*begin, 0);
+        }
+    }
+
+    static void free_values(pmValueSet &value_set)
+    {
+        if (value_set.valfmt == PM_VAL_DPTR) {
+            for (int index = 0; index < value_set.numval; ++index) {
+                free(value_set.vlist[index].value.pval);
+            }
+        }
+        value_set.numval = 0;
+        value_set.valfmt = PM_VAL_INSITU;
+    }
+
+    static void free_value_set(pmValueSet * const value_set)
+    {
+        free_values(*value_set);
+        free(value_set);
+    }
+
     /*
      * Static callback functions registered by the register_callbacks functions.
      * These all redirect thier non-static singleton counterparts above.
@@ -1570,62 +3218,83 @@ private:
 #if PCP_CPP_PMDA_INTERFACE_VERSION >= 6
     static int callback_attribute(int ctx, int attr, const char *value, int length, pmdaExt *pmda)
     {
-        return get_instance()->on_attribute(ctx, attr, value, length, pmda);
+        return get_instance(pmda)->on_attribute(ctx, attr, value, length, pmda);
     }
 #endif
 
 #if PCP_CPP_PMDA_INTERFACE_VERSION >= 4
     static int callback_children(const char *name, int traverse, char ***kids, int **sts, pmdaExt *pmda)
     {
-        return get_instance()->on_children(name, traverse, kids, sts, pmda);
+        return get_instance(pmda)->on_children(name, traverse, kids, sts, pmda);
     }
 #endif
 
     static int callback_desc(pmID pmid, pmDesc *desc, pmdaExt *pmda)
     {
-        return get_instance()->on_desc(pmid, desc, pmda);
+        return get_instance(pmda)->on_desc(pmid, desc, pmda);
     }
 
     static int callback_fetch(int numpmid, pmID *pmidlist, pmResult **resp, pmdaExt *pmda)
     {
-        return get_instance()->on_fetch(numpmid, pmidlist, resp, pmda);
+        pcp::pmda * const agent = get_instance(pmda);
+        int result;
+        {
+            const fetching_instance_guard guard(agent);
+            const uint64_t start = agent->begin_self_timing();
+            result = agent->on_fetch(numpmid, pmidlist, resp, pmda);
+            agent->end_self_timing(self_fetch, start);
+        }
+        agent->count_self_values(result, resp);
+        return result;
     }
 
     static int callback_fetch_callback(pmdaMetric *mdesc, unsigned int inst, pmAtomValue *avp)
     {
-        return get_instance()->on_fetch_callback(mdesc, inst, avp);
+        return get_fetch_callback_instance()->on_fetch_callback(mdesc, inst, avp);
     }
 
     static int callback_instance(pmInDom indom, int inst, char *name, pmInResult **result, pmdaExt *pmda)
     {
-        return get_instance()->on_instance(indom, inst, name, result, pmda);
+        pcp::pmda * const agent = get_instance(pmda);
+        const uint64_t start = agent->begin_self_timing();
+        const int status = agent->on_instance(indom, inst, name, result, pmda);
+        agent->end_self_timing(self_instance, start);
+        return status;
     }
 
 #if PCP_CPP_PMDA_INTERFACE_VERSION >= 4
     static int callback_name(pmID pmid, char ***nameset, pmdaExt *pmda)
     {
-        return get_instance()->on_name(pmid, nameset, pmda);
+        return get_instance(pmda)->on_name(pmid, nameset, pmda);
     }
 
     static int callback_pmid(const char *name, pmID *pmid, pmdaExt *pmda)
     {
-        return get_instance()->on_pmid(name, pmid, pmda);
+        return get_instance(pmda)->on_pmid(name, pmid, pmda);
     }
 #endif
 
     static int callback_profile(pmProfile *prof, pmdaExt *pmda)
     {
-        return get_instance()->on_profile(prof, pmda);
+        return get_instance(pmda)->on_profile(prof, pmda);
     }
 
     static int callback_store(pmResult *result, pmdaExt *pmda)
     {
-        return get_instance()->on_store(result, pmda);
+        pcp::pmda * const agent = get_instance(pmda);
+        const uint64_t start = agent->begin_self_timing();
+        const int status = agent->on_store(result, pmda);
+        agent->end_self_timing(self_store, start);
+        return status;
     }
 
     static int callback_text(int ident, int type, char **buffer, pmdaExt *pmda)
     {
-        return get_instance()->on_text(ident, type, buffer, pmda);
+        pcp::pmda * const agent = get_instance(pmda);
+        const uint64_t start = agent->begin_self_timing();
+        const int result = agent->on_text(ident, type, buffer, pmda);
+        agent->end_self_timing(self_text, start);
+        return result;
     }
 
 };
@@ -0,0 +1,130 @@
+//            Copyright Paul Colby 2013 - 2018.
+// Distributed under the Boost Software License, Version 1.0.
+//       (See accompanying file LICENSE.md or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+/**
+ * @file
+ * @brief Defines the pcp::static_schema struct, and related macros.
+ */
+
+#ifndef __PCP_CPP_STATIC_SCHEMA_HPP__
+#define __PCP_CPP_STATIC_SCHEMA_HPP__
+
+#include "config.hpp"
+#include "types.hpp"
+
+#include <cstddef>
+
+/**
+ * @brief Static pmdaMetric initializer.
+ *
+ * Expands to a constant initializer for a pmdaMetric, whose atom type is
+ * derived from a C++ type at compile time.  Types not supported by
+ * pcp::atom_type_of fail to compile.  For example:
+ * @code
+ * static pmdaMetric metrics[] = {
+ *     PCP_CPP_STATIC_METRIC(0, 0, uint32_t, PM_INDOM_NULL, PM_SEM_COUNTER,
+ *                           PMDA_PMUNITS(0,0,1, 0,0,PM_COUNT_ONE)),
+ *     PCP_CPP_STATIC_METRIC(0, 1, double, 0, PM_SEM_INSTANT,
+ *                           PMDA_PMUNITS(0,0,0, 0,0,0))
+ * };
+ * @endcode
+ *
+ * @param cluster    Cluster ID.
+ * @param item       Item ID.
+ * @param value_type C++ type of the metric's values.
+ * @param indom      Serial number of the metric's instance domain, or
+ *                   PM_INDOM_NULL.
+ * @param semantic   PCP semantic.
+ * @param units      PCP units, as a PMDA_PMUNITS initializer.
+ */
+#define PCP_CPP_STATIC_METRIC(cluster, item, value_type, indom, semantic, units) \
+    { NULL, { PMDA_PMID(cluster, item), PCP_CPP_STATIC_ATOM_TYPE(value_type), \
+              static_cast<pmInDom>(indom), semantic, units } }
+
+/// @cond internal
+#ifdef PCP_CPP_NAMESPACE
+#define PCP_CPP_STATIC_ATOM_TYPE(value_type) ::PCP_CPP_NAMESPACE::pcp::atom_type_of<value_type>::value
+#else
+#define PCP_CPP_STATIC_ATOM_TYPE(value_type) ::pcp::atom_type_of<value_type>::value
+#endif
+/// @endcond
+
+/**
+ * @brief Static pmdaInstid initializer.
+ *
+ * @param id   Instance ID.
+ * @param name Instance name, as a string literal.
+ */
+#define PCP_CPP_STATIC_INSTANCE(id, name) { id, const_cast<char *>(name) }
+
+/**
+ * @brief Static pmdaIndom initializer.
+ *
+ * @param serial    Serial number of the instance domain.
+ * @param instances Array of pmdaInstid values.
+ */
+#define PCP_CPP_STATIC_INDOM(serial, instances) \
+    { serial, static_cast<int>(sizeof(instances) / sizeof(instances[0])), instances }
+
+PCP_CPP_BEGIN_NAMESPACE
+
+namespace pcp {
+
+/**
+ * @brief Compile-time metric and instance domain tables.
+ *
+ * Agents whose metrics are fixed at compile time may describe them with
+ * static pmdaMetric and pmdaIndom arrays (see PCP_CPP_STATIC_METRIC and
+ * PCP_CPP_STATIC_INDOM), and return them from pcp::pmda::get_static_schema.
+ * The arrays are then passed to pmdaInit as-is, so no metadata is built, or
+ * allocated, at startup.
+ *
+ * The arrays are updated in place by pmdaInit, so must not be const, and must
+ * not be shared by more than one PMDA.
+ *
+ * @see pcp::pmda::get_static_schema
+ */
+struct static_schema {
+    pmdaMetric * metrics; ///< Metric table.
+    size_t metric_count;  ///< Number of elements in \a metrics.
+    pmdaIndom * indoms;   ///< Instance domain table; may be \c NULL.
+    size_t indom_count;   ///< Number of elements in \a indoms.
+};
+
+/**
+ * @brief Make a static schema from static metric and instance domain tables.
+ *
+ * @param metrics Metric table.
+ * @param indoms  Instance domain table.
+ *
+ * @return A static_schema referring to \a metrics and \a indoms.
+ */
+template <size_t MetricCount, size_t IndomCount>
+static_schema make_static_schema(pmdaMetric (&metrics)[MetricCount],
+                                 pmdaIndom (&indoms)[IndomCount])
+{
+    const static_schema schema = { metrics, MetricCount, indoms, IndomCount };
+    return schema;
+}
+
+/**
+ * @brief Make a static schema from a static metric table.
+ *
+ * @param metrics Metric table.
+ *
+ * @return A static_schema referring to \a metrics, with no instance domains.
+ */
+template <size_t MetricCount>
+static_schema make_static_schema(pmdaMetric (&metrics)[MetricCount])
+{
+    const static_schema schema = { metrics, MetricCount, NULL, 0 };
+    return schema;
+}
+
+} // pcp namespace.
+
+PCP_CPP_END_NAMESPACE
+
+#endif
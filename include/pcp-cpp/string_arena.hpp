@@ -0,0 +1,201 @@
+//            Copyright Paul Colby 2013 - 2018.
+// Distributed under the Boost Software License, Version 1.0.
+//       (See accompanying file LICENSE.md or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+/**
+ * @file
+ * @brief Defines the pcp::string_arena class.
+ */
+
+#ifndef __PCP_CPP_STRING_ARENA_HPP__
+#define __PCP_CPP_STRING_ARENA_HPP__
+
+#include "config.hpp"
+
+#include <cstring>
+#include <new>
+#include <string>
+#include <vector>
+
+#if __cplusplus >= 201703L
+#include <string_view>
+#endif
+
+PCP_CPP_BEGIN_NAMESPACE
+
+namespace pcp {
+
+/**
+ * @brief Arena of null-terminated strings, released all at once.
+ *
+ * Strings are copied into large, reusable chunks of memory, and remain valid
+ * (at the same address) until the next call to reset.  Since reset keeps all
+ * chunks for re-use, once an arena has grown to its working size, storing
+ * strings performs no heap allocations at all.
+ *
+ * The pcp::pmda class resets its arena at the start of every fetch, which
+ * makes arena strings suitable for returning from fetch_value with the
+ * default PMDA_FETCH_STATIC code, instead of strdup'ing each value and using
+ * PMDA_FETCH_DYNAMIC.
+ *
+ * @see pcp::pmda::get_string_arena
+ */
+class string_arena {
+
+public:
+
+    /**
+     * @brief Constructor.
+     *
+     * @param chunk_size Minimum size of each chunk of memory, in bytes.
+     */
+    explicit string_arena(const size_t chunk_size = 16 * 1024)
+        : chunk_size(chunk_size), current_chunk(0), current_offset(0)
+    {
+
+    }
+
+    /**
+     * @brief Destructor.
+     */
+    ~string_arena()
+    {
+        for (std::vector<chunk>::iterator iter = chunks.begin(); iter != chunks.end(); ++iter) {
+            delete[] iter->data;
+        }
+    }
+
+    /**
+     * @brief Copy a string into this arena.
+     *
+     * @param value  String to copy; need not be null-terminated.
+     * @param length Length of \a value, in bytes.
+     *
+     * @throw std::bad_alloc If more memory was needed, and not available.
+     *
+     * @return A null-terminated copy of \a value, valid until the next reset.
+     */
+    char * store(const char * const value, const size_t length)
+    {
+        char * const copy = allocate(length + 1);
+        memcpy(copy, value, length);
+        copy[length] = '\0';
+        return copy;
+    }
+
+    /**
+     * @brief Copy a null-terminated string into this arena.
+     *
+     * @param value String to copy.
+     *
+     * @throw std::bad_alloc If more memory was needed, and not available.
+     *
+     * @return A copy of \a value, valid until the next reset.
+     */
+    char * store(const char * const value)
+    {
+        return store(value, strlen(value));
+    }
+
+    /**
+     * @brief Copy a string into this arena.
+     *
+     * @param value String to copy.
+     *
+     * @throw std::bad_alloc If more memory was needed, and not available.
+     *
+     * @return A null-terminated copy of \a value, valid until the next reset.
+     */
+    char * store(const std::string &value)
+    {
+        return store(value.data(), value.size());
+    }
+
+#if __cplusplus >= 201703L
+    /**
+     * @brief Copy a string into this arena.
+     *
+     * @note This function is only available when building with C++17 or later.
+     *
+     * @param value String to copy.
+     *
+     * @throw std::bad_alloc If more memory was needed, and not available.
+     *
+     * @return A null-terminated copy of \a value, valid until the next reset.
+     */
+    char * store(const std::string_view value)
+    {
+        return store(value.data(), value.size());
+    }
+#endif
+
+    /**
+     * @brief Release all strings stored in this arena.
+     *
+     * All memory is retained for re-use.  Pointers previously returned by
+     * store must not be used after calling this function.
+     */
+    void reset()
+    {
+        current_chunk = 0;
+        current_offset = 0;
+    }
+
+    /**
+     * @brief Get the total memory held by this arena.
+     *
+     * @return The combined size of all chunks, in bytes.
+     */
+    size_t capacity() const
+    {
+        size_t total = 0;
+        for (std::vector<chunk>::const_iterator iter = chunks.begin(); iter != chunks.end(); ++iter) {
+            total += iter->size;
+        }
+        return total;
+    }
+
+private:
+    /// @brief A single block of arena memory.
+    struct chunk {
+        char * data; ///< Chunk memory.
+        size_t size; ///< Size of \a data, in bytes.
+    };
+
+    const size_t chunk_size;    ///< Minimum size of new chunks.
+    std::vector<chunk> chunks;  ///< All chunks, in order of use.
+    size_t current_chunk;       ///< Index of the chunk currently being filled.
+    size_t current_offset;      ///< Bytes used in the current chunk.
+
+    char * allocate(const size_t size)
+    {
+        // Move on through already-allocated chunks, looking for space.
+        while ((current_chunk < chunks.size()) &&
+               (current_offset + size > chunks[current_chunk].size)) {
+            ++current_chunk;
+            current_offset = 0;
+        }
+        if (current_chunk == chunks.size()) {
+            chunks.reserve(chunks.size() + 1); // So push_back cannot throw.
+            chunk new_chunk;
+            new_chunk.size = (size > chunk_size) ? size : chunk_size;
+            new_chunk.data = new char[new_chunk.size];
+            chunks.push_back(new_chunk);
+        }
+        char * const result = chunks[current_chunk].data + current_offset;
+        current_offset += size;
+        return result;
+    }
+
+    // Arenas own their chunks, so cannot be copied.
+    string_arena(const string_arena &);
+    string_arena &operator=(const string_arena &);
+
+};
+
+} // pcp namespace.
+
+PCP_CPP_END_NAMESPACE
+
+#endif
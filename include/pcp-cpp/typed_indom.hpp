@@ -0,0 +1,378 @@
+//            Copyright Paul Colby 2013 - 2018.
+// Distributed under the Boost Software License, Version 1.0.
+//       (See accompanying file LICENSE.md or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+/**
+ * @file
+ * @brief Defines the pcp::cache::typed_indom class template.
+ */
+
+#ifndef __PCP_CPP_TYPED_INDOM_HPP__
+#define __PCP_CPP_TYPED_INDOM_HPP__
+
+#include "cache.hpp"
+#include "cached_instance_domain.hpp"
+#include "config.hpp"
+#include "exception.hpp"
+#include "types.hpp"
+
+#include <climits>
+#include <new>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+PCP_CPP_BEGIN_NAMESPACE
+
+namespace pcp {
+namespace cache {
+
+/**
+ * @brief PMDA cache instance domain, owning a typed object per instance.
+ *
+ * Rather than agents allocating per-instance state themselves, and storing
+ * it in the cache as untyped opaque pointers, this class allocates a default
+ * constructed \a Type object for each instance it stores, and owns it for as
+ * long as the instance remains in the cache.  Objects are allocated from
+ * slabs of \a slab_size objects, so there is no per-instance heap traffic.
+ *
+ * Since this is a pcp::cached_instance_domain, it may be given to metric
+ * descriptions like any other instance domain, and the pcp::pmda class then
+ * validates, and fetches, its instances via the cache.
+ *
+ * Inactive instances keep their objects, so instances that come back (being
+ * stored again) get their previous objects back.  Objects are only destroyed,
+ * and their slots reused, once their instances are purged (via this class's
+ * purge function), or this class is destroyed.
+ *
+ * For example:
+ * @code
+ * struct process_state { uint64_t last_cpu_time; };
+ * pcp::cache::typed_indom<process_state> processes;
+ * ...
+ * processes.inactivate_all();
+ * for each current process {
+ *     process_state &state = processes.store(name);
+ *     ...
+ * }
+ * processes.purge(300);
+ * @endcode
+ *
+ * The cache entries must only be stored via this class, since their opaque
+ * pointers are assumed to refer to objects this class owns.  And since the
+ * cache itself is not updated when this class is destroyed, this class must
+ * outlive any use of its entries' opaque pointers.
+ *
+ * @tparam Type Default-constructible type of the per-instance objects.  Slots
+ *              are aligned for \c long \c double, \c uint64_t and pointers,
+ *              so over-aligned types are rejected at compile time (where the
+ *              compiler can tell).
+ */
+template <typename Type>
+class typed_indom : public cached_instance_domain {
+
+public:
+
+    /**
+     * @brief Constructor.
+     *
+     * @param domain_id User-defined ID for this instance domain.
+     * @param slab_size Number of objects to allocate at a time.
+     */
+    explicit typed_indom(const domain_id_type domain_id = PM_INDOM_NULL,
+                         const size_t slab_size = 64)
+        : cached_instance_domain(domain_id),
+          slab_size((slab_size == 0) ? 1 : slab_size),
+          used_count(0)
+    {
+
+    }
+
+    /**
+     * @brief Destructor.
+     *
+     * Destroys all objects, and releases their slabs.
+     */
+    virtual ~typed_indom()
+    {
+        for (typename std::vector<slot *>::iterator slab = slabs.begin();
+             slab != slabs.end(); ++slab) {
+            for (size_t index = 0; index < slab_size; ++index) {
+                if ((*slab)[index].instance_id >= 0) {
+                    (*slab)[index].object()->~Type();
+                }
+            }
+            delete [] *slab;
+        }
+    }
+
+    /**
+     * @brief Functor for setting this instance's domain ID.
+     *
+     * @param domain_id ID for the instance domain.
+     *
+     * @return A reference to this instance domain.
+     */
+    typed_indom& operator()(const domain_id_type domain_id)
+    {
+        cached_instance_domain::operator()(domain_id);
+        return *this;
+    }
+
+    /**
+     * @brief Add, or re-activate, an instance.
+     *
+     * Instances still in use should be stored regularly, even when already
+     * active, since doing so refreshes their cache timestamps; see purge.
+     *
+     * @param name Instance name to store.
+     *
+     * @throw pcp::exception On error.
+     *
+     * @return The instance's object, default constructed if new.
+     */
+    Type & store(const std::string &name)
+    {
+        return store_name(name);
+    }
+
+    /**
+     * @brief Add, or re-activate, an instance, without allocating.
+     *
+     * Objects are still allocated (a slab at a time) as needed.
+     *
+     * @param name Instance name to store.
+     *
+     * @throw pcp::exception On error.
+     *
+     * @return The instance's object, default constructed if new.
+     */
+    Type & store(const string_ref &name)
+    {
+        return store_name(name);
+    }
+
+    /**
+     * @brief Find an instance's object, by instance ID.
+     *
+     * @param instance_id Instance ID to lookup.
+     * @param flags       Optional flags that alter the function's behaviour.
+     *
+     * @return The instance's object, or \c NULL if not found (or not active,
+     *         if \a flags includes \a require_active).
+     */
+    Type * find(const instance_id_type instance_id,
+                const lookup_flags flags = require_active) const
+    {
+        return object_of(try_lookup<Type *>(get_pm_instance_domain(), instance_id), flags);
+    }
+
+    /**
+     * @brief Find an instance's object, by instance name.
+     *
+     * @param name  Instance name to lookup.
+     * @param flags Optional flags that alter the function's behaviour.
+     *
+     * @return The instance's object, or \c NULL if not found (or not active,
+     *         if \a flags includes \a require_active).
+     */
+    Type * find(const std::string &name, const lookup_flags flags = require_active) const
+    {
+        return object_of(try_lookup<Type *>(get_pm_instance_domain(), name), flags);
+    }
+
+    /**
+     * @brief Find an instance's object, by instance name, without allocating.
+     *
+     * @param name  Instance name to lookup.
+     * @param flags Optional flags that alter the function's behaviour.
+     *
+     * @return The instance's object, or \c NULL if not found (or not active,
+     *         if \a flags includes \a require_active).
+     */
+    Type * find(const string_ref &name, const lookup_flags flags = require_active) const
+    {
+        return object_of(try_lookup<Type *>(get_pm_instance_domain(), name), flags);
+    }
+
+    /**
+     * @brief Purge instances that have not been stored for some time.
+     *
+     * The purged instances' objects are destroyed, and their slots reused.
+     * Like pcp::cache::purge, this includes active instances that have not
+     * been stored within \a recent seconds.
+     *
+     * @param recent All instances that have not been stored within this many
+     *               seconds will be purged.
+     *
+     * @throw pcp::exception On error.
+     *
+     * @return The number of instances purged.
+     *
+     * @see pcp::cache::purge
+     */
+    size_t purge(const time_t recent)
+    {
+        const size_t count = cached_instance_domain::purge(recent);
+        if (count > 0) {
+            release_purged();
+        }
+        return count;
+    }
+
+    /**
+     * @brief Get the number of objects currently allocated.
+     *
+     * @return The number of instances, active or not, with objects.
+     */
+    size_t size() const
+    {
+        return used_count;
+    }
+
+    /**
+     * @brief Get the number of objects that can be allocated without
+     *        allocating another slab.
+     *
+     * @return The total number of object slots, used or not.
+     */
+    size_t capacity() const
+    {
+        return slabs.size() * slab_size;
+    }
+
+private:
+    /// @brief Storage for a single object, aligned for most types.
+    union storage_type {
+        char bytes[sizeof(Type)];
+        long double align_long_double;
+        uint64_t align_uint64;
+        void * align_pointer;
+    };
+
+#if __cplusplus >= 201103L
+    static_assert(alignof(Type) <= alignof(storage_type),
+                  "typed_indom does not support over-aligned types");
+#elif defined __GNUC__
+    typedef char over_aligned_types_not_supported[
+        (__alignof__(Type) <= __alignof__(storage_type)) ? 1 : -1];
+#endif
+
+    /// @brief Storage for a single object.
+    struct slot {
+        storage_type storage; ///< Storage for the object; must be the first member.
+        int instance_id;      ///< Owning cache entry's instance ID, or -1 if free.
+
+        slot() : instance_id(-1)
+        {
+
+        }
+
+        Type * object()
+        {
+            return reinterpret_cast<Type *>(storage.bytes);
+        }
+    };
+
+    const size_t slab_size;         ///< Number of slots per slab.
+    std::vector<slot *> slabs;      ///< Slabs of slab_size slots each.
+    std::vector<slot *> free_slots; ///< Unused slots, to allocate from.
+    size_t used_count;              ///< Number of slots holding objects.
+
+    // Hidden, since copies would share (then double-destroy) their objects.
+    typed_indom(const typed_indom &);
+    typed_indom &operator=(const typed_indom &);
+
+    // Hidden, since the synced opaque pointers would not be objects we own.
+    using cached_instance_domain::sync;
+
+    template <typename Name>
+    Type & store_name(const Name &name)
+    {
+        // Instances that come back keep their existing objects.  Active
+        // instances are stored again too, to refresh their cache timestamps,
+        // so that purge does not destroy objects that are still in use.
+        const lookup_result_type<Type *> existing =
+            try_lookup<Type *>(get_pm_instance_domain(), name);
+        if ((existing.status >= 0) && (existing.opaque != NULL)) {
+            cached_instance_domain::store(name, existing.opaque);
+            return *existing.opaque;
+        }
+
+        slot * const new_slot = allocate();
+        try {
+            new_slot->instance_id = static_cast<int>(
+                cached_instance_domain::store(name, new_slot->object()));
+        } catch (...) {
+            release(new_slot);
+            throw;
+        }
+        return *new_slot->object();
+    }
+
+    static Type * object_of(const lookup_result_type<Type *> &result,
+                            const lookup_flags flags)
+    {
+        if ((result.status < 0) ||
+            ((flags & require_active) && (result.status != PMDA_CACHE_ACTIVE))) {
+            return NULL;
+        }
+        return result.opaque;
+    }
+
+    // Takes a free slot, and default constructs its object.
+    slot * allocate()
+    {
+        if (free_slots.empty()) {
+            slot * const slab = new slot [slab_size];
+            slabs.push_back(slab);
+            free_slots.reserve(capacity());
+            for (size_t index = slab_size; index > 0; --index) {
+                free_slots.push_back(&slab[index - 1]);
+            }
+        }
+        slot * const free_slot = free_slots.back();
+        new (free_slot->storage.bytes) Type();
+        free_slots.pop_back();
+        free_slot->instance_id = INT_MAX; // Used, pending its instance ID.
+        ++used_count;
+        return free_slot;
+    }
+
+    // Destroys a slot's object, and returns the slot to the free list.
+    void release(slot * const used_slot)
+    {
+        used_slot->object()->~Type();
+        used_slot->instance_id = -1;
+        free_slots.push_back(used_slot); // Capacity already reserved.
+        --used_count;
+    }
+
+    // Releases the slots whose instances are no longer in the cache.
+    void release_purged()
+    {
+        for (typename std::vector<slot *>::iterator slab = slabs.begin();
+             slab != slabs.end(); ++slab) {
+            for (size_t index = 0; index < slab_size; ++index) {
+                slot &used_slot = (*slab)[index];
+                if (used_slot.instance_id < 0) {
+                    continue;
+                }
+                void * opaque = NULL;
+                if ((pmdaCacheLookup(get_pm_instance_domain(), used_slot.instance_id,
+                                     NULL, &opaque) < 0) ||
+                    (opaque != used_slot.object())) {
+                    release(&used_slot);
+                }
+            }
+        }
+    }
+
+};
+
+} } // pcp::cache namespace.
+
+PCP_CPP_END_NAMESPACE
+
+#endif
@@ -47,6 +47,35 @@ template <> inline atom_type_type type<double>() { return PM_TYPE_DOUBLE; } ///<
 template <> inline atom_type_type type<char *>      () { return PM_TYPE_STRING; } ///< Template specialisation for `char *`.
 template <> inline atom_type_type type<std::string> () { return PM_TYPE_STRING; } ///< Template specialisation for std::string.
 
+/**
+ * @brief Compile-time PM_TYPE_* constant for a given C++ type.
+ *
+ * This is the compile-time equivalent of pcp::type, for use in constant
+ * expressions, such as static metric tables.  Unsupported types have no
+ * definition, so using them fails to compile.
+ *
+ * @see pcp::type
+ */
+template <typename Type> struct atom_type_of;
+
+/// @cond internal
+#define PCP_CPP_ATOM_TYPE_OF(Type, Value) \
+    template <> struct atom_type_of<Type> { static const atom_type_type value = Value; }
+PCP_CPP_ATOM_TYPE_OF(int8_t,      PM_TYPE_32);
+PCP_CPP_ATOM_TYPE_OF(int16_t,     PM_TYPE_32);
+PCP_CPP_ATOM_TYPE_OF(int32_t,     PM_TYPE_32);
+PCP_CPP_ATOM_TYPE_OF(int64_t,     PM_TYPE_64);
+PCP_CPP_ATOM_TYPE_OF(uint8_t,     PM_TYPE_U32);
+PCP_CPP_ATOM_TYPE_OF(uint16_t,    PM_TYPE_U32);
+PCP_CPP_ATOM_TYPE_OF(uint32_t,    PM_TYPE_U32);
+PCP_CPP_ATOM_TYPE_OF(uint64_t,    PM_TYPE_U64);
+PCP_CPP_ATOM_TYPE_OF(float,       PM_TYPE_FLOAT);
+PCP_CPP_ATOM_TYPE_OF(double,      PM_TYPE_DOUBLE);
+PCP_CPP_ATOM_TYPE_OF(char *,      PM_TYPE_STRING);
+PCP_CPP_ATOM_TYPE_OF(std::string, PM_TYPE_STRING);
+#undef PCP_CPP_ATOM_TYPE_OF
+/// @endcond
+
 } // pcp namespace.
 
 PCP_CPP_END_NAMESPACE
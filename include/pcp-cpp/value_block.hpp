@@ -0,0 +1,525 @@
+//            Copyright Paul Colby 2013 - 2018.
+// Distributed under the Boost Software License, Version 1.0.
+//       (See accompanying file LICENSE.md or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+/**
+ * @file
+ * @brief Defines pmValueBlock helper classes.
+ */
+
+#ifndef __PCP_CPP_VALUE_BLOCK_HPP__
+#define __PCP_CPP_VALUE_BLOCK_HPP__
+
+#include "atom.hpp"
+#include "config.hpp"
+#include "exception.hpp"
+#include "types.hpp"
+
+#include <cstring>
+#include <vector>
+
+PCP_CPP_BEGIN_NAMESPACE
+
+namespace pcp {
+
+/**
+ * @brief Pool of pmValueBlock buffers, released all at once.
+ *
+ * This class builds pmValueBlock values (such as for PM_TYPE_AGGREGATE
+ * metrics) directly in large, reusable chunks of memory.  Blocks remain valid
+ * until the next call to reset, which keeps all chunks for re-use.  So once a
+ * pool has grown to its working size, building blocks performs no heap
+ * allocations, and payloads written via extend are never copied by the pool.
+ *
+ * The pcp::pmda class resets its pool at the start of every fetch, so blocks
+ * built with it may be returned from fetch_value with the default
+ * PMDA_FETCH_STATIC code; libpcp copies each value into its result, and never
+ * frees the pool's blocks.
+ *
+ * For example:
+ * @code
+ * pcp::value_block_pool &pool = get_value_block_pool();
+ * pool.begin();
+ * pool.append(&header, sizeof(header));
+ * read_payload(pool.extend(payload_size), payload_size);
+ * return pcp::atom(metric.type, pool.finish());
+ * @endcode
+ *
+ * @see pcp::pmda::get_value_block_pool
+ */
+class value_block_pool {
+
+public:
+
+    /**
+     * @brief Constructor.
+     *
+     * @param chunk_size Minimum size of each chunk of memory, in bytes.
+     */
+    explicit value_block_pool(const size_t chunk_size = 64 * 1024)
+        : chunk_size(chunk_size), current_chunk(0), current_offset(0),
+          block_offset(0), block_length(0), block_type(PM_TYPE_AGGREGATE)
+    {
+
+    }
+
+    /**
+     * @brief Destructor.
+     */
+    ~value_block_pool()
+    {
+        for (std::vector<chunk>::iterator iter = chunks.begin(); iter != chunks.end(); ++iter) {
+            delete[] iter->data;
+        }
+    }
+
+    /**
+     * @brief Begin building a new block.
+     *
+     * Any block begun, but not yet finished, is discarded.
+     *
+     * @param type Value type to record in the block's header.
+     *
+     * @throw std::bad_alloc If more memory was needed, and not available.
+     */
+    void begin(const atom_type_type type = PM_TYPE_AGGREGATE)
+    {
+        block_offset = align(current_offset);
+        block_length = 0;
+        block_type = type;
+        reserve(0);
+    }
+
+    /**
+     * @brief Extend the block being built.
+     *
+     * The caller should write exactly \a length bytes of payload to the
+     * returned address, which remains valid until the next call to extend,
+     * append, begin or reset.
+     *
+     * @param length Number of payload bytes to add.
+     *
+     * @throw pcp::exception If the block would exceed PM_VAL_VLEN_MAX bytes.
+     * @throw std::bad_alloc If more memory was needed, and not available.
+     *
+     * @return Address at which to write the new payload bytes.
+     */
+    void * extend(const size_t length)
+    {
+        reserve(length);
+        char * const payload = chunks[current_chunk].data + block_offset +
+                               PM_VAL_HDR_SIZE + block_length;
+        block_length += length;
+        return payload;
+    }
+
+    /**
+     * @brief Append a copy of some data to the block being built.
+     *
+     * @param data   Data to append.
+     * @param length Length of \a data, in bytes.
+     *
+     * @throw pcp::exception If the block would exceed PM_VAL_VLEN_MAX bytes.
+     * @throw std::bad_alloc If more memory was needed, and not available.
+     */
+    void append(const void * const data, const size_t length)
+    {
+        memcpy(extend(length), data, length);
+    }
+
+    /**
+     * @brief Finish building the current block.
+     *
+     * @return The finished block, valid until the next reset.
+     */
+    pmValueBlock * finish()
+    {
+        pmValueBlock * const block = reinterpret_cast<pmValueBlock *>(
+            chunks[current_chunk].data + block_offset);
+        block->vtype = block_type;
+        block->vlen = PM_VAL_HDR_SIZE + block_length;
+        current_offset = block_offset + PM_VAL_HDR_SIZE + block_length;
+        return block;
+    }
+
+    /**
+     * @brief Build a block from a copy of some data.
+     *
+     * @param data   Payload to copy into the block.
+     * @param length Length of \a data, in bytes.
+     * @param type   Value type to record in the block's header.
+     *
+     * @throw pcp::exception If the block would exceed PM_VAL_VLEN_MAX bytes.
+     * @throw std::bad_alloc If more memory was needed, and not available.
+     *
+     * @return The new block, valid until the next reset.
+     */
+    pmValueBlock * store(const void * const data, const size_t length,
+                         const atom_type_type type = PM_TYPE_AGGREGATE)
+    {
+        begin(type);
+        append(data, length);
+        return finish();
+    }
+
+    /**
+     * @brief Release all blocks built by this pool.
+     *
+     * All memory is retained for re-use.  Blocks previously returned by finish
+     * or store must not be used after calling this function.
+     */
+    void reset()
+    {
+        current_chunk = 0;
+        current_offset = 0;
+        block_offset = 0;
+        block_length = 0;
+    }
+
+    /**
+     * @brief Get the total memory held by this pool.
+     *
+     * @return The combined size of all chunks, in bytes.
+     */
+    size_t capacity() const
+    {
+        size_t total = 0;
+        for (std::vector<chunk>::const_iterator iter = chunks.begin(); iter != chunks.end(); ++iter) {
+            total += iter->size;
+        }
+        return total;
+    }
+
+private:
+    /// @brief A single block of pool memory.
+    struct chunk {
+        char * data; ///< Chunk memory.
+        size_t size; ///< Size of \a data, in bytes.
+    };
+
+    const size_t chunk_size;     ///< Minimum size of new chunks.
+    std::vector<chunk> chunks;   ///< All chunks, in order of use.
+    size_t current_chunk;        ///< Index of the chunk currently being filled.
+    size_t current_offset;       ///< Bytes used by finished blocks in the current chunk.
+    size_t block_offset;         ///< Offset of the block being built.
+    size_t block_length;         ///< Payload bytes in the block being built.
+    atom_type_type block_type;   ///< Type of the block being built.
+
+    static size_t align(const size_t offset)
+    {
+        const size_t alignment = sizeof(void *);
+        return (offset + alignment - 1) / alignment * alignment;
+    }
+
+    // Ensure the block being built has room for another length bytes, moving
+    // it to a larger chunk if necessary.
+    void reserve(const size_t length)
+    {
+        const size_t required = PM_VAL_HDR_SIZE + block_length + length;
+        if (required > PM_VAL_VLEN_MAX) {
+            throw pcp::exception(PM_ERR_TOOBIG);
+        }
+        if ((current_chunk < chunks.size()) &&
+            (block_offset + required <= chunks[current_chunk].size)) {
+            return;
+        }
+
+        // Find the next unused chunk that is big enough, or add a new chunk
+        // with room to double, so that growing blocks are moved rarely.
+        const bool had_chunk = (current_chunk < chunks.size());
+        size_t next_chunk = had_chunk ? current_chunk + 1 : current_chunk;
+        while ((next_chunk < chunks.size()) && (chunks[next_chunk].size < required)) {
+            ++next_chunk;
+        }
+        if (next_chunk == chunks.size()) {
+            chunks.reserve(chunks.size() + 1); // So push_back cannot throw.
+            chunk new_chunk;
+            new_chunk.size = (required * 2 > chunk_size) ? required * 2 : chunk_size;
+            new_chunk.data = new char[new_chunk.size];
+            chunks.push_back(new_chunk);
+        }
+        // Only move the block if it was being built in an existing chunk.
+        if (had_chunk && (next_chunk != current_chunk)) {
+            memcpy(chunks[next_chunk].data, chunks[current_chunk].data + block_offset,
+                   PM_VAL_HDR_SIZE + block_length);
+        }
+        current_chunk = next_chunk;
+        current_offset = 0;
+        block_offset = 0;
+    }
+
+    // Pools own their chunks, so cannot be copied.
+    value_block_pool(const value_block_pool &);
+    value_block_pool &operator=(const value_block_pool &);
+
+};
+
+/**
+ * @brief Reusable PM_TYPE_EVENT array.
+ *
+ * This is a simple wrapper for PCP's pmdaEvent* functions, which build event
+ * arrays in buffers that are retained (and grown as needed) across resets.
+ * Typically, an agent keeps one event_array per instance, calling reset at
+ * the start of each fetch.  The result of get may then be returned from
+ * fetch_value with the default PMDA_FETCH_STATIC code.
+ *
+ * @see pmdaEventNewArray
+ */
+class event_array {
+
+public:
+
+    /**
+     * @brief Constructor.
+     *
+     * @throw pcp::exception On error.
+     */
+    event_array()
+        : handle(check(pmdaEventNewArray()))
+    {
+
+    }
+
+    /**
+     * @brief Destructor.
+     */
+    ~event_array()
+    {
+        pmdaEventReleaseArray(handle);
+    }
+
+    /**
+     * @brief Remove all records, retaining the array's buffer for re-use.
+     *
+     * @throw pcp::exception On error.
+     */
+    void reset()
+    {
+        check(pmdaEventResetArray(handle));
+    }
+
+    /**
+     * @brief Add a new event record.
+     *
+     * @param timestamp Time the event occurred.
+     * @param flags     Optional PM_EVENT_FLAG_* flags.
+     *
+     * @throw pcp::exception On error.
+     */
+    void add_record(const struct timeval &timestamp, const int flags = 0)
+    {
+        struct timeval copy = timestamp;
+        check(pmdaEventAddRecord(handle, &copy, flags));
+    }
+
+    /**
+     * @brief Add a record noting that some events were missed.
+     *
+     * @param timestamp Time the events were missed.
+     * @param count     Number of events missed.
+     *
+     * @throw pcp::exception On error.
+     */
+    void add_missed_records(const struct timeval &timestamp, const int count)
+    {
+        struct timeval copy = timestamp;
+        check(pmdaEventAddMissedRecord(handle, &copy, count));
+    }
+
+    /**
+     * @brief Add a parameter to the most recent event record.
+     *
+     * @param pmid  Metric ID of the parameter.
+     * @param type  Type of the parameter's value.
+     * @param value The parameter's value.
+     *
+     * @throw pcp::exception On error.
+     */
+    void add_parameter(const pmID pmid, const atom_type_type type, const pmAtomValue &value)
+    {
+        pmAtomValue copy = value;
+        check(pmdaEventAddParam(handle, pmid, type, &copy));
+    }
+
+    /**
+     * @brief Add a parameter to the most recent event record.
+     *
+     * @tparam ValueType Type of \a value; see pcp::atom.
+     *
+     * @param pmid  Metric ID of the parameter.
+     * @param type  Type of the parameter's value.
+     * @param value The parameter's value.
+     *
+     * @throw pcp::exception On error.
+     */
+    template <typename ValueType>
+    void add_parameter(const pmID pmid, const atom_type_type type, const ValueType value)
+    {
+        add_parameter(pmid, type, pcp::atom(type, value));
+    }
+
+    /**
+     * @brief Get the event array, as a value block.
+     *
+     * @return The event array, valid until the next call to any non-const
+     *         function on this object.
+     */
+    pmValueBlock * get()
+    {
+        return reinterpret_cast<pmValueBlock *>(pmdaEventGetAddr(handle));
+    }
+
+private:
+    const int handle; ///< Array handle, as returned by pmdaEventNewArray.
+
+    static int check(const int result)
+    {
+        if (result < 0) {
+            throw pcp::exception(result);
+        }
+        return result;
+    }
+
+    // Event arrays own their handle, so cannot be copied.
+    event_array(const event_array &);
+    event_array &operator=(const event_array &);
+
+};
+
+#ifdef PM_TYPE_HIGHRES_EVENT // PM_TYPE_HIGHRES_EVENT added in PCP 3.9.10.
+/**
+ * @brief Reusable PM_TYPE_HIGHRES_EVENT array.
+ *
+ * This is the high resolution (nanosecond timestamp) equivalent of
+ * pcp::event_array.
+ *
+ * @see pmdaEventNewHighResArray
+ */
+class highres_event_array {
+
+public:
+
+    /**
+     * @brief Constructor.
+     *
+     * @throw pcp::exception On error.
+     */
+    highres_event_array()
+        : handle(check(pmdaEventNewHighResArray()))
+    {
+
+    }
+
+    /**
+     * @brief Destructor.
+     */
+    ~highres_event_array()
+    {
+        pmdaEventReleaseHighResArray(handle);
+    }
+
+    /**
+     * @brief Remove all records, retaining the array's buffer for re-use.
+     *
+     * @throw pcp::exception On error.
+     */
+    void reset()
+    {
+        check(pmdaEventResetHighResArray(handle));
+    }
+
+    /**
+     * @brief Add a new event record.
+     *
+     * @param timestamp Time the event occurred.
+     * @param flags     Optional PM_EVENT_FLAG_* flags.
+     *
+     * @throw pcp::exception On error.
+     */
+    void add_record(const struct timespec &timestamp, const int flags = 0)
+    {
+        struct timespec copy = timestamp;
+        check(pmdaEventAddHighResRecord(handle, &copy, flags));
+    }
+
+    /**
+     * @brief Add a record noting that some events were missed.
+     *
+     * @param timestamp Time the events were missed.
+     * @param count     Number of events missed.
+     *
+     * @throw pcp::exception On error.
+     */
+    void add_missed_records(const struct timespec &timestamp, const int count)
+    {
+        struct timespec copy = timestamp;
+        check(pmdaEventAddHighResMissedRecord(handle, &copy, count));
+    }
+
+    /**
+     * @brief Add a parameter to the most recent event record.
+     *
+     * @param pmid  Metric ID of the parameter.
+     * @param type  Type of the parameter's value.
+     * @param value The parameter's value.
+     *
+     * @throw pcp::exception On error.
+     */
+    void add_parameter(const pmID pmid, const atom_type_type type, const pmAtomValue &value)
+    {
+        pmAtomValue copy = value;
+        check(pmdaEventHighResAddParam(handle, pmid, type, &copy));
+    }
+
+    /**
+     * @brief Add a parameter to the most recent event record.
+     *
+     * @tparam ValueType Type of \a value; see pcp::atom.
+     *
+     * @param pmid  Metric ID of the parameter.
+     * @param type  Type of the parameter's value.
+     * @param value The parameter's value.
+     *
+     * @throw pcp::exception On error.
+     */
+    template <typename ValueType>
+    void add_parameter(const pmID pmid, const atom_type_type type, const ValueType value)
+    {
+        add_parameter(pmid, type, pcp::atom(type, value));
+    }
+
+    /**
+     * @brief Get the event array, as a value block.
+     *
+     * @return The event array, valid until the next call to any non-const
+     *         function on this object.
+     */
+    pmValueBlock * get()
+    {
+        return reinterpret_cast<pmValueBlock *>(pmdaEventHighResGetAddr(handle));
+    }
+
+private:
+    const int handle; ///< Array handle, as returned by pmdaEventNewHighResArray.
+
+    static int check(const int result)
+    {
+        if (result < 0) {
+            throw pcp::exception(result);
+        }
+        return result;
+    }
+
+    // Event arrays own their handle, so cannot be copied.
+    highres_event_array(const highres_event_array &);
+    highres_event_array &operator=(const highres_event_array &);
+
+};
+#endif
+
+} // pcp namespace.
+
+PCP_CPP_END_NAMESPACE
+
+#endif
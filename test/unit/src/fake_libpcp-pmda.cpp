@@ -15,10 +15,17 @@
 
 // PCP 4.0.0 clean and promoted some functions, renaming them in the process.
 #if !defined PM_VERSION_CURRENT || PM_VERSION_CURRENT < PM_VERSION(4,0,0)
+#define pmInProfile __pmInProfile
 #define pmInResult __pmInResult
 #define pmProfile __pmProfile
+#define pmStuffValue __pmStuffValue
 #endif
 
+#include "fake_libpcp-pmda.h"
+
+#include <map>
+#include <string>
+
 extern "C" {
 
 int pmdaAttribute(int /*context*/, int /*key*/, const char */*value*/, int /*length*/,
@@ -27,39 +34,233 @@ int pmdaAttribute(int /*context*/, int /*key*/, const char */*value*/, int /*len
     return PM_ERR_NYI;
 }
 
-int pmdaCacheLookup(pmInDom indom, int, char **, void **)
+} // extern "C"
+
+// A minimal in-memory PMDA cache, for instance domains enabled via
+// fake_pmda_cache.  All other instance domains keep the simpler behaviour of
+// echoing their pmInDom back, which many tests use to inject results.
+struct fake_cache_entry {
+    std::string name;
+    std::string key;
+    void * opaque;
+    bool active;
+    time_t stamp; // fake_cache_clock at the entry's most recent PMDA_CACHE_ADD.
+};
+
+struct fake_cache_type {
+    std::map<int, fake_cache_entry> entries;
+    std::map<int, fake_cache_entry>::const_iterator walk;
+    int next_inst;
+};
+
+static std::map<pmInDom, fake_cache_type> fake_caches;
+static time_t fake_cache_clock = 1000;
+
+fake_pmda_cache::fake_pmda_cache(const pmInDom indom) : indom(indom)
+{
+    fake_cache_type &cache = fake_caches[indom];
+    cache.entries.clear();
+    cache.walk = cache.entries.end();
+    cache.next_inst = 0;
+}
+
+fake_pmda_cache::~fake_pmda_cache()
+{
+    fake_caches.erase(indom);
+}
+
+void fake_pmda_cache::advance_clock(const time_t seconds)
+{
+    fake_cache_clock += seconds;
+}
+
+static fake_cache_type * find_fake_cache(const pmInDom indom)
+{
+    const std::map<pmInDom, fake_cache_type>::iterator cache = fake_caches.find(indom);
+    return (cache == fake_caches.end()) ? NULL : &cache->second;
+}
+
+static std::map<int, fake_cache_entry>::iterator find_fake_entry(
+    fake_cache_type &cache, const std::string &name, const std::string &key)
+{
+    std::map<int, fake_cache_entry>::iterator entry = cache.entries.begin();
+    while ((entry != cache.entries.end()) &&
+           ((key.empty() ? entry->second.name : entry->second.key) !=
+            (key.empty() ? name : key))) {
+        ++entry;
+    }
+    return entry;
+}
+
+static int lookup_fake_entry(const fake_cache_entry &entry, char **name, void **opaque)
+{
+    if (name != NULL) {
+        *name = const_cast<char *>(entry.name.c_str());
+    }
+    if (opaque != NULL) {
+        *opaque = entry.opaque;
+    }
+    return entry.active ? PMDA_CACHE_ACTIVE : PMDA_CACHE_INACTIVE;
+}
+
+static int store_fake_entry(fake_cache_type &cache, const int flags, const char *name,
+                            const std::string &key, void *opaque)
+{
+    std::map<int, fake_cache_entry>::iterator entry = find_fake_entry(cache, name, key);
+    switch (flags) {
+    case PMDA_CACHE_ADD:
+        if (entry == cache.entries.end()) {
+            fake_cache_entry new_entry = { name, key, opaque, true, fake_cache_clock };
+            return cache.entries.insert(std::make_pair(cache.next_inst++, new_entry)).first->first;
+        }
+        entry->second.opaque = opaque;
+        entry->second.active = true;
+        entry->second.stamp = fake_cache_clock;
+        return entry->first;
+    case PMDA_CACHE_HIDE:
+        if (entry == cache.entries.end()) {
+            return PM_ERR_INST;
+        }
+        entry->second.active = false;
+        return entry->first;
+    case PMDA_CACHE_CULL:
+        if (entry == cache.entries.end()) {
+            return PM_ERR_INST;
+        }
+        {
+            const int inst = entry->first;
+            cache.entries.erase(entry);
+            cache.walk = cache.entries.end();
+            return inst;
+        }
+    default:
+        return PM_ERR_NYI;
+    }
+}
+
+extern "C" {
+
+int pmdaCacheLookup(pmInDom indom, int inst, char **name, void **opaque)
 {
-    return indom;
+    fake_cache_type * const cache = find_fake_cache(indom);
+    if (cache == NULL) {
+        return indom;
+    }
+    const std::map<int, fake_cache_entry>::const_iterator entry = cache->entries.find(inst);
+    return (entry == cache->entries.end()) ? PM_ERR_INST
+                                           : lookup_fake_entry(entry->second, name, opaque);
 }
 
-int pmdaCacheLookupName(pmInDom indom, const char *, int *, void **)
+int pmdaCacheLookupName(pmInDom indom, const char *name, int *inst, void **opaque)
 {
-    return indom;
+    fake_cache_type * const cache = find_fake_cache(indom);
+    if (cache == NULL) {
+        *inst = indom;
+        if (opaque != NULL) {
+            *opaque = NULL;
+        }
+        return indom;
+    }
+    const std::map<int, fake_cache_entry>::iterator entry =
+        find_fake_entry(*cache, name, std::string());
+    if (entry == cache->entries.end()) {
+        return PM_ERR_INST;
+    }
+    *inst = entry->first;
+    return lookup_fake_entry(entry->second, NULL, opaque);
 }
 
-int pmdaCacheLookupKey(pmInDom indom, const char *, int, const void *, char **, int *, void **)
+int pmdaCacheLookupKey(pmInDom indom, const char *name, int keylen, const void *key,
+                       char **oname, int *inst, void **opaque)
 {
-    return indom;
+    fake_cache_type * const cache = find_fake_cache(indom);
+    if (cache == NULL) {
+        *inst = indom;
+        return indom;
+    }
+    const std::map<int, fake_cache_entry>::iterator entry = find_fake_entry(*cache,
+        name, std::string(static_cast<const char *>(key), (key == NULL) ? 0 : keylen));
+    if (entry == cache->entries.end()) {
+        return PM_ERR_INST;
+    }
+    *inst = entry->first;
+    return lookup_fake_entry(entry->second, oname, opaque);
 }
 
 int pmdaCacheOp(pmInDom indom, int op)
 {
-    return ((int)indom < 0) ? indom : op;
+    fake_cache_type * const cache = find_fake_cache(indom);
+    if (cache == NULL) {
+        if (op == PMDA_CACHE_WALK_NEXT) {
+            return -1; // Walks always find an empty cache.
+        }
+        return ((int)indom < 0) ? indom : op;
+    }
+    int count = 0;
+    switch (op) {
+    case PMDA_CACHE_ACTIVE:
+    case PMDA_CACHE_INACTIVE:
+        for (std::map<int, fake_cache_entry>::iterator entry = cache->entries.begin();
+             entry != cache->entries.end(); ++entry) {
+            entry->second.active = (op == PMDA_CACHE_ACTIVE);
+        }
+        return 0;
+    case PMDA_CACHE_SIZE:
+        return cache->entries.size();
+    case PMDA_CACHE_SIZE_ACTIVE:
+    case PMDA_CACHE_SIZE_INACTIVE:
+        for (std::map<int, fake_cache_entry>::const_iterator entry = cache->entries.begin();
+             entry != cache->entries.end(); ++entry) {
+            count += (entry->second.active == (op == PMDA_CACHE_SIZE_ACTIVE)) ? 1 : 0;
+        }
+        return count;
+    case PMDA_CACHE_WALK_REWIND:
+        cache->walk = cache->entries.begin();
+        return 0;
+    case PMDA_CACHE_WALK_NEXT:
+        while ((cache->walk != cache->entries.end()) && (!cache->walk->second.active)) {
+            ++cache->walk;
+        }
+        return (cache->walk == cache->entries.end()) ? -1 : (cache->walk++)->first;
+    default:
+        return 0;
+    }
 }
 
 int pmdaCachePurge(pmInDom indom, time_t recent)
 {
-    return ((int)indom < 0) ? indom : recent;
+    fake_cache_type * const cache = find_fake_cache(indom);
+    if (cache == NULL) {
+        return ((int)indom < 0) ? indom : recent;
+    }
+    // As per libpcp_pmda, entries (active or not) that have not been added
+    // within the last recent seconds are culled.
+    int count = 0;
+    for (std::map<int, fake_cache_entry>::iterator entry = cache->entries.begin();
+         entry != cache->entries.end();) {
+        if (entry->second.stamp >= fake_cache_clock - recent) {
+            ++entry;
+        } else {
+            cache->entries.erase(entry++);
+            ++count;
+        }
+    }
+    cache->walk = cache->entries.end();
+    return count;
 }
 
-int pmdaCacheStore(pmInDom indom, int, const char *, void *)
+int pmdaCacheStore(pmInDom indom, int flags, const char *name, void *opaque)
 {
-    return indom;
+    fake_cache_type * const cache = find_fake_cache(indom);
+    return (cache == NULL) ? indom : store_fake_entry(*cache, flags, name, std::string(), opaque);
 }
 
-int pmdaCacheStoreKey(pmInDom indom, int, const char *, int, const void *, void *)
+int pmdaCacheStoreKey(pmInDom indom, int flags, const char *name, int keylen,
+                      const void *key, void *opaque)
 {
-    return indom;
+    fake_cache_type * const cache = find_fake_cache(indom);
+    return (cache == NULL) ? indom : store_fake_entry(*cache, flags, name,
+        std::string(static_cast<const char *>(key), (key == NULL) ? 0 : keylen), opaque);
 }
 
 int pmdaChildren(const char */*name*/, int /*traverse*/, char ***/*offspring*/,
@@ -97,6 +298,129 @@ void pmdaDSO(pmdaInterface *, int , char *, char *)
 
 }
 
+// Minimal event arrays, tracking only the number of records in each.
+static pmEventArray fake_event_arrays[4];
+static bool fake_event_arrays_used[4];
+
+int pmdaEventNewArray(void)
+{
+    for (int handle = 0; handle < 4; ++handle) {
+        if (!fake_event_arrays_used[handle]) {
+            fake_event_arrays_used[handle] = true;
+            memset(&fake_event_arrays[handle], 0, sizeof(pmEventArray));
+            fake_event_arrays[handle].ea_type = PM_TYPE_EVENT;
+            return handle;
+        }
+    }
+    return -ENOMEM;
+}
+
+int pmdaEventResetArray(int handle)
+{
+    if ((handle < 0) || (handle >= 4) || (!fake_event_arrays_used[handle])) {
+        return -EINVAL;
+    }
+    fake_event_arrays[handle].ea_nrecords = 0;
+    return 0;
+}
+
+int pmdaEventReleaseArray(int handle)
+{
+    if ((handle < 0) || (handle >= 4) || (!fake_event_arrays_used[handle])) {
+        return -EINVAL;
+    }
+    fake_event_arrays_used[handle] = false;
+    return 0;
+}
+
+int pmdaEventAddRecord(int handle, struct timeval *, int)
+{
+    if ((handle < 0) || (handle >= 4) || (!fake_event_arrays_used[handle])) {
+        return -EINVAL;
+    }
+    return ++fake_event_arrays[handle].ea_nrecords;
+}
+
+int pmdaEventAddMissedRecord(int handle, struct timeval *timestamp, int)
+{
+    return pmdaEventAddRecord(handle, timestamp, PM_EVENT_FLAG_MISSED);
+}
+
+int pmdaEventAddParam(int handle, pmID, int, pmAtomValue *)
+{
+    if ((handle < 0) || (handle >= 4) || (!fake_event_arrays_used[handle]) ||
+        (fake_event_arrays[handle].ea_nrecords == 0)) {
+        return -EINVAL;
+    }
+    return 0;
+}
+
+pmEventArray *pmdaEventGetAddr(int handle)
+{
+    return &fake_event_arrays[handle];
+}
+
+#ifdef PM_TYPE_HIGHRES_EVENT
+static pmHighResEventArray fake_highres_event_array;
+static bool fake_highres_event_array_used;
+
+int pmdaEventNewHighResArray(void)
+{
+    if (fake_highres_event_array_used) {
+        return -ENOMEM;
+    }
+    fake_highres_event_array_used = true;
+    memset(&fake_highres_event_array, 0, sizeof(pmHighResEventArray));
+    fake_highres_event_array.ea_type = PM_TYPE_HIGHRES_EVENT;
+    return 0;
+}
+
+int pmdaEventResetHighResArray(int handle)
+{
+    if ((handle != 0) || (!fake_highres_event_array_used)) {
+        return -EINVAL;
+    }
+    fake_highres_event_array.ea_nrecords = 0;
+    return 0;
+}
+
+int pmdaEventReleaseHighResArray(int handle)
+{
+    if ((handle != 0) || (!fake_highres_event_array_used)) {
+        return -EINVAL;
+    }
+    fake_highres_event_array_used = false;
+    return 0;
+}
+
+int pmdaEventAddHighResRecord(int handle, struct timespec *, int)
+{
+    if ((handle != 0) || (!fake_highres_event_array_used)) {
+        return -EINVAL;
+    }
+    return ++fake_highres_event_array.ea_nrecords;
+}
+
+int pmdaEventAddHighResMissedRecord(int handle, struct timespec *timestamp, int)
+{
+    return pmdaEventAddHighResRecord(handle, timestamp, PM_EVENT_FLAG_MISSED);
+}
+
+int pmdaEventHighResAddParam(int handle, pmID, int, pmAtomValue *)
+{
+    if ((handle != 0) || (!fake_highres_event_array_used) ||
+        (fake_highres_event_array.ea_nrecords == 0)) {
+        return -EINVAL;
+    }
+    return 0;
+}
+
+pmHighResEventArray *pmdaEventHighResGetAddr(int)
+{
+    return &fake_highres_event_array;
+}
+#endif
+
 int pmdaFetch(int /*numpmid*/, pmID */*pmidlist*/, pmResult **/*resp*/,
               pmdaExt */*pmda*/)
 {
@@ -114,6 +438,27 @@ void pmdaInit(pmdaInterface *dispatch, pmdaIndom *indoms,
     dispatch->version.two.ext->e_nmetrics = nmetrics;
 }
 
+int pmInProfile(pmInDom indom, const pmProfile *prof, int inst)
+{
+    // Same semantics as the real function: listed instances are the
+    // exceptions to their instance domain's include / exclude state.
+    if (prof == NULL) {
+        return 1;
+    }
+    for (int index = 0; index < prof->profile_len; ++index) {
+        const pmInDomProfile &indom_profile = prof->profile[index];
+        if (indom_profile.indom == indom) {
+            for (int inst_index = 0; inst_index < indom_profile.instances_len; ++inst_index) {
+                if (indom_profile.instances[inst_index] == inst) {
+                    return (indom_profile.state == PM_PROFILE_EXCLUDE);
+                }
+            }
+            return (indom_profile.state == PM_PROFILE_INCLUDE);
+        }
+    }
+    return (prof->state == PM_PROFILE_INCLUDE);
+}
+
 int pmdaInstance(pmInDom /*indom*/, int /*inst*/, char */*name*/,
                  pmInResult **/*result*/, pmdaExt */*pmda*/)
 {
@@ -135,9 +480,10 @@ int pmdaPMID(const char */*name*/, pmID */*pmid*/, pmdaExt */*pmda*/)
     return PM_ERR_NYI;
 }
 
-int pmdaProfile(pmProfile */*prof*/, pmdaExt */*pmda*/)
+int pmdaProfile(pmProfile *prof, pmdaExt *pmda)
 {
-    return PM_ERR_NYI;
+    pmda->e_prof = prof;
+    return 0;
 }
 
 int pmdaName(pmID /*pmid*/, char ***/*nameset*/, pmdaExt */*pmda*/)
@@ -155,6 +501,37 @@ void pmdaSetFetchCallBack(pmdaInterface *dispatch,
     }
 }
 
+int pmStuffValue(const pmAtomValue *avp, pmValue *vp, int type)
+{
+    switch (type) {
+    case PM_TYPE_32:
+    case PM_TYPE_U32:
+        vp->value.lval = avp->l;
+        return PM_VAL_INSITU;
+    case PM_TYPE_STRING: {
+        const size_t length = strlen(avp->cp) + 1;
+        vp->value.pval = static_cast<pmValueBlock *>(malloc(PM_VAL_HDR_SIZE + length));
+        vp->value.pval->vtype = type;
+        vp->value.pval->vlen = PM_VAL_HDR_SIZE + length;
+        memcpy(vp->value.pval->vbuf, avp->cp, length);
+        return PM_VAL_DPTR;
+    }
+    case PM_TYPE_64:
+    case PM_TYPE_U64:
+    case PM_TYPE_FLOAT:
+    case PM_TYPE_DOUBLE: {
+        const size_t length = (type == PM_TYPE_FLOAT) ? sizeof(float) : sizeof(double);
+        vp->value.pval = static_cast<pmValueBlock *>(malloc(PM_VAL_HDR_SIZE + sizeof(pmAtomValue)));
+        vp->value.pval->vtype = type;
+        vp->value.pval->vlen = PM_VAL_HDR_SIZE + length;
+        memcpy(vp->value.pval->vbuf, avp, length);
+        return PM_VAL_DPTR;
+    }
+    default:
+        return PM_ERR_TYPE;
+    }
+}
+
 int pmdaStore(pmResult */*result*/, pmdaExt */*pmda*/)
 {
     return PM_ERR_NYI;
@@ -0,0 +1,19 @@
+//               Copyright Paul Colby 2018.
+// Distributed under the Boost Software License, Version 1.0.
+//       (See accompanying file LICENSE.md or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include <pcp/pmapi.h>
+
+/// @brief Backs an instance domain with our mock PMDA cache, while in scope.
+class fake_pmda_cache {
+public:
+    explicit fake_pmda_cache(const pmInDom indom);
+    ~fake_pmda_cache();
+
+    /// @brief Advance the clock used to timestamp, and purge, cache entries.
+    static void advance_clock(const time_t seconds);
+
+private:
+    const pmInDom indom;
+};
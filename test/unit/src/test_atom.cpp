@@ -235,3 +235,74 @@ TEST(atom, pm_type_highres_event) {
     EXPECT_THROW(pcp::atom(PM_TYPE_HIGHRES_EVENT, const_cast<char *>("not an event")), pcp::exception);
 }
 #endif
+
+TEST(atom, pm_type_string_arena) {
+    // Strings are copied into the arena.
+    pcp::string_arena arena;
+    const std::string value("arena string");
+    const pmAtomValue atom = pcp::atom(PM_TYPE_STRING, value, arena);
+    EXPECT_STREQ("arena string", atom.cp);
+    EXPECT_NE(value.c_str(), atom.cp);
+
+#if __cplusplus >= 201703L
+    EXPECT_STREQ("view", pcp::atom(PM_TYPE_STRING, std::string_view("viewed", 4), arena).cp);
+#endif
+
+    // Only PM_TYPE_STRING is supported.
+    EXPECT_THROW(pcp::atom(PM_TYPE_32, value, arena), pcp::exception);
+    EXPECT_THROW(pcp::atom(PM_TYPE_AGGREGATE, value, arena), pcp::exception);
+}
+
+TEST(atom, compile_time_types) {
+    EXPECT_EQ(-123, pcp::atom<PM_TYPE_32>(-123).l);
+    EXPECT_EQ(123u, pcp::atom<PM_TYPE_U32>(123).ul);
+    EXPECT_EQ(-1234567890123LL, pcp::atom<PM_TYPE_64>(-1234567890123LL).ll);
+    EXPECT_EQ(1234567890123ULL, pcp::atom<PM_TYPE_U64>(1234567890123ULL).ull);
+    EXPECT_EQ(1.5f, pcp::atom<PM_TYPE_FLOAT>(1.5).f);
+    EXPECT_EQ(2.5, pcp::atom<PM_TYPE_DOUBLE>(2.5f).d);
+
+    char string[] = "string";
+    EXPECT_EQ(string, pcp::atom<PM_TYPE_STRING>(string).cp);
+    pmValueBlock block;
+    EXPECT_EQ(&block, pcp::atom<PM_TYPE_AGGREGATE>(&block).vbp);
+    EXPECT_EQ(&block, pcp::atom<PM_TYPE_AGGREGATE_STATIC>(&block).vbp);
+    EXPECT_EQ(&block, pcp::atom<PM_TYPE_EVENT>(&block).vbp);
+#ifdef PM_TYPE_HIGHRES_EVENT
+    EXPECT_EQ(&block, pcp::atom<PM_TYPE_HIGHRES_EVENT>(&block).vbp);
+#endif
+
+    // Runtime conversions are unaffected.
+    EXPECT_EQ(123u, pcp::atom(PM_TYPE_U32, 123).ul);
+    EXPECT_EQ(string, pcp::atom<char *>(PM_TYPE_STRING, string).cp);
+}
+
+TEST(atom, bulk_conversions) {
+    const uint8_t bytes[] = { 0, 1, 255 };
+    pmAtomValue atoms[3];
+    memset(atoms, 0, sizeof(atoms));
+    pcp::atoms(PM_TYPE_U32, bytes, 3, atoms);
+    EXPECT_EQ(0u, atoms[0].ul);
+    EXPECT_EQ(1u, atoms[1].ul);
+    EXPECT_EQ(255u, atoms[2].ul);
+
+    const float floats[] = { 1.5f, -2.5f };
+    pcp::atoms(PM_TYPE_DOUBLE, floats, 2, atoms);
+    EXPECT_EQ(1.5, atoms[0].d);
+    EXPECT_EQ(-2.5, atoms[1].d);
+
+    // Only count atoms are written.
+    const uint64_t ticks[] = { 10, 20, 30, 40 };
+    pcp::atoms(PM_TYPE_U64, ticks, 2, atoms);
+    EXPECT_EQ(10u, atoms[0].ull);
+    EXPECT_EQ(20u, atoms[1].ull);
+    EXPECT_EQ(255u, atoms[2].ul);
+
+    // Selected elements only.
+    const pcp::instance_id_type indexes[] = { 3, 0 };
+    pcp::atoms(PM_TYPE_64, ticks, indexes, 2, atoms);
+    EXPECT_EQ(40, atoms[0].ll);
+    EXPECT_EQ(10, atoms[1].ll);
+
+    EXPECT_THROW(pcp::atoms(PM_TYPE_STRING, ticks, 1, atoms), pcp::exception);
+    EXPECT_THROW(pcp::atoms(PM_TYPE_STRING, ticks, indexes, 1, atoms), pcp::exception);
+}
@@ -5,8 +5,15 @@
 
 #include "pcp-cpp/cache.hpp"
 
+#include "fake_libpcp-pmda.h"
+
 #include "gtest/gtest.h"
 
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
 // PM_ERR_FAULT ("QA fault injected") was not added until PCP 3.6.0.
 #ifndef PM_ERR_FAULT
 #define PM_ERR_FAULT PM_ERR_GENERIC
@@ -82,6 +89,48 @@ TEST(cache, lookup_by_name_and_key) {
     );
 }
 
+TEST(cache, try_lookup) {
+    // Errors (such as PM_ERR_FAULT in this case) are returned, not thrown.
+    pcp::cache::lookup_result_type<void *> result;
+    EXPECT_NO_THROW(result = pcp::cache::try_lookup<void *>(PM_ERR_FAULT, 123));
+    EXPECT_EQ(PM_ERR_FAULT, result.status);
+    EXPECT_NO_THROW(result = pcp::cache::try_lookup<void *>(PM_ERR_FAULT, "foo"));
+    EXPECT_EQ(PM_ERR_FAULT, result.status);
+    EXPECT_NO_THROW(result = pcp::cache::try_lookup<void *>(PM_ERR_FAULT, "foo", "bar"));
+    EXPECT_EQ(PM_ERR_FAULT, result.status);
+
+    // As are inactive entries.
+    result = pcp::cache::try_lookup<void *>(PMDA_CACHE_INACTIVE, 123);
+    EXPECT_EQ(PMDA_CACHE_INACTIVE, result.status);
+    EXPECT_EQ(pcp::instance_id_type(123), result.instance_id);
+    result = pcp::cache::try_lookup<void *>(PMDA_CACHE_ACTIVE, "foo");
+    EXPECT_EQ(PMDA_CACHE_ACTIVE, result.status);
+    result = pcp::cache::try_lookup<void *>(PMDA_CACHE_INACTIVE, "foo", "bar");
+    EXPECT_EQ(PMDA_CACHE_INACTIVE, result.status);
+}
+
+TEST(cache, lookup_by_string_ref) {
+    // Slices of a larger buffer, that are not null-terminated.
+    const char buffer[] = "foo bah";
+    const pcp::cache::string_ref name(buffer, 3), key(buffer + 4, 3);
+
+    // Errors (such as PM_ERR_FAULT in this case) result in exceptions, or not.
+    EXPECT_THROW(pcp::cache::lookup<void *>(PM_ERR_FAULT, name), pcp::exception);
+    EXPECT_THROW(pcp::cache::lookup<void *>(PM_ERR_FAULT, name, key), pcp::exception);
+    EXPECT_EQ(PM_ERR_FAULT, pcp::cache::try_lookup<void *>(PM_ERR_FAULT, name).status);
+    EXPECT_EQ(PM_ERR_FAULT, pcp::cache::try_lookup<void *>(PM_ERR_FAULT, name, key).status);
+
+    // Inactive cache results may or may not throw, depending on the require_active flag.
+    EXPECT_NO_THROW(
+        pcp::cache::lookup<void *>(PMDA_CACHE_INACTIVE, name, pcp::cache::lookup_flags(0))
+    );
+    EXPECT_THROW(
+        pcp::cache::lookup<void *>(PMDA_CACHE_INACTIVE, name, key, pcp::cache::require_active),
+        pcp::exception
+    );
+    EXPECT_NO_THROW(pcp::cache::lookup<void *>(PMDA_CACHE_ACTIVE, name, key));
+}
+
 TEST(cache, perform) {
     // Errors (such as PM_ERR_FAULT in this case) result in exceptions.
     EXPECT_THROW(pcp::cache::perform(PM_ERR_FAULT, PMDA_CACHE_CHECK), pcp::exception);
@@ -134,3 +183,106 @@ TEST(cache, store_by_name_and_key) {
     EXPECT_NO_THROW(pcp::cache::store(123, "foo", "bah", (void *)NULL));
     EXPECT_NO_THROW(pcp::cache::store(123, "foo", "bah", PMDA_CACHE_ADD));
 }
+
+TEST(cache, store_by_string_ref) {
+    const char buffer[] = "foo bah";
+    const pcp::cache::string_ref name(buffer, 3), key(buffer + 4, 3);
+
+    // Errors (such as PM_ERR_FAULT in this case) result in exceptions.
+    EXPECT_THROW(pcp::cache::store(PM_ERR_FAULT, name, (void *)NULL), pcp::exception);
+    EXPECT_THROW(pcp::cache::store(PM_ERR_FAULT, name, key, PMDA_CACHE_ADD), pcp::exception);
+
+    // All non-errors should return without exceptions.
+    EXPECT_EQ(pcp::instance_id_type(123), pcp::cache::store(123, name, PMDA_CACHE_ADD));
+    EXPECT_EQ(pcp::instance_id_type(123), pcp::cache::store(123, name, key, (void *)NULL));
+}
+
+TEST(cache, terminated_string) {
+    const char buffer[] = "foo bah";
+    const pcp::cache::detail::terminated_string name(pcp::cache::string_ref(buffer, 3));
+    EXPECT_STREQ("foo", name.c_str());
+
+    // Longer names are copied to the heap instead.
+    const std::string long_name(1000, 'x');
+    const pcp::cache::detail::terminated_string copy(
+        pcp::cache::string_ref(long_name.data(), long_name.size()));
+    EXPECT_EQ(long_name, copy.c_str());
+}
+
+TEST(cache, sync) {
+    // Note, our fake pmdaCacheLookupName returns the indom as the entry's status.
+    std::vector<std::pair<std::string, void *> > instances;
+    int opaque = 0;
+    instances.push_back(std::make_pair(std::string("a"), static_cast<void *>(NULL)));
+
+    // Errors result in exceptions.
+    EXPECT_THROW(pcp::cache::sync(PM_ERR_FAULT, instances.begin(), instances.end()),
+                 pcp::exception);
+
+    // Active entries, with unchanged opaque pointers, are left untouched.
+    pcp::cache::sync_result_type result =
+        pcp::cache::sync(PMDA_CACHE_ACTIVE, instances.begin(), instances.end());
+    EXPECT_EQ(size_t(0), result.added + result.reactivated + result.updated + result.removed);
+
+    // Others are stored.
+    instances.push_back(std::make_pair(std::string("b"), static_cast<void *>(&opaque)));
+    result = pcp::cache::sync(PMDA_CACHE_ACTIVE, instances.begin(), instances.end());
+    EXPECT_EQ(size_t(1), result.updated);
+    result = pcp::cache::sync(PMDA_CACHE_INACTIVE, instances.begin(), instances.end());
+    EXPECT_EQ(size_t(2), result.reactivated);
+    result = pcp::cache::sync(123, instances.begin(), instances.end());
+    EXPECT_EQ(size_t(2), result.added);
+    EXPECT_EQ(size_t(0), result.removed);
+
+    // C string names work too.
+    std::map<const char *, int *> names;
+    names["c"] = &opaque;
+    result = pcp::cache::sync(123, names.begin(), names.end());
+    EXPECT_EQ(size_t(1), result.added);
+}
+
+TEST(cache, sync_removed) {
+    const fake_pmda_cache cache(300);
+    int opaque = 0;
+    std::vector<std::pair<std::string, void *> > instances;
+    instances.push_back(std::make_pair(std::string("a"), static_cast<void *>(NULL)));
+    instances.push_back(std::make_pair(std::string("b"), static_cast<void *>(NULL)));
+    instances.push_back(std::make_pair(std::string("c"), static_cast<void *>(NULL)));
+    EXPECT_EQ(size_t(3), pcp::cache::sync(300, instances.begin(), instances.end()).added);
+
+    // Active entries missing from the current instances are hidden.
+    instances.erase(instances.begin() + 1);
+    instances.back().second = &opaque;
+    pcp::cache::sync_result_type result = pcp::cache::sync(300, instances.begin(), instances.end());
+    EXPECT_EQ(size_t(0), result.added);
+    EXPECT_EQ(size_t(0), result.reactivated);
+    EXPECT_EQ(size_t(1), result.updated);
+    EXPECT_EQ(size_t(1), result.removed);
+    EXPECT_EQ(PMDA_CACHE_ACTIVE, pmdaCacheLookup(300, 0, NULL, NULL));
+    EXPECT_EQ(PMDA_CACHE_INACTIVE, pmdaCacheLookup(300, 1, NULL, NULL));
+    EXPECT_EQ(PMDA_CACHE_ACTIVE, pmdaCacheLookup(300, 2, NULL, NULL));
+    EXPECT_EQ(2, pmdaCacheOp(300, PMDA_CACHE_SIZE_ACTIVE));
+
+    // Then reactivated, if they come back.
+    instances.push_back(std::make_pair(std::string("b"), static_cast<void *>(NULL)));
+    result = pcp::cache::sync(300, instances.begin(), instances.end());
+    EXPECT_EQ(size_t(1), result.reactivated);
+    EXPECT_EQ(size_t(0), result.removed);
+    EXPECT_EQ(PMDA_CACHE_ACTIVE, pmdaCacheLookup(300, 1, NULL, NULL));
+
+    // Names may be string_refs too, such as slices of a larger buffer.
+    const char buffer[] = "a b c";
+    std::vector<std::pair<pcp::cache::string_ref, void *> > refs;
+    refs.push_back(std::make_pair(pcp::cache::string_ref(buffer, 1), static_cast<void *>(NULL)));
+    refs.push_back(std::make_pair(pcp::cache::string_ref(buffer + 4, 1), static_cast<void *>(&opaque)));
+    result = pcp::cache::sync(300, refs.begin(), refs.end());
+    EXPECT_EQ(size_t(0), result.added + result.reactivated + result.updated);
+    EXPECT_EQ(size_t(1), result.removed);
+    EXPECT_EQ(PMDA_CACHE_INACTIVE, pmdaCacheLookup(300, 1, NULL, NULL));
+
+    // And an empty set of instances hides everything.
+    instances.clear();
+    result = pcp::cache::sync(300, instances.begin(), instances.end());
+    EXPECT_EQ(size_t(2), result.removed);
+    EXPECT_EQ(0, pmdaCacheOp(300, PMDA_CACHE_SIZE_ACTIVE));
+}
@@ -0,0 +1,209 @@
+//               Copyright Paul Colby 2018.
+// Distributed under the Boost Software License, Version 1.0.
+//       (See accompanying file LICENSE.md or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include "pcp-cpp/cached_instance_domain.hpp"
+
+#include "fake_libpcp-pmda.h"
+
+#include "gtest/gtest.h"
+
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#if __cplusplus >= 201103L
+// Detect accessible instance_domain members that would bypass the cache.
+template <typename Domain>
+static auto has_begin(int) -> decltype(std::declval<Domain &>().begin(), true) { return true; }
+template <typename Domain> static bool has_begin(...) { return false; }
+
+template <typename Domain>
+static auto has_find(int) -> decltype(std::declval<Domain &>().find(1), true) { return true; }
+template <typename Domain> static bool has_find(...) { return false; }
+
+template <typename Domain>
+static auto has_size(int) -> decltype(std::declval<Domain &>().size(), true) { return true; }
+template <typename Domain> static bool has_size(...) { return false; }
+
+template <typename Domain>
+static auto has_insert(int) -> decltype(std::declval<Domain &>().insert(
+    pcp::instance_domain::value_type(1, pcp::instance_info())), true) { return true; }
+template <typename Domain> static bool has_insert(...) { return false; }
+
+template <typename Domain>
+static auto has_erase(int) -> decltype(std::declval<Domain &>().erase(1), true) { return true; }
+template <typename Domain> static bool has_erase(...) { return false; }
+
+template <typename Domain>
+static auto has_clear(int) -> decltype(std::declval<Domain &>().clear(), true) { return true; }
+template <typename Domain> static bool has_clear(...) { return false; }
+
+template <typename Domain>
+static auto has_swap(int) -> decltype(std::declval<Domain &>().swap(
+    std::declval<pcp::instance_domain &>()), true) { return true; }
+template <typename Domain> static bool has_swap(...) { return false; }
+#endif
+
+// Note, unless backed by a fake_pmda_cache, our fake pmdaCacheStore returns
+// the instance domain as the instance ID, and our fake pmdaCacheLookupName
+// returns it as the entry's status.
+
+TEST(cached_instance_domain, constructor) {
+    const pcp::cached_instance_domain indom(12);
+    EXPECT_EQ(pcp::domain_id_type(12), indom.get_domain_id());
+    EXPECT_TRUE(indom.uses_pmda_cache());
+    EXPECT_EQ(pcp::instance_domain::size_type(0), indom.get_instance_count());
+    // The std::map interface is not used.
+    EXPECT_TRUE(static_cast<const pcp::instance_domain &>(indom).empty());
+}
+
+TEST(cached_instance_domain, hidden_map_members) {
+#if __cplusplus >= 201103L
+    EXPECT_FALSE(has_begin<pcp::cached_instance_domain>(0));
+    EXPECT_FALSE(has_find<pcp::cached_instance_domain>(0));
+    EXPECT_FALSE(has_size<pcp::cached_instance_domain>(0));
+    EXPECT_FALSE(has_insert<pcp::cached_instance_domain>(0));
+    EXPECT_FALSE(has_erase<pcp::cached_instance_domain>(0));
+    EXPECT_FALSE(has_clear<pcp::cached_instance_domain>(0));
+    EXPECT_FALSE(has_swap<pcp::cached_instance_domain>(0));
+    EXPECT_TRUE(has_begin<pcp::instance_domain>(0)); // Sanity check the checks.
+    EXPECT_TRUE(has_find<pcp::instance_domain>(0));
+    EXPECT_TRUE(has_size<pcp::instance_domain>(0));
+    EXPECT_TRUE(has_insert<pcp::instance_domain>(0));
+    EXPECT_TRUE(has_erase<pcp::instance_domain>(0));
+    EXPECT_TRUE(has_clear<pcp::instance_domain>(0));
+    EXPECT_TRUE(has_swap<pcp::instance_domain>(0));
+#endif
+}
+
+TEST(cached_instance_domain, store) {
+    pcp::cached_instance_domain indom(1);
+    indom.set_pm_instance_domain(5);
+    EXPECT_FALSE(indom.contains(5));
+
+    const unsigned long generation = indom.get_generation();
+    EXPECT_EQ(pcp::instance_id_type(5), indom.store("five"));
+    EXPECT_TRUE(indom.contains(5));
+    EXPECT_NE(generation, indom.get_generation());
+    EXPECT_TRUE(static_cast<const pcp::instance_domain &>(indom).empty());
+
+    indom.inactivate_all();
+    EXPECT_FALSE(indom.contains(5));
+
+    // Errors are thrown.
+    indom.set_pm_instance_domain(PM_ERR_GENERIC);
+    EXPECT_THROW(indom.store("error"), pcp::exception);
+    EXPECT_THROW(indom.inactivate_all(), pcp::exception);
+}
+
+TEST(cached_instance_domain, hide) {
+    pcp::cached_instance_domain indom(1);
+    indom.set_pm_instance_domain(PMDA_CACHE_ACTIVE);
+
+    // Storing an instance already in this domain changes nothing.
+    EXPECT_EQ(pcp::instance_id_type(PMDA_CACHE_ACTIVE), indom.store("eight"));
+    const unsigned long generation = indom.get_generation();
+    EXPECT_EQ(pcp::instance_id_type(PMDA_CACHE_ACTIVE), indom.store("eight"));
+    EXPECT_EQ(generation, indom.get_generation());
+
+    EXPECT_EQ(pcp::instance_id_type(PMDA_CACHE_ACTIVE), indom.hide("eight"));
+    EXPECT_NE(generation, indom.get_generation());
+    EXPECT_FALSE(indom.contains(PMDA_CACHE_ACTIVE));
+
+    // As does hiding an instance not in this domain.
+    const unsigned long hidden = indom.get_generation();
+    EXPECT_EQ(pcp::instance_id_type(PMDA_CACHE_ACTIVE), indom.hide("eight"));
+    EXPECT_EQ(hidden, indom.get_generation());
+}
+
+TEST(cached_instance_domain, sync) {
+    pcp::cached_instance_domain indom(1);
+    indom.set_pm_instance_domain(PMDA_CACHE_ACTIVE);
+    std::map<std::string, void *> instances;
+    instances["eight"] = NULL;
+
+    // Unchanged, so this domain is unchanged too.
+    const unsigned long generation = indom.get_generation();
+    const pcp::cache::sync_result_type result = indom.sync(instances.begin(), instances.end());
+    EXPECT_EQ(size_t(0), result.added + result.reactivated + result.updated + result.removed);
+    EXPECT_EQ(generation, indom.get_generation());
+
+    // Added, so this domain is re-indexed (from our fake, empty, cache).
+    indom.set_pm_instance_domain(123);
+    EXPECT_EQ(size_t(1), indom.sync(instances.begin(), instances.end()).added);
+    EXPECT_NE(generation, indom.get_generation());
+}
+
+TEST(cached_instance_domain, pmda_instances) {
+    const fake_pmda_cache cache(200);
+    pcp::cached_instance_domain indom(1);
+    indom.set_pm_instance_domain(200);
+    EXPECT_EQ(pcp::instance_id_type(0), indom.store("zero"));
+    EXPECT_EQ(pcp::instance_id_type(1), indom.store("one"));
+    EXPECT_EQ(pcp::instance_id_type(2), indom.store("two"));
+    indom.hide("one");
+
+    // Only active instances are enumerated, with their cached names.
+    ASSERT_EQ(pcp::instance_domain::size_type(2), indom.get_instance_count());
+    pmdaInstid instances[2];
+    indom.get_pmda_instances(instances);
+    EXPECT_EQ(0, instances[0].i_inst);
+    EXPECT_STREQ("zero", instances[0].i_name);
+    EXPECT_EQ(2, instances[1].i_inst);
+    EXPECT_STREQ("two", instances[1].i_name);
+    EXPECT_EQ("two", indom.get_instance_info(2).instance_name);
+    EXPECT_THROW(indom.get_instance_info(1), std::out_of_range);
+}
+
+TEST(cached_instance_domain, reindex) {
+    const fake_pmda_cache cache(201);
+    pcp::cached_instance_domain indom(1);
+    indom.set_pm_instance_domain(201);
+    indom.store("zero");
+    indom.store("one");
+
+    // Purging re-indexes from the cache's remaining active instances.
+    fake_pmda_cache::advance_clock(10);
+    indom.store("one");
+    EXPECT_EQ(size_t(1), indom.purge(5));
+    EXPECT_FALSE(indom.contains(0));
+    EXPECT_TRUE(indom.contains(1));
+    EXPECT_EQ(size_t(0), indom.purge(5));
+
+    // As does syncing, for both additions and removals.
+    std::map<std::string, void *> instances;
+    instances["two"] = NULL;
+    const pcp::cache::sync_result_type result = indom.sync(instances.begin(), instances.end());
+    EXPECT_EQ(size_t(1), result.added);
+    EXPECT_EQ(size_t(1), result.removed);
+    EXPECT_FALSE(indom.contains(1));
+    EXPECT_TRUE(indom.contains(2));
+    EXPECT_EQ(pcp::instance_domain::size_type(1), indom.get_instance_count());
+}
+
+TEST(cached_instance_domain, string_ref) {
+    const fake_pmda_cache cache(202);
+    pcp::cached_instance_domain indom(1);
+    indom.set_pm_instance_domain(202);
+    const char buffer[] = "zero one two";
+
+    EXPECT_EQ(pcp::instance_id_type(0), indom.store(pcp::cache::string_ref(buffer, 4)));
+    EXPECT_EQ(pcp::instance_id_type(1), indom.store(pcp::cache::string_ref(buffer + 5, 3)));
+    EXPECT_TRUE(indom.contains(1));
+    EXPECT_EQ(pcp::instance_id_type(1), indom.hide(pcp::cache::string_ref(buffer + 5, 3)));
+    EXPECT_FALSE(indom.contains(1));
+    EXPECT_EQ("zero", indom.get_instance_info(0).instance_name);
+
+    std::vector<std::pair<pcp::cache::string_ref, void *> > instances;
+    instances.push_back(std::make_pair(pcp::cache::string_ref(buffer + 9, 3),
+                                       static_cast<void *>(NULL)));
+    const pcp::cache::sync_result_type result = indom.sync(instances.begin(), instances.end());
+    EXPECT_EQ(size_t(1), result.added);
+    EXPECT_EQ(size_t(1), result.removed);
+    EXPECT_FALSE(indom.contains(0));
+    EXPECT_TRUE(indom.contains(2));
+    EXPECT_EQ("two", indom.get_instance_info(2).instance_name);
+}
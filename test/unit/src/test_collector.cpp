@@ -0,0 +1,117 @@
+//               Copyright Paul Colby 2018.
+// Distributed under the Boost Software License, Version 1.0.
+//       (See accompanying file LICENSE.md or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include "pcp-cpp/collector.hpp"
+
+#include "gtest/gtest.h"
+
+#include <unistd.h>
+
+class counting_collector : public pcp::collector<unsigned long> {
+public:
+    bool fail;
+
+    counting_collector() : fail(false), count(0) { }
+
+    virtual ~counting_collector() {
+        stop();
+    }
+
+protected:
+    virtual void collect(unsigned long &snapshot) {
+        if (fail) {
+            throw pcp::exception(PM_ERR_GENERIC, "collection failed");
+        }
+        snapshot = ++count;
+    }
+
+private:
+    unsigned long count;
+};
+
+// Wait up to 10 seconds for a collector to publish at least count snapshots.
+static bool wait_for_published(const counting_collector &collector,
+                               const unsigned long count)
+{
+    for (int attempt = 0; attempt < 10000; ++attempt) {
+        if (collector.get_published_count() >= count) {
+            return true;
+        }
+        usleep(1000);
+    }
+    return false;
+}
+
+TEST(collector, start_stop) {
+    counting_collector collector;
+    EXPECT_FALSE(collector.is_running());
+    EXPECT_EQ(0u, collector.latest());
+
+    collector.start(0);
+    EXPECT_TRUE(collector.is_running());
+    EXPECT_THROW(collector.start(0), pcp::exception);
+
+    collector.stop();
+    EXPECT_FALSE(collector.is_running());
+    EXPECT_NO_THROW(collector.stop());
+}
+
+TEST(collector, latest) {
+    counting_collector collector;
+    collector.start(0);
+    ASSERT_TRUE(wait_for_published(collector, 3));
+
+    // Snapshots only ever move forward, and remain stable between calls.
+    const unsigned long &first = collector.latest();
+    const unsigned long value = first;
+    EXPECT_LE(1u, value);
+    ASSERT_TRUE(wait_for_published(collector, collector.get_published_count() + 3));
+    EXPECT_EQ(value, first);
+    EXPECT_LT(value, collector.latest());
+
+    // Once stopped, the final snapshot is returned.
+    collector.stop();
+    EXPECT_EQ(collector.get_published_count(), collector.latest());
+    EXPECT_EQ(collector.get_published_count(), collector.latest());
+}
+
+TEST(collector, interval) {
+    counting_collector collector;
+    collector.start(boost::posix_time::hours(1));
+    ASSERT_TRUE(wait_for_published(collector, 1));
+    usleep(10000);
+    EXPECT_EQ(1u, collector.get_published_count());
+    EXPECT_EQ(1u, collector.latest());
+
+    // Stopping should not wait for the interval to elapse.
+    collector.stop();
+    EXPECT_EQ(1u, collector.get_published_count());
+}
+
+TEST(collector, exceptions) {
+    counting_collector collector;
+    collector.fail = true;
+    collector.start(1);
+    usleep(10000);
+    collector.stop();
+    EXPECT_EQ(0u, collector.get_published_count());
+    EXPECT_EQ(0u, collector.latest());
+}
+
+#ifndef NDEBUG
+class unstopped_collector : public pcp::collector<int> {
+protected:
+    virtual void collect(int &snapshot) {
+        snapshot = 1;
+    }
+};
+
+TEST(collector, unstopped_destruction) {
+    EXPECT_DEATH({
+        unstopped_collector collector;
+        collector.start(1);
+    }, "stop");
+}
+#endif
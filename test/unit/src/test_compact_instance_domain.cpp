@@ -0,0 +1,188 @@
+//               Copyright Paul Colby 2018.
+// Distributed under the Boost Software License, Version 1.0.
+//       (See accompanying file LICENSE.md or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include "pcp-cpp/compact_instance_domain.hpp"
+
+#include "gtest/gtest.h"
+
+#if __cplusplus >= 201103L
+#include <utility>
+
+// Detect accessible std::map members, which would read the unused std::map.
+template <typename Domain>
+static auto has_begin(int) -> decltype(std::declval<Domain &>().begin(), true) { return true; }
+template <typename Domain> static bool has_begin(...) { return false; }
+
+template <typename Domain>
+static auto has_find(int) -> decltype(std::declval<Domain &>().find(1), true) { return true; }
+template <typename Domain> static bool has_find(...) { return false; }
+
+template <typename Domain>
+static auto has_count(int) -> decltype(std::declval<Domain &>().count(1), true) { return true; }
+template <typename Domain> static bool has_count(...) { return false; }
+
+template <typename Domain>
+static auto has_swap(int) -> decltype(std::declval<Domain &>().swap(
+    std::declval<pcp::instance_domain &>()), true) { return true; }
+template <typename Domain> static bool has_swap(...) { return false; }
+#endif
+
+/// @brief Loads descriptions lazily, for odd instance IDs only.
+class lazy_instance_domain : public pcp::compact_instance_domain {
+protected:
+    virtual bool load_descriptions(const pcp::instance_id_type instance_id,
+                                   std::string &short_description,
+                                   std::string &verbose_description) const
+    {
+        if ((instance_id % 2) == 0) {
+            return false;
+        }
+        short_description = "odd";
+        verbose_description = "an odd instance";
+        return true;
+    }
+};
+
+TEST(compact_instance_domain, builder) {
+    pcp::compact_instance_domain indom;
+    EXPECT_EQ(PM_INDOM_NULL, indom.get_domain_id());
+    EXPECT_TRUE(indom.empty());
+
+    pcp::instance_info info;
+    info.instance_name = "two";
+    indom(5)(3, "three")(1, "one", "short one", "verbose one")(2, info);
+    EXPECT_EQ(5u, indom.get_domain_id());
+    EXPECT_EQ(pcp::compact_instance_domain::size_type(3), indom.size());
+    EXPECT_EQ(pcp::compact_instance_domain::size_type(3), indom.get_instance_count());
+    EXPECT_FALSE(indom.empty());
+
+    // Instances are held in ID order, regardless of insertion order.
+    EXPECT_EQ(1u, indom.instance_id_at(0));
+    EXPECT_STREQ("one", indom.instance_name_at(0));
+    EXPECT_EQ(2u, indom.instance_id_at(1));
+    EXPECT_STREQ("two", indom.instance_name_at(1));
+    EXPECT_EQ(3u, indom.instance_id_at(2));
+    EXPECT_STREQ("three", indom.instance_name_at(2));
+
+    // Inserting an existing ID has no effect (std::map behaviour).
+    EXPECT_FALSE(indom.insert(2, "new two"));
+    indom(3, "new three");
+    EXPECT_EQ(pcp::compact_instance_domain::size_type(3), indom.size());
+    EXPECT_STREQ("two", indom.get_instance_name(2));
+    EXPECT_STREQ("three", indom.get_instance_name(3));
+    EXPECT_EQ(NULL, indom.get_instance_name(4));
+
+    EXPECT_TRUE(indom.contains(1));
+    EXPECT_FALSE(indom.contains(4));
+
+    // The inherited std::map is not used, so is hidden.
+    EXPECT_TRUE(static_cast<const pcp::instance_domain &>(indom).begin() ==
+                static_cast<const pcp::instance_domain &>(indom).end());
+#if __cplusplus >= 201103L
+    EXPECT_FALSE(has_begin<pcp::compact_instance_domain>(0));
+    EXPECT_FALSE(has_find<pcp::compact_instance_domain>(0));
+    EXPECT_FALSE(has_count<pcp::compact_instance_domain>(0));
+    EXPECT_FALSE(has_swap<pcp::compact_instance_domain>(0));
+    EXPECT_TRUE(has_begin<pcp::instance_domain>(0)); // Sanity check the checks.
+    EXPECT_TRUE(has_find<pcp::instance_domain>(0));
+    EXPECT_TRUE(has_count<pcp::instance_domain>(0));
+    EXPECT_TRUE(has_swap<pcp::instance_domain>(0));
+#endif
+}
+
+TEST(compact_instance_domain, descriptions) {
+    lazy_instance_domain indom;
+    indom(1, "one", "short one", "verbose one")(2, "two")(3, "three");
+
+    const pcp::instance_info one = indom.get_instance_info(1);
+    EXPECT_EQ("one", one.instance_name);
+    EXPECT_EQ("short one", one.short_description);
+    EXPECT_EQ("verbose one", one.verbose_description);
+
+    const pcp::instance_info two = indom.get_instance_info(2);
+    EXPECT_EQ("two", two.instance_name);
+    EXPECT_TRUE(two.short_description.empty());
+    EXPECT_TRUE(two.verbose_description.empty());
+
+    const pcp::instance_info three = indom.get_instance_info(3);
+    EXPECT_EQ("three", three.instance_name);
+    EXPECT_EQ("odd", three.short_description);
+    EXPECT_EQ("an odd instance", three.verbose_description);
+
+    EXPECT_THROW(indom.get_instance_info(4), std::out_of_range);
+}
+
+TEST(compact_instance_domain, erase) {
+    pcp::compact_instance_domain indom;
+    for (pcp::instance_id_type id = 0; id < 100; ++id) {
+        indom(id, std::string(10, static_cast<char>('a' + (id % 26))));
+    }
+    indom(std::numeric_limits<pcp::instance_id_type>::max(), "max");
+    unsigned long generation = indom.get_generation();
+
+    EXPECT_EQ(pcp::compact_instance_domain::size_type(0), indom.erase(100));
+    EXPECT_EQ(generation, indom.get_generation());
+
+    // Erasing most instances reclaims their names along the way.
+    for (pcp::instance_id_type id = 0; id < 90; ++id) {
+        EXPECT_EQ(pcp::compact_instance_domain::size_type(1), indom.erase(id));
+    }
+    EXPECT_NE(generation, indom.get_generation());
+    EXPECT_EQ(pcp::compact_instance_domain::size_type(11), indom.size());
+    for (pcp::instance_id_type id = 90; id < 100; ++id) {
+        EXPECT_TRUE(indom.contains(id));
+        EXPECT_EQ(std::string(10, static_cast<char>('a' + (id % 26))),
+                  indom.get_instance_name(id));
+    }
+    EXPECT_FALSE(indom.contains(89));
+    EXPECT_TRUE(indom.contains(std::numeric_limits<pcp::instance_id_type>::max()));
+    EXPECT_EQ(pcp::compact_instance_domain::size_type(1),
+              indom.erase(std::numeric_limits<pcp::instance_id_type>::max()));
+    EXPECT_FALSE(indom.contains(std::numeric_limits<pcp::instance_id_type>::max()));
+
+    generation = indom.get_generation();
+    indom.shrink_to_fit();
+    EXPECT_NE(generation, indom.get_generation());
+    EXPECT_STREQ("mmmmmmmmmm", indom.get_instance_name(90));
+
+    indom.clear();
+    EXPECT_TRUE(indom.empty());
+    EXPECT_FALSE(indom.contains(90));
+}
+
+TEST(compact_instance_domain, get_pmda_instances) {
+    pcp::compact_instance_domain indom;
+    indom(20, "twenty")(10, "ten");
+    pmdaInstid instances[2];
+    indom.get_pmda_instances(instances);
+    EXPECT_EQ(10, instances[0].i_inst);
+    EXPECT_STREQ("ten", instances[0].i_name);
+    EXPECT_EQ(20, instances[1].i_inst);
+    EXPECT_STREQ("twenty", instances[1].i_name);
+
+    // Via the base class too.
+    const pcp::instance_domain &base = indom;
+    EXPECT_EQ(pcp::instance_domain::size_type(2), base.get_instance_count());
+    instances[0].i_inst = instances[1].i_inst = 0;
+    base.get_pmda_instances(instances);
+    EXPECT_EQ(10, instances[0].i_inst);
+    EXPECT_EQ(20, instances[1].i_inst);
+}
+
+TEST(compact_instance_domain, lookup) {
+    pcp::compact_instance_domain indom;
+    indom(20, "twenty")(10, "ten")(30, "ten"); // Duplicate names resolve to the lowest ID.
+    pcp::instance_id_type id = 0;
+    EXPECT_TRUE(indom.lookup_instance_id("ten", id));
+    EXPECT_EQ(pcp::instance_id_type(10), id);
+    EXPECT_STREQ("twenty", indom.lookup_instance_name(20));
+
+    indom.erase(10);
+    indom.shrink_to_fit();
+    EXPECT_TRUE(indom.lookup_instance_id("ten", id));
+    EXPECT_EQ(pcp::instance_id_type(30), id);
+    EXPECT_STREQ("twenty", indom.lookup_instance_name(20));
+    EXPECT_EQ(static_cast<const char *>(NULL), indom.lookup_instance_name(10));
+}
@@ -7,6 +7,34 @@
 
 #include "gtest/gtest.h"
 
+#include <sstream>
+#if __cplusplus >= 201103L
+#include <type_traits>
+#include <utility>
+#endif
+
+#if __cplusplus >= 201103L
+// Detect accessible std::map members that could bypass the instance index.
+template <typename Map>
+static auto has_emplace(int) -> decltype(std::declval<Map &>().emplace(
+    1, pcp::instance_info()), true) { return true; }
+template <typename Map> static bool has_emplace(...) { return false; }
+
+template <typename Map>
+static auto has_emplace_hint(int) -> decltype(std::declval<Map &>().emplace_hint(
+    std::declval<Map &>().end(), 1, pcp::instance_info()), true) { return true; }
+template <typename Map> static bool has_emplace_hint(...) { return false; }
+
+template <typename Map>
+static auto has_subscript(int) -> decltype(std::declval<Map &>()[1], true) { return true; }
+template <typename Map> static bool has_subscript(...) { return false; }
+
+template <typename Map>
+static auto has_const_iterator_erase(int) -> decltype(std::declval<Map &>().erase(
+    std::declval<typename Map::const_iterator>()), true) { return true; }
+template <typename Map> static bool has_const_iterator_erase(...) { return false; }
+#endif
+
 TEST(instance_domain, constructor) {
     {
         pcp::instance_domain indom;
@@ -156,3 +184,192 @@ TEST(instance_domain, functor_3) {
     EXPECT_EQ("max-short", indom.at(std::numeric_limits<pcp::instance_id_type>::max()).short_description);
     EXPECT_EQ("max-verbose", indom.at(std::numeric_limits<pcp::instance_id_type>::max()).verbose_description);
 }
+
+TEST(instance_domain, contains) {
+    pcp::instance_domain indom;
+    EXPECT_FALSE(indom.contains(0));
+    EXPECT_FALSE(indom.contains(std::numeric_limits<pcp::instance_id_type>::min()));
+    EXPECT_FALSE(indom.contains(std::numeric_limits<pcp::instance_id_type>::max()));
+
+    indom(0, "zero")(63, "63")(64, "64")
+         (std::numeric_limits<pcp::instance_id_type>::min(), "min")
+         (std::numeric_limits<pcp::instance_id_type>::max(), "max");
+    EXPECT_TRUE(indom.contains(0));
+    EXPECT_FALSE(indom.contains(1));
+    EXPECT_FALSE(indom.contains(62));
+    EXPECT_TRUE(indom.contains(63));
+    EXPECT_TRUE(indom.contains(64));
+    EXPECT_FALSE(indom.contains(65));
+    EXPECT_TRUE(indom.contains(std::numeric_limits<pcp::instance_id_type>::min()));
+    EXPECT_TRUE(indom.contains(std::numeric_limits<pcp::instance_id_type>::max()));
+    EXPECT_FALSE(indom.contains(std::numeric_limits<pcp::instance_id_type>::max() - 1));
+
+    // The index must match std::map's own lookups throughout.
+    for (pcp::instance_id_type id = 0; id < 200; ++id) {
+        EXPECT_EQ(indom.count(id) > 0, indom.contains(id)) << id;
+    }
+}
+
+TEST(instance_domain, contains_after_erase) {
+    pcp::instance_domain indom;
+    indom(1, "one")(2, "two")(3, "three")(std::numeric_limits<pcp::instance_id_type>::max(), "max")(1 << 24, "large");
+    EXPECT_EQ(pcp::instance_domain::size_type(5), indom.size());
+
+    EXPECT_EQ(pcp::instance_domain::size_type(1), indom.erase(2));
+    EXPECT_EQ(pcp::instance_domain::size_type(0), indom.erase(2));
+    EXPECT_TRUE(indom.contains(1));
+    EXPECT_FALSE(indom.contains(2));
+    EXPECT_TRUE(indom.contains(3));
+
+    indom.erase(indom.find(std::numeric_limits<pcp::instance_id_type>::max()));
+    EXPECT_FALSE(indom.contains(std::numeric_limits<pcp::instance_id_type>::max()));
+    EXPECT_TRUE(indom.contains(1 << 24));
+
+    indom.erase(indom.begin(), indom.find(3));
+    EXPECT_FALSE(indom.contains(1));
+    EXPECT_TRUE(indom.contains(3));
+
+    // Re-inserting an erased instance restores it.
+    indom.insert(pcp::instance_domain::value_type(2, pcp::instance_info()));
+    EXPECT_TRUE(indom.contains(2));
+
+    pcp::instance_domain other;
+    other(5, "five");
+    indom.swap(other);
+    EXPECT_TRUE(indom.contains(5));
+    EXPECT_FALSE(indom.contains(2));
+    EXPECT_TRUE(other.contains(2));
+    EXPECT_TRUE(other.contains(1 << 24));
+
+    other.clear();
+    EXPECT_TRUE(other.empty());
+    EXPECT_FALSE(other.contains(2));
+    EXPECT_FALSE(other.contains(3));
+    EXPECT_FALSE(other.contains(1 << 24));
+
+    // Copies carry their index with them.
+    const pcp::instance_domain copy(indom);
+    EXPECT_TRUE(copy.contains(5));
+    EXPECT_FALSE(copy.contains(2));
+}
+
+TEST(instance_domain, mutating_routes) {
+    pcp::instance_domain indom;
+    const pcp::instance_domain::value_type values[] = {
+        pcp::instance_domain::value_type(3, pcp::instance_info()),
+        pcp::instance_domain::value_type(4, pcp::instance_info())
+    };
+
+    // Every public route to modifying the instances keeps the index, and the
+    // generation, in sync.
+    unsigned long generation = indom.get_generation();
+    indom(1, "one");
+    EXPECT_TRUE(indom.contains(1));
+    EXPECT_NE(generation, indom.get_generation());
+
+    generation = indom.get_generation();
+    indom(2, pcp::instance_info());
+    EXPECT_TRUE(indom.contains(2));
+    EXPECT_NE(generation, indom.get_generation());
+
+    generation = indom.get_generation();
+    indom.insert(indom.end(), pcp::instance_domain::value_type(5, pcp::instance_info()));
+    EXPECT_TRUE(indom.contains(5));
+    EXPECT_NE(generation, indom.get_generation());
+
+    generation = indom.get_generation();
+    indom.insert(values, values + 2);
+    EXPECT_TRUE(indom.contains(3));
+    EXPECT_TRUE(indom.contains(4));
+    EXPECT_NE(generation, indom.get_generation());
+
+    generation = indom.get_generation();
+    indom.erase(indom.find(5));
+    EXPECT_FALSE(indom.contains(5));
+    EXPECT_NE(generation, indom.get_generation());
+
+    generation = indom.get_generation();
+    indom.erase(indom.find(3), indom.end());
+    EXPECT_FALSE(indom.contains(3));
+    EXPECT_FALSE(indom.contains(4));
+    EXPECT_NE(generation, indom.get_generation());
+
+    generation = indom.get_generation();
+    EXPECT_EQ(pcp::instance_domain::size_type(1), indom.erase(2));
+    EXPECT_FALSE(indom.contains(2));
+    EXPECT_NE(generation, indom.get_generation());
+
+    generation = indom.get_generation();
+    indom.clear();
+    EXPECT_FALSE(indom.contains(1));
+    EXPECT_NE(generation, indom.get_generation());
+
+    // Anything that would bypass the index, such as std::map's emplace,
+    // operator[], and erase by const_iterator, or modifying the domain via a
+    // std::map reference, is inaccessible.
+#if __cplusplus >= 201103L
+    typedef std::map<pcp::instance_id_type, const pcp::instance_info> map_type;
+    EXPECT_FALSE((std::is_convertible<pcp::instance_domain *, map_type *>::value));
+    EXPECT_FALSE(has_emplace<pcp::instance_domain>(0));
+    EXPECT_FALSE(has_emplace_hint<pcp::instance_domain>(0));
+    EXPECT_FALSE(has_subscript<pcp::instance_domain>(0));
+    EXPECT_FALSE(has_const_iterator_erase<pcp::instance_domain>(0));
+    EXPECT_TRUE(has_emplace<map_type>(0)); // Sanity check the checks.
+    EXPECT_TRUE((has_subscript<std::map<int, int> >(0)));
+#endif
+}
+
+TEST(instance_domain, generation) {
+    pcp::instance_domain indom;
+    const unsigned long initial = indom.get_generation();
+
+    indom(1, "one");
+    EXPECT_NE(initial, indom.get_generation());
+
+    // Only actual changes bump the generation.
+    unsigned long generation = indom.get_generation();
+    indom(1, "one again");
+    EXPECT_EQ(generation, indom.get_generation());
+    EXPECT_EQ(pcp::instance_domain::size_type(0), indom.erase(2));
+    EXPECT_EQ(generation, indom.get_generation());
+    indom(1); // Setting the domain ID does not change the instances.
+    EXPECT_EQ(generation, indom.get_generation());
+
+    indom.erase(1);
+    EXPECT_NE(generation, indom.get_generation());
+
+    generation = indom.get_generation();
+    indom.clear();
+    EXPECT_NE(generation, indom.get_generation());
+}
+
+TEST(instance_domain, lookup) {
+    pcp::instance_domain indom;
+    pcp::instance_id_type id = 0;
+    EXPECT_FALSE(indom.lookup_instance_id("one", id));
+    EXPECT_EQ(static_cast<const char *>(NULL), indom.lookup_instance_name(1));
+
+    for (int index = 0; index < 1000; ++index) {
+        std::ostringstream name;
+        name << "instance " << index;
+        indom(index * 7, name.str());
+    }
+    EXPECT_TRUE(indom.lookup_instance_id("instance 123", id));
+    EXPECT_EQ(pcp::instance_id_type(861), id);
+    EXPECT_STREQ("instance 999", indom.lookup_instance_name(6993));
+    EXPECT_FALSE(indom.lookup_instance_id("instance", id));
+    EXPECT_EQ(static_cast<const char *>(NULL), indom.lookup_instance_name(6994));
+
+    // Lookups follow changes to the domain.
+    indom.erase(861);
+    indom(5, "instance 123");
+    EXPECT_TRUE(indom.lookup_instance_id("instance 123", id));
+    EXPECT_EQ(pcp::instance_id_type(5), id);
+    EXPECT_EQ(static_cast<const char *>(NULL), indom.lookup_instance_name(861));
+
+    // Copies have their own lookup tables.
+    pcp::instance_domain copy(indom);
+    indom.clear();
+    EXPECT_FALSE(indom.lookup_instance_id("instance 123", id));
+    EXPECT_STREQ("instance 123", copy.lookup_instance_name(5));
+}
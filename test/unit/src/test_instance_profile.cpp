@@ -0,0 +1,80 @@
+//               Copyright Paul Colby 2018.
+// Distributed under the Boost Software License, Version 1.0.
+//       (See accompanying file LICENSE.md or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include "pcp-cpp/instance_profile.hpp"
+
+#include "gtest/gtest.h"
+
+TEST(instance_profile, default_includes_all) {
+    const pcp::instance_profile profile;
+    EXPECT_TRUE(profile.includes(123, 0));
+    EXPECT_TRUE(profile.includes(123, 456));
+    EXPECT_TRUE(profile.includes_by_default(123));
+    EXPECT_TRUE(profile.get_exceptions(123).empty());
+    EXPECT_TRUE(profile.includes_all());
+
+    const pcp::instance_profile null_profile(NULL);
+    EXPECT_TRUE(null_profile.includes(123, 456));
+}
+
+TEST(instance_profile, decode) {
+    int excluded[] = { 7, 3 };
+    int included[] = { 9, 2, 5 };
+    pmInDomProfile indoms[2];
+    indoms[0].indom = 100;
+    indoms[0].state = PM_PROFILE_INCLUDE;
+    indoms[0].instances_len = 2;
+    indoms[0].instances = excluded;
+    indoms[1].indom = 200;
+    indoms[1].state = PM_PROFILE_EXCLUDE;
+    indoms[1].instances_len = 3;
+    indoms[1].instances = included;
+    pmProfile raw;
+    raw.state = PM_PROFILE_EXCLUDE;
+    raw.profile_len = 2;
+    raw.profile = indoms;
+
+    pcp::instance_profile profile(&raw);
+
+    // Matches pmInProfile, for all combinations.
+    const pmInDom domains[] = { 100, 200, 300 };
+    for (size_t domain = 0; domain < sizeof(domains)/sizeof(domains[0]); ++domain) {
+        for (int instance = 0; instance < 10; ++instance) {
+            EXPECT_EQ(pmInProfile(domains[domain], &raw, instance) != 0,
+                      profile.includes(domains[domain], instance))
+                << "indom " << domains[domain] << " instance " << instance;
+        }
+    }
+
+    // Exceptions are sorted, and relative to each domain's default state.
+    EXPECT_TRUE(profile.includes_by_default(100));
+    ASSERT_EQ(2u, profile.get_exceptions(100).size());
+    EXPECT_EQ(3, profile.get_exceptions(100)[0]);
+    EXPECT_EQ(7, profile.get_exceptions(100)[1]);
+    EXPECT_FALSE(profile.includes_by_default(200));
+    ASSERT_EQ(3u, profile.get_exceptions(200).size());
+    EXPECT_EQ(2, profile.get_exceptions(200)[0]);
+    EXPECT_EQ(5, profile.get_exceptions(200)[1]);
+    EXPECT_EQ(9, profile.get_exceptions(200)[2]);
+    EXPECT_FALSE(profile.includes_by_default(300));
+    EXPECT_TRUE(profile.get_exceptions(300).empty());
+
+    // Re-assigning replaces the previous profile.
+    raw.profile_len = 1;
+    raw.state = PM_PROFILE_INCLUDE;
+    profile.assign(&raw);
+    EXPECT_TRUE(profile.includes(200, 3));
+    EXPECT_FALSE(profile.includes(100, 3));
+    EXPECT_FALSE(profile.includes_all());
+    profile.assign(NULL);
+    EXPECT_TRUE(profile.includes(100, 3));
+    EXPECT_TRUE(profile.includes_all());
+
+    // Domains listed without exceptions exclude nothing.
+    raw.profile_len = 1;
+    indoms[0].instances_len = 0;
+    profile.assign(&raw);
+    EXPECT_TRUE(profile.includes_all());
+}
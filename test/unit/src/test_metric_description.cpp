@@ -84,3 +84,31 @@ TEST(metric_cluster, cast_to_pmDesc) {
     EXPECT_EQ(11u, desc2.units.scaleTime);
     EXPECT_EQ(-6, desc2.units.scaleCount);
 }
+
+TEST(metric_description, source) {
+    const pcp::metric_description unbound(
+        "unbound", PM_TYPE_U32, PM_SEM_INSTANT, pcp::units(0,0,0, 0,0,0));
+    EXPECT_FALSE(unbound.source.is_bound());
+
+    double value = 1.5;
+    pcp::metrics_description metrics;
+    metrics(0)(1, "bound", PM_TYPE_DOUBLE, PM_SEM_INSTANT, pcp::units(0,0,0, 0,0,0),
+               pcp::bind_to(&value));
+    const pcp::metric_source &source = metrics.at(0).at(1).source;
+    ASSERT_TRUE(source.is_bound());
+    EXPECT_EQ(1.5, source.read(PM_TYPE_DOUBLE).d);
+    value = 2.5;
+    EXPECT_EQ(2.5, source.read(PM_TYPE_DOUBLE).d);
+
+    // Numeric sources are validated against the metric's type on registration.
+    EXPECT_THROW(pcp::metric_description("bad", PM_TYPE_STRING, PM_SEM_INSTANT,
+                     pcp::units(0,0,0, 0,0,0), NULL, std::string(), std::string(),
+                     NULL, static_cast<pcp::metric_flags>(0), pcp::bind_to(&value)),
+                 pcp::exception);
+
+#if __cplusplus >= 201103L
+    std::atomic<uint64_t> counter(123);
+    EXPECT_EQ(123u, pcp::bind_to(&counter).read(PM_TYPE_U64).ull);
+    EXPECT_EQ(456u, pcp::bind_getter([]() { return 456u; }).read(PM_TYPE_U32).ul);
+#endif
+}
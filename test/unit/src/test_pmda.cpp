@@ -4,15 +4,24 @@
 //          http://www.boost.org/LICENSE_1_0.txt)
 
 #define protected public
+#include "pcp-cpp/basic_pmda.hpp"
 #include "pcp-cpp/pmda.hpp"
 #undef protected
 
+#include "pcp-cpp/atom.hpp"
+#include "pcp-cpp/cached_instance_domain.hpp"
+#include "pcp-cpp/compact_instance_domain.hpp"
+#include "pcp-cpp/typed_indom.hpp"
 #include "pcp-cpp/units.hpp"
 
 #include "fake_libpcp.h"
+#include "fake_libpcp-pmda.h"
 
 #include "gtest/gtest.h"
 
+#include <fstream>
+#include <sstream>
+
 // PM_ERR_FAULT ("QA fault injected") was not added until PCP 3.6.0.
 #ifndef PM_ERR_FAULT
 #define PM_ERR_FAULT PM_ERR_GENERIC
@@ -103,6 +112,131 @@ public:
     }
 };
 
+/// @brief Counts calls to begin_fetch_values.
+class counting_pmda : public stub_pmda {
+public:
+    size_t begin_fetch_values_calls;
+
+    counting_pmda() : begin_fetch_values_calls(0) { }
+
+    virtual void begin_fetch_values() {
+        ++begin_fetch_values_calls;
+    }
+};
+
+/// @brief Records the metrics requested of begin_fetch_values.
+class selective_pmda : public stub_pmda {
+public:
+    std::vector<fetch_request> requests;
+
+    virtual void begin_fetch_values(const fetch_request &request) {
+        requests.push_back(request);
+    }
+};
+
+/// @brief Reports missing values and errors without throwing.
+class sparse_pmda : public stub_pmda {
+public:
+    virtual fetch_value_result fetch_value(const metric_id &metric)
+    {
+        switch (metric.item) {
+        case 0:  return pcp::atom(metric.type, 123);
+        case 1:  return fetch_value_result::no_value();
+        default: return fetch_value_result::error(PM_ERR_AGAIN);
+        }
+    }
+};
+
+/// @brief Fetches values in batches, via fetch_values.
+class batch_pmda : public stub_pmda {
+public:
+    size_t fetch_values_calls;
+
+    batch_pmda() : fetch_values_calls(0) { }
+
+    virtual bool supports_fetch_values() const {
+        return true;
+    }
+
+    virtual void fetch_values(const std::vector<metric_values> &metrics) {
+        ++fetch_values_calls;
+        for (std::vector<metric_values>::const_iterator iter = metrics.begin();
+             iter != metrics.end(); ++iter)
+        {
+            for (size_t index = 0; index < iter->count; ++index) {
+                if (iter->item == 2) {
+                    iter->codes[index] = PM_ERR_AGAIN;
+                } else if (iter->instances[index] == 2) {
+                    iter->codes[index] = PMDA_FETCH_NOVALUES;
+                } else {
+                    iter->atoms[index].ul = iter->item * 100 + iter->instances[index];
+                }
+            }
+        }
+    }
+};
+
+/// @brief Enables self-instrumentation metrics.
+class self_instrumented_pmda : public batch_pmda {
+public:
+    virtual bool supports_self_instrumentation() const {
+        return true;
+    }
+};
+
+/// @brief Statically dispatched PMDA, via pcp::basic_pmda.
+class crtp_pmda : public pcp::basic_pmda<crtp_pmda> {
+public:
+    size_t fetch_value_calls;
+
+    crtp_pmda() : fetch_value_calls(0) { }
+
+    virtual std::string get_pmda_name() const {
+        return "crtp";
+    }
+
+    virtual int get_default_pmda_domain_number() const {
+        return 123;
+    }
+
+    virtual pcp::metrics_description get_supported_metrics() {
+        return pcp::metrics_description()(0)
+            (0, "present", pcp::type<uint32_t>(), PM_SEM_INSTANT, pcp::units(0,0,0, 0,0,0))
+            (1, "missing", pcp::type<uint32_t>(), PM_SEM_INSTANT, pcp::units(0,0,0, 0,0,0));
+    }
+
+    virtual fetch_value_result fetch_value(const metric_id &metric) {
+        ++fetch_value_calls;
+        if (metric.item == 1) {
+            return fetch_value_result::no_value();
+        }
+        return pcp::atom(metric.type, 456);
+    }
+};
+
+/// @brief Records which instance handles fetch callbacks, during fetches.
+class routed_pmda : public stub_pmda {
+public:
+    size_t begin_fetch_values_calls;
+    const pcp::pmda * fetch_callback_instance;
+
+    routed_pmda() : begin_fetch_values_calls(0), fetch_callback_instance(NULL) { }
+
+    virtual void begin_fetch_values() {
+        ++begin_fetch_values_calls;
+        fetch_callback_instance = get_fetch_callback_instance();
+    }
+};
+
+// Reads, then frees, a 64-bit value from a DPTR value.
+static uint64_t take_u64(pmValue &value)
+{
+    uint64_t result;
+    memcpy(&result, value.value.pval->vbuf, sizeof(result));
+    free(value.value.pval);
+    return result;
+}
+
 TEST(pmda, get_instance) {
     // Instance should be NULL, since we haven't initialised any DSO or daemon
     // interfaces yet.
@@ -210,6 +344,595 @@ TEST(pmda, initialize_pmda) {
     EXPECT_EQ(&opaque, interface.version.two.ext->e_metrics[1].m_user);
 }
 
+TEST(pmda, lookup_metric) {
+    stub_pmda pmda;
+    pcp::instance_domain domain;
+    pmda.stub_supported_metrics
+        (3, "cluster 3")
+            (0, "zero", PM_TYPE_U32, PM_SEM_INSTANT, pcp::units(0,0,0, 0,0,0))
+            (5, "five", PM_TYPE_STRING, PM_SEM_INSTANT, pcp::units(0,0,0, 0,0,0),
+             &domain, pcp::storable_metric)
+        (7, "cluster 7")
+        (9, "cluster 9")
+            (2, "two", PM_TYPE_DOUBLE, PM_SEM_COUNTER, pcp::units(0,0,0, 0,0,0));
+
+    pmdaInterface interface;
+    memset(&interface, 0, sizeof(interface));
+    pmda.initialize_pmda(interface);
+
+    // Supported metrics resolve to their descriptions.
+    EXPECT_EQ("zero", pmda.lookup_metric(3, 0).description->metric_name);
+    EXPECT_EQ(PM_TYPE_U32, pmda.lookup_metric(3, 0).type);
+    EXPECT_EQ(NULL, pmda.lookup_metric(3, 0).domain);
+    EXPECT_EQ("five", pmda.lookup_metric(3, 5).description->metric_name);
+    EXPECT_EQ(PM_TYPE_STRING, pmda.lookup_metric(3, 5).type);
+    EXPECT_EQ(&domain, pmda.lookup_metric(3, 5).domain);
+    EXPECT_EQ(pcp::storable_metric, pmda.lookup_metric(3, 5).flags);
+    EXPECT_EQ("two", pmda.lookup_metric(PMDA_PMID(9, 2)).description->metric_name);
+    EXPECT_EQ(PM_TYPE_DOUBLE, pmda.lookup_metric(PMDA_PMID(9, 2)).type);
+
+    // Unsupported metrics, including gaps between supported ones, throw.
+    EXPECT_THROW(pmda.lookup_metric(0, 0), std::out_of_range);
+    EXPECT_THROW(pmda.lookup_metric(3, 1), std::out_of_range);
+    EXPECT_THROW(pmda.lookup_metric(3, 6), std::out_of_range);
+    EXPECT_THROW(pmda.lookup_metric(7, 0), std::out_of_range);
+    EXPECT_THROW(pmda.lookup_metric(9, 0), std::out_of_range);
+    EXPECT_THROW(pmda.lookup_metric(9, 3), std::out_of_range);
+    EXPECT_THROW(pmda.lookup_metric(10, 0), std::out_of_range);
+    EXPECT_THROW(pmda.lookup_metric(PMDA_PMID(4095, 1023)), std::out_of_range);
+}
+
+TEST(pmda, refresh_interval) {
+    counting_pmda pmda;
+    EXPECT_EQ(0u, pmda.get_refresh_interval(1));
+    EXPECT_EQ(std::numeric_limits<unsigned long>::max(), pmda.get_refresh_age());
+
+    pmdaExt ext;
+    memset(&ext, 0, sizeof(ext));
+    pmResult * result = NULL;
+    pmID cached[] = { PMDA_PMID(1, 0) };
+    pmID uncached[] = { PMDA_PMID(1, 0), PMDA_PMID(2, 0) };
+
+    // By default, every fetch refreshes.
+    pmda.on_fetch(1, cached, &result, &ext);
+    pmda.on_fetch(1, cached, &result, &ext);
+    EXPECT_EQ(2u, pmda.begin_fetch_values_calls);
+    EXPECT_GT(60000u, pmda.get_refresh_age());
+
+    // Fetches within the refresh interval are served from the previous refresh.
+    pmda.set_refresh_interval(1, 3600 * 1000);
+    EXPECT_EQ(3600u * 1000u, pmda.get_refresh_interval(1));
+    EXPECT_EQ(0u, pmda.get_refresh_interval(2));
+    pmda.on_fetch(1, cached, &result, &ext);
+    pmda.on_fetch(1, cached, &result, &ext);
+    EXPECT_EQ(2u, pmda.begin_fetch_values_calls);
+
+    // Unless any of the requested clusters has expired.
+    pmda.on_fetch(2, uncached, &result, &ext);
+    EXPECT_EQ(3u, pmda.begin_fetch_values_calls);
+
+    // The default interval applies to all clusters without their own.
+    pmda.set_refresh_interval(boost::posix_time::hours(1));
+    EXPECT_EQ(3600u * 1000u, pmda.get_refresh_interval(2));
+    pmda.on_fetch(2, uncached, &result, &ext);
+    EXPECT_EQ(3u, pmda.begin_fetch_values_calls);
+}
+
+TEST(pmda, begin_fetch_values_request) {
+    selective_pmda pmda;
+    pmdaExt ext;
+    memset(&ext, 0, sizeof(ext));
+    pmResult * result = NULL;
+    pmID pmids[] = { PMDA_PMID(2, 5), PMDA_PMID(1, 3), PMDA_PMID(2, 1), PMDA_PMID(1, 3) };
+
+    // Requests are sorted, and de-duplicated.
+    pmda.on_fetch(4, pmids, &result, &ext);
+    ASSERT_EQ(1u, pmda.requests.size());
+    ASSERT_EQ(2u, pmda.requests[0].clusters.size());
+    EXPECT_EQ(1u, pmda.requests[0].clusters[0]);
+    EXPECT_EQ(2u, pmda.requests[0].clusters[1]);
+    ASSERT_EQ(3u, pmda.requests[0].metrics.size());
+    EXPECT_EQ(PMDA_PMID(1, 3), pmda.requests[0].metrics[0]);
+    EXPECT_EQ(PMDA_PMID(2, 1), pmda.requests[0].metrics[1]);
+    EXPECT_EQ(PMDA_PMID(2, 5), pmda.requests[0].metrics[2]);
+    EXPECT_TRUE(pmda.requests[0].includes(1));
+    EXPECT_FALSE(pmda.requests[0].includes(3));
+    EXPECT_TRUE(pmda.requests[0].includes(2, 5));
+    EXPECT_FALSE(pmda.requests[0].includes(2, 3));
+    EXPECT_GT(60000u, pmda.get_refresh_age(1));
+    EXPECT_EQ(std::numeric_limits<unsigned long>::max(), pmda.get_refresh_age(3));
+
+    // Clusters within their refresh interval are left out of the request.
+    pmda.set_refresh_interval(1, 3600 * 1000);
+    pmda.on_fetch(4, pmids, &result, &ext);
+    ASSERT_EQ(2u, pmda.requests.size());
+    ASSERT_EQ(1u, pmda.requests[1].clusters.size());
+    EXPECT_EQ(2u, pmda.requests[1].clusters[0]);
+    EXPECT_FALSE(pmda.requests[1].includes(1, 3));
+    EXPECT_TRUE(pmda.requests[1].includes(2, 1));
+
+    // And if no clusters have expired, begin_fetch_values is not called.
+    pmda.on_fetch(1, pmids + 1, &result, &ext);
+    EXPECT_EQ(2u, pmda.requests.size());
+}
+
+TEST(pmda, begin_fetch_values_per_metric_refresh) {
+    selective_pmda pmda;
+    pmda.stub_supported_metrics(1)
+        (0, "first", PM_TYPE_U32, PM_SEM_INSTANT, pcp::units(0,0,0, 0,0,0))
+        (1, "second", PM_TYPE_U32, PM_SEM_INSTANT, pcp::units(0,0,0, 0,0,0));
+    pmdaInterface interface;
+    memset(&interface, 0, sizeof(interface));
+    pmda.initialize_pmda(interface);
+    pmdaExt * const ext = interface.version.two.ext;
+    pmResult * result = NULL;
+    pmID first = PMDA_PMID(1, 0), second = PMDA_PMID(1, 1);
+    pmda.set_refresh_interval(1, 3600 * 1000);
+
+    // Refreshing one metric does not make the rest of its cluster fresh.
+    pmda.on_fetch(1, &first, &result, ext);
+    pmda.on_fetch(1, &second, &result, ext);
+    ASSERT_EQ(2u, pmda.requests.size());
+    ASSERT_EQ(1u, pmda.requests[1].metrics.size());
+    EXPECT_TRUE(pmda.requests[1].includes(1, 1));
+
+    // But each metric is then served from its own refresh.
+    pmda.on_fetch(1, &first, &result, ext);
+    pmda.on_fetch(1, &second, &result, ext);
+    EXPECT_EQ(2u, pmda.requests.size());
+}
+
+TEST(pmda, begin_fetch_values_profile_refresh) {
+    selective_pmda pmda;
+    pcp::instance_domain domain(1);
+    domain(1, "one")(2, "two");
+    pmda.stub_supported_metrics(1)
+        (0, "singular", PM_TYPE_U32, PM_SEM_INSTANT, pcp::units(0,0,0, 0,0,0))
+        (1, "plural", PM_TYPE_U32, PM_SEM_INSTANT, pcp::units(0,0,0, 0,0,0), &domain);
+    pmdaInterface interface;
+    memset(&interface, 0, sizeof(interface));
+    pmda.initialize_pmda(interface);
+    pmdaExt * const ext = interface.version.two.ext;
+    pmResult * result = NULL;
+    pmID pmids[] = { PMDA_PMID(1, 0), PMDA_PMID(1, 1) };
+    pmda.set_refresh_interval(1, 3600 * 1000);
+
+    int excluded[] = { 2 };
+    pmInDomProfile indom_profile;
+    indom_profile.indom = domain.get_pm_instance_domain();
+    indom_profile.state = PM_PROFILE_INCLUDE;
+    indom_profile.instances_len = 1;
+    indom_profile.instances = excluded;
+    pmProfile profile;
+    profile.state = PM_PROFILE_INCLUDE;
+    profile.profile_len = 1;
+    profile.profile = &indom_profile;
+
+    // Values collected under a restrictive profile are shared with that profile.
+    EXPECT_EQ(0, pmda.on_profile(&profile, ext));
+    pmda.on_fetch(2, pmids, &result, ext);
+    pmda.on_fetch(2, pmids, &result, ext);
+    ASSERT_EQ(1u, pmda.requests.size());
+
+    // But not with clients wanting the skipped instances.
+    EXPECT_EQ(0, pmda.on_profile(NULL, ext));
+    pmda.on_fetch(2, pmids, &result, ext);
+    ASSERT_EQ(2u, pmda.requests.size());
+    ASSERT_EQ(1u, pmda.requests[1].metrics.size());
+    EXPECT_TRUE(pmda.requests[1].includes(1, 1));
+
+    // While values collected under a complete profile are shared with all.
+    EXPECT_EQ(0, pmda.on_profile(&profile, ext));
+    pmda.on_fetch(2, pmids, &result, ext);
+    EXPECT_EQ(2u, pmda.requests.size());
+}
+
+TEST(pmda, self_instrumentation) {
+    self_instrumented_pmda pmda;
+    pmda.stub_supported_metrics(0)
+        (0, "singular", PM_TYPE_U32, PM_SEM_INSTANT, pcp::units(0,0,0, 0,0,0));
+    pmdaInterface interface;
+    memset(&interface, 0, sizeof(interface));
+    pmda.initialize_pmda(interface);
+    pmdaExt * const ext = interface.version.two.ext;
+
+    // The self-instrumentation cluster is added to the agent's own metrics.
+    ASSERT_EQ(2u, pmda.supported_metrics.size());
+    const pcp::metrics_description::const_iterator cluster = pmda.supported_metrics.find(4095);
+    ASSERT_NE(pmda.supported_metrics.end(), cluster);
+    EXPECT_EQ("pmda", cluster->second.get_cluster_name());
+    EXPECT_EQ("fetches", cluster->second.at(0).metric_name);
+    EXPECT_EQ("store_latency", cluster->second.at(9).metric_name);
+    EXPECT_EQ(static_cast<const pcp::pmda::metric_lookup_entry *>(NULL), pmda.find_metric(4095, 10));
+
+    // Callbacks are counted when invoked via the PMDA interface.
+    pcp::pmda * const old_instance = pcp::pmda::set_instance(&pmda);
+    pmID pmids[] = { PMDA_PMID(0, 0) };
+    pmResult * result = NULL;
+    EXPECT_EQ(0, interface.version.two.fetch(1, pmids, &result, ext));
+    ASSERT_NE(static_cast<pmResult *>(NULL), result);
+    free(result->vset[0]);
+    char * buffer = NULL;
+    EXPECT_EQ(PM_ERR_NYI, interface.version.two.text(PMDA_PMID(9, 9), PM_TEXT_PMID, &buffer, ext));
+
+    // Self-instrumentation metrics are served by the base class.
+    pmID self_pmids[] = { PMDA_PMID(4095, 0), PMDA_PMID(4095, 1), PMDA_PMID(4095, 2),
+                          PMDA_PMID(4095, 3), PMDA_PMID(4095, 6) };
+    EXPECT_EQ(0, interface.version.two.fetch(5, self_pmids, &result, ext));
+    EXPECT_EQ(1u, pmda.fetch_values_calls); // No agent metrics requested.
+    ASSERT_EQ(5, result->numpmid);
+    ASSERT_EQ(1, result->vset[0]->numval); // Fetches, not including this one.
+    EXPECT_EQ(1u, take_u64(result->vset[0]->vlist[0]));
+    ASSERT_EQ(1, result->vset[1]->numval); // Values.
+    EXPECT_EQ(1u, take_u64(result->vset[1]->vlist[0]));
+    ASSERT_EQ(4, result->vset[2]->numval); // Exceptions, by type.
+    EXPECT_EQ(0u, take_u64(result->vset[2]->vlist[0]));
+    EXPECT_EQ(1u, take_u64(result->vset[2]->vlist[1])); // Unknown PMID for text.
+    EXPECT_EQ(0u, take_u64(result->vset[2]->vlist[2]));
+    EXPECT_EQ(0u, take_u64(result->vset[2]->vlist[3]));
+    ASSERT_EQ(5, result->vset[3]->numval); // Calls, by operation.
+    EXPECT_EQ(1u, take_u64(result->vset[3]->vlist[0]));
+    EXPECT_EQ(1u, take_u64(result->vset[3]->vlist[1]));
+    EXPECT_EQ(0u, take_u64(result->vset[3]->vlist[2]));
+    EXPECT_EQ(1u, take_u64(result->vset[3]->vlist[3]));
+    EXPECT_EQ(0u, take_u64(result->vset[3]->vlist[4]));
+    ASSERT_EQ(8, result->vset[4]->numval); // Fetch latency histogram.
+    uint64_t histogram_total = 0;
+    for (int index = 0; index < 8; ++index) {
+        histogram_total += take_u64(result->vset[4]->vlist[index]);
+    }
+    EXPECT_EQ(1u, histogram_total);
+    for (int index = 0; index < result->numpmid; ++index) {
+        free(result->vset[index]);
+    }
+    pcp::pmda::set_instance(old_instance);
+}
+
+/// @brief Throws from on_fetch, as if out of memory.
+class throwing_fetch_pmda : public stub_pmda {
+public:
+    virtual int on_fetch(int, pmID *, pmResult **, pmdaExt *) {
+        throw std::bad_alloc();
+    }
+};
+
+TEST(pmda, fetch_callback_instance_restored) {
+    throwing_fetch_pmda pmda;
+    pmdaInterface interface;
+    memset(&interface, 0, sizeof(interface));
+    pmda.initialize_pmda(interface);
+    stub_pmda other;
+    pcp::pmda * const old_instance = pcp::pmda::set_instance(&other);
+
+    // The fetching instance is restored, even if the fetch throws.
+    pmID pmid = PMDA_PMID(0, 0);
+    pmResult * result = NULL;
+    EXPECT_THROW(interface.version.two.fetch(1, &pmid, &result, interface.version.two.ext),
+                 std::bad_alloc);
+    EXPECT_EQ(&other, pcp::pmda::get_fetch_callback_instance());
+
+    pcp::pmda::set_instance(old_instance);
+    delete [] interface.version.two.ext->e_metrics;
+    delete interface.version.two.ext;
+}
+
+TEST(pmda, self_instrumentation_collisions) {
+    pmdaInterface interface;
+    memset(&interface, 0, sizeof(interface));
+
+    // The agent's metrics must not use the self-instrumentation cluster.
+    self_instrumented_pmda cluster_clash;
+    cluster_clash.stub_supported_metrics(4095)
+        (0, "singular", PM_TYPE_U32, PM_SEM_INSTANT, pcp::units(0,0,0, 0,0,0));
+    EXPECT_THROW(cluster_clash.initialize_pmda(interface), pcp::exception);
+
+    // Nor the self-instrumentation instance domains.
+    pcp::instance_domain domain(0xFFFE);
+    domain(0, "zero");
+    self_instrumented_pmda indom_clash;
+    indom_clash.stub_supported_metrics(0)
+        (0, "plural", PM_TYPE_U32, PM_SEM_INSTANT, pcp::units(0,0,0, 0,0,0), &domain);
+    EXPECT_THROW(indom_clash.initialize_pmda(interface), pcp::exception);
+}
+
+TEST(pmda, string_arena_reset_per_fetch) {
+    stub_pmda pmda;
+    pmdaExt ext;
+    memset(&ext, 0, sizeof(ext));
+    pmResult * result = NULL;
+
+    const char * const first = pmda.get_string_arena().store("first");
+    pmda.on_fetch(0, NULL, &result, &ext);
+    EXPECT_EQ(first, pmda.get_string_arena().store("again"));
+}
+
+TEST(pmda, fetch_value_result) {
+    EXPECT_EQ(PMDA_FETCH_NOVALUES, pcp::pmda::fetch_value_result::no_value().code);
+    EXPECT_FALSE(pcp::pmda::fetch_value_result::no_value().has_value());
+    EXPECT_EQ(PM_ERR_AGAIN, pcp::pmda::fetch_value_result::error(PM_ERR_AGAIN).code);
+    EXPECT_FALSE(pcp::pmda::fetch_value_result::error(PM_ERR_AGAIN).has_value());
+    const pmAtomValue atom = pcp::atom(PM_TYPE_U32, 1);
+    EXPECT_TRUE(pcp::pmda::fetch_value_result(atom).has_value());
+    EXPECT_TRUE(pcp::pmda::fetch_value_result(atom, PMDA_FETCH_DYNAMIC).has_value());
+}
+
+TEST(pmda, on_fetch_callback_without_exceptions) {
+    sparse_pmda pmda;
+    pmda.stub_supported_metrics(0)
+        (0, "present", PM_TYPE_U32, PM_SEM_INSTANT, pcp::units(0,0,0, 0,0,0))
+        (1, "missing", PM_TYPE_U32, PM_SEM_INSTANT, pcp::units(0,0,0, 0,0,0))
+        (2, "failing", PM_TYPE_U32, PM_SEM_INSTANT, pcp::units(0,0,0, 0,0,0));
+    pmdaInterface interface;
+    memset(&interface, 0, sizeof(interface));
+    pmda.initialize_pmda(interface);
+    pmdaMetric * const metrics = interface.version.two.ext->e_metrics;
+
+    pmAtomValue atom;
+    atom.ul = 0;
+    EXPECT_EQ(PMDA_FETCH_STATIC, pmda.on_fetch_callback(&metrics[0], PM_IN_NULL, &atom));
+    EXPECT_EQ(123u, atom.ul);
+    atom.ul = 0;
+    EXPECT_EQ(PMDA_FETCH_NOVALUES, pmda.on_fetch_callback(&metrics[1], PM_IN_NULL, &atom));
+    EXPECT_EQ(0u, atom.ul);
+    EXPECT_EQ(PM_ERR_AGAIN, pmda.on_fetch_callback(&metrics[2], PM_IN_NULL, &atom));
+    EXPECT_EQ(0u, atom.ul);
+}
+
+TEST(pmda, fetch_values) {
+    batch_pmda pmda;
+    pcp::instance_domain domain(1);
+    domain(1, "one")(2, "two")(3, "three")(4, "four");
+    pmda.stub_supported_metrics(0)
+        (0, "singular", PM_TYPE_U32, PM_SEM_INSTANT, pcp::units(0,0,0, 0,0,0))
+        (1, "plural", PM_TYPE_U32, PM_SEM_INSTANT, pcp::units(0,0,0, 0,0,0), &domain)
+        (2, "failing", PM_TYPE_U32, PM_SEM_INSTANT, pcp::units(0,0,0, 0,0,0), &domain);
+
+    pmdaInterface interface;
+    memset(&interface, 0, sizeof(interface));
+    pmda.initialize_pmda(interface);
+
+    // Exclude instance 4 via the client's profile.
+    int excluded[] = { 4 };
+    pmInDomProfile indom_profile;
+    indom_profile.indom = domain.get_pm_instance_domain();
+    indom_profile.state = PM_PROFILE_INCLUDE;
+    indom_profile.instances_len = 1;
+    indom_profile.instances = excluded;
+    pmProfile profile;
+    profile.state = PM_PROFILE_INCLUDE;
+    profile.profile_len = 1;
+    profile.profile = &indom_profile;
+    pmdaExt ext;
+    memset(&ext, 0, sizeof(ext));
+    EXPECT_EQ(0, pmda.on_profile(&profile, &ext));
+    EXPECT_FALSE(pmda.get_instance_profile().includes(indom_profile.indom, 4));
+
+    pmID pmids[] = { PMDA_PMID(0, 1), PMDA_PMID(0, 0), PMDA_PMID(0, 2), PMDA_PMID(9, 9) };
+    pmResult * result = NULL;
+    EXPECT_EQ(0, pmda.on_fetch(4, pmids, &result, &ext));
+    EXPECT_EQ(1u, pmda.fetch_values_calls);
+    ASSERT_NE(static_cast<pmResult *>(NULL), result);
+    ASSERT_EQ(4, result->numpmid);
+
+    // Instance 2 has no value, and instance 4 is excluded by the profile.
+    EXPECT_EQ(pmids[0], result->vset[0]->pmid);
+    ASSERT_EQ(2, result->vset[0]->numval);
+    EXPECT_EQ(PM_VAL_INSITU, result->vset[0]->valfmt);
+    EXPECT_EQ(1, result->vset[0]->vlist[0].inst);
+    EXPECT_EQ(101, result->vset[0]->vlist[0].value.lval);
+    EXPECT_EQ(3, result->vset[0]->vlist[1].inst);
+    EXPECT_EQ(103, result->vset[0]->vlist[1].value.lval);
+
+    // Singular metrics have a single PM_IN_NULL instance.
+    ASSERT_EQ(1, result->vset[1]->numval);
+    EXPECT_EQ(static_cast<int>(PM_IN_NULL), result->vset[1]->vlist[0].inst);
+    EXPECT_EQ(static_cast<int>(PM_IN_NULL), result->vset[1]->vlist[0].value.lval);
+
+    // Errors are reported per metric, as are unsupported metrics.
+    EXPECT_EQ(PM_ERR_AGAIN, result->vset[2]->numval);
+    EXPECT_EQ(PM_ERR_PMID, result->vset[3]->numval);
+
+    for (int index = 0; index < result->numpmid; ++index) {
+        free(result->vset[index]);
+    }
+}
+
+static uint64_t bound_getter()
+{
+    return 456;
+}
+
+TEST(pmda, bound_metrics) {
+    uint32_t counter = 123;
+    stub_pmda pmda;
+    pmda.stub_supported_metrics(0)
+        (0, "variable", PM_TYPE_U32, PM_SEM_COUNTER, pcp::units(0,0,0, 0,0,0),
+            pcp::bind_to(&counter))
+        (1, "getter", PM_TYPE_U64, PM_SEM_INSTANT, pcp::units(0,0,0, 0,0,0),
+            pcp::bind_to(&bound_getter))
+        (2, "unbound", PM_TYPE_U32, PM_SEM_INSTANT, pcp::units(0,0,0, 0,0,0));
+    pmdaInterface interface;
+    memset(&interface, 0, sizeof(interface));
+    pmda.initialize_pmda(interface);
+    pmdaMetric * const metrics = interface.version.two.ext->e_metrics;
+
+    // Bound metrics are read directly, without calling fetch_value.
+    pmAtomValue atom;
+    EXPECT_EQ(PMDA_FETCH_STATIC, pmda.on_fetch_callback(&metrics[0], PM_IN_NULL, &atom));
+    EXPECT_EQ(123u, atom.ul);
+    counter = 124;
+    EXPECT_EQ(PMDA_FETCH_STATIC, pmda.on_fetch_callback(&metrics[0], PM_IN_NULL, &atom));
+    EXPECT_EQ(124u, atom.ul);
+    EXPECT_EQ(PMDA_FETCH_STATIC, pmda.on_fetch_callback(&metrics[1], PM_IN_NULL, &atom));
+    EXPECT_EQ(456u, atom.ull);
+    EXPECT_EQ(PM_ERR_NYI, pmda.on_fetch_callback(&metrics[2], PM_IN_NULL, &atom));
+}
+
+TEST(pmda, bound_metrics_fetch_values) {
+    uint32_t counter = 123;
+    batch_pmda pmda;
+    pmda.stub_supported_metrics(0)
+        (0, "unbound", PM_TYPE_U32, PM_SEM_INSTANT, pcp::units(0,0,0, 0,0,0))
+        (1, "variable", PM_TYPE_U32, PM_SEM_COUNTER, pcp::units(0,0,0, 0,0,0),
+            pcp::bind_to(&counter));
+    pmdaInterface interface;
+    memset(&interface, 0, sizeof(interface));
+    pmda.initialize_pmda(interface);
+    pmdaExt ext;
+    memset(&ext, 0, sizeof(ext));
+
+    // Fetches of only bound metrics do not call fetch_values at all.
+    pmID bound_pmids[] = { PMDA_PMID(0, 1) };
+    pmResult * result = NULL;
+    EXPECT_EQ(0, pmda.on_fetch(1, bound_pmids, &result, &ext));
+    EXPECT_EQ(0u, pmda.fetch_values_calls);
+    ASSERT_NE(static_cast<pmResult *>(NULL), result);
+    ASSERT_EQ(1, result->vset[0]->numval);
+    EXPECT_EQ(123, result->vset[0]->vlist[0].value.lval);
+    free(result->vset[0]);
+
+    pmID pmids[] = { PMDA_PMID(0, 0), PMDA_PMID(0, 1) };
+    EXPECT_EQ(0, pmda.on_fetch(2, pmids, &result, &ext));
+    EXPECT_EQ(1u, pmda.fetch_values_calls);
+    ASSERT_EQ(1, result->vset[0]->numval);
+    EXPECT_EQ(static_cast<int>(PM_IN_NULL), result->vset[0]->vlist[0].value.lval);
+    ASSERT_EQ(1, result->vset[1]->numval);
+    EXPECT_EQ(123, result->vset[1]->vlist[0].value.lval);
+    free(result->vset[0]);
+    free(result->vset[1]);
+}
+
+/// @brief Describes its metrics with compile-time tables.
+class static_pmda : public sparse_pmda {
+public:
+    virtual const pcp::static_schema * get_static_schema()
+    {
+        static pmdaInstid instances[] = {
+            PCP_CPP_STATIC_INSTANCE(1, "one"),
+            PCP_CPP_STATIC_INSTANCE(2, "two")
+        };
+        static pmdaIndom indoms[] = {
+            PCP_CPP_STATIC_INDOM(5, instances)
+        };
+        static pmdaMetric metrics[] = {
+            PCP_CPP_STATIC_METRIC(3, 1, uint32_t, 5, PM_SEM_INSTANT, PMDA_PMUNITS(0,0,0, 0,0,0)),
+            PCP_CPP_STATIC_METRIC(3, 0, uint32_t, PM_INDOM_NULL, PM_SEM_COUNTER, PMDA_PMUNITS(0,0,1, 0,0,PM_COUNT_ONE)),
+            PCP_CPP_STATIC_METRIC(1, 2, double, PM_INDOM_NULL, PM_SEM_INSTANT, PMDA_PMUNITS(0,0,0, 0,0,0))
+        };
+        static const pcp::static_schema schema = pcp::make_static_schema(metrics, indoms);
+        return &schema;
+    }
+};
+
+TEST(pmda, static_schema) {
+    static_pmda pmda;
+    pmdaInterface interface;
+    memset(&interface, 0, sizeof(interface));
+    pmda.initialize_pmda(interface);
+
+    // The static tables are passed to pmdaInit as-is.
+    const pmdaExt * const ext = interface.version.two.ext;
+    ASSERT_EQ(3, ext->e_nmetrics);
+    ASSERT_EQ(1, ext->e_nindoms);
+    EXPECT_EQ(2, ext->e_indoms[0].it_numinst);
+    EXPECT_EQ(PM_TYPE_U32, ext->e_metrics[0].m_desc.type);
+    EXPECT_EQ(PM_TYPE_DOUBLE, ext->e_metrics[2].m_desc.type);
+    EXPECT_EQ(PMDA_PMID(3, 0), ext->e_metrics[1].m_desc.pmid);
+
+    // Static metrics may be listed in any order.
+    EXPECT_EQ(PM_TYPE_U32, pmda.lookup_metric(3, 0).type);
+    EXPECT_EQ(PM_TYPE_U32, pmda.lookup_metric(3, 1).type);
+    EXPECT_EQ(PM_TYPE_DOUBLE, pmda.lookup_metric(1, 2).type);
+    EXPECT_EQ(&ext->e_indoms[0], pmda.lookup_metric(3, 1).static_domain);
+    EXPECT_EQ(static_cast<const pmdaIndom *>(NULL), pmda.lookup_metric(3, 0).static_domain);
+    ASSERT_NE(static_cast<const pcp::instance_domain *>(NULL), pmda.lookup_metric(3, 1).static_index);
+    EXPECT_TRUE(pmda.lookup_metric(3, 1).static_index->contains(2));
+    EXPECT_FALSE(pmda.lookup_metric(3, 1).static_index->contains(3));
+    EXPECT_EQ(static_cast<const pcp::instance_domain *>(NULL), pmda.lookup_metric(3, 0).static_index);
+    EXPECT_THROW(pmda.lookup_metric(3, 2), std::out_of_range);
+    EXPECT_THROW(pmda.lookup_metric(2, 0), std::out_of_range);
+
+    // Instances are validated against the static instance domain.
+    pmAtomValue atom;
+    EXPECT_EQ(PMDA_FETCH_STATIC, pmda.on_fetch_callback(&ext->e_metrics[1], PM_IN_NULL, &atom));
+    EXPECT_EQ(123u, atom.ul);
+    EXPECT_EQ(PMDA_FETCH_NOVALUES, pmda.on_fetch_callback(&ext->e_metrics[0], 2, &atom));
+    EXPECT_EQ(PM_ERR_INST, pmda.on_fetch_callback(&ext->e_metrics[0], 3, &atom));
+    EXPECT_EQ(PM_ERR_INDOM, pmda.on_fetch_callback(&ext->e_metrics[0], PM_IN_NULL, &atom));
+
+    // Without help text, text requests fall through to pmdaText.
+    char * text = NULL;
+    EXPECT_EQ(PM_ERR_NYI, pmda.on_text(PMDA_PMID(3, 0), PM_TEXT_PMID | PM_TEXT_ONELINE,
+                                       &text, interface.version.two.ext));
+    delete interface.version.two.ext;
+}
+
+TEST(pmda, metric_values_assign) {
+    const uint8_t values[] = { 10, 11, 12, 13 };
+    pcp::instance_id_type instances[] = { 0, 1, 3, 2, 9 };
+    pmAtomValue atoms[5];
+    int codes[5] = { PMDA_FETCH_STATIC, PMDA_FETCH_STATIC, PMDA_FETCH_STATIC,
+                     PMDA_FETCH_STATIC, PMDA_FETCH_STATIC };
+    stub_pmda::metric_values metric;
+    metric.cluster = 0;
+    metric.item = 0;
+    metric.type = PM_TYPE_U32;
+    metric.opaque = NULL;
+    metric.count = 5;
+    metric.instances = instances;
+    metric.atoms = atoms;
+    metric.codes = codes;
+
+    // Contiguous instances, then gathered, with out-of-range ones omitted.
+    metric.assign(values, 4);
+    EXPECT_EQ(10u, atoms[0].ul);
+    EXPECT_EQ(11u, atoms[1].ul);
+    EXPECT_EQ(13u, atoms[2].ul);
+    EXPECT_EQ(12u, atoms[3].ul);
+    EXPECT_EQ(PMDA_FETCH_STATIC, codes[3]);
+    EXPECT_EQ(PMDA_FETCH_NOVALUES, codes[4]);
+
+    // All in range.
+    metric.count = 4;
+    metric.type = PM_TYPE_DOUBLE;
+    metric.assign(values, 4);
+    EXPECT_EQ(13.0, atoms[2].d);
+    EXPECT_EQ(12.0, atoms[3].d);
+
+    // Singular metrics take the first value.
+    instances[0] = PM_IN_NULL;
+    metric.count = 1;
+    metric.assign(values + 1, 1);
+    EXPECT_EQ(11.0, atoms[0].d);
+    metric.assign(values, 0);
+    EXPECT_EQ(PMDA_FETCH_NOVALUES, codes[0]);
+}
+
+TEST(pmda, fetch_values_default_implementation) {
+    stub_pmda pmda;
+    pmda.stub_supported_metrics(0)
+        (0, "singular", PM_TYPE_U32, PM_SEM_INSTANT, pcp::units(0,0,0, 0,0,0));
+    pmdaInterface interface;
+    memset(&interface, 0, sizeof(interface));
+    pmda.initialize_pmda(interface);
+
+    // The stub PMDA's fetch_value throws PM_ERR_NYI for everything.
+    const pcp::instance_id_type instance = PM_IN_NULL;
+    pmAtomValue atom;
+    int code = PMDA_FETCH_STATIC;
+    stub_pmda::metric_values values;
+    values.cluster = 0;
+    values.item = 0;
+    values.type = PM_TYPE_U32;
+    values.opaque = NULL;
+    values.count = 1;
+    values.instances = &instance;
+    values.atoms = &atom;
+    values.codes = &code;
+    pmda.fetch_values(std::vector<stub_pmda::metric_values>(1, values));
+    EXPECT_EQ(PM_ERR_NYI, code);
+}
+
 TEST(pmda, parse_command_line_throws_on_invalid_config_option) {
     publicized_pmda pmda;
     const char * argv[] = { "pmda_name", "--config=/dev/null/invalid" };
@@ -323,3 +1046,387 @@ TEST(pmda, display_functions_do_not_leave_cout_flags_modified) {
     pmda.display_version();
     EXPECT_EQ(flags, std::cout.flags());
 }
+
+TEST(pmda, basic_pmda) {
+    crtp_pmda pmda;
+    pmdaInterface interface;
+    memset(&interface, 0, sizeof(interface));
+    pmda.initialize_pmda(interface);
+    pmdaExt * const ext = interface.version.two.ext;
+    pmdaMetric * const metrics = ext->e_metrics;
+
+    // The fetch callback is the statically dispatched trampoline.  Our fake
+    // pmdaInit only creates the pmdaExt, so set the callbacks again here.
+    pmda.set_callbacks(interface);
+    const pcp::pmda * const old_instance = pcp::pmda::set_instance(&pmda);
+    ASSERT_NE(static_cast<pmdaFetchCallBack>(NULL), ext->e_fetchCallBack);
+    pmAtomValue atom;
+    atom.ul = 0;
+    EXPECT_EQ(PMDA_FETCH_STATIC, ext->e_fetchCallBack(&metrics[0], PM_IN_NULL, &atom));
+    EXPECT_EQ(456u, atom.ul);
+    EXPECT_EQ(PMDA_FETCH_NOVALUES, ext->e_fetchCallBack(&metrics[1], PM_IN_NULL, &atom));
+    EXPECT_EQ(PM_ERR_INDOM, ext->e_fetchCallBack(&metrics[0], 1, &atom));
+    EXPECT_EQ(size_t(2), pmda.fetch_value_calls);
+    pcp::pmda::set_instance(const_cast<pcp::pmda *>(old_instance));
+
+    // The default batch implementation is statically dispatched too.
+    const pcp::instance_id_type instance = PM_IN_NULL;
+    int code = PMDA_FETCH_STATIC;
+    crtp_pmda::metric_values values;
+    values.cluster = 0;
+    values.item = 0;
+    values.type = PM_TYPE_U32;
+    values.opaque = NULL;
+    values.count = 1;
+    values.instances = &instance;
+    values.atoms = &atom;
+    values.codes = &code;
+    atom.ul = 0;
+    pmda.fetch_values(std::vector<crtp_pmda::metric_values>(1, values));
+    EXPECT_EQ(PMDA_FETCH_STATIC, code);
+    EXPECT_EQ(456u, atom.ul);
+    EXPECT_EQ(size_t(3), pmda.fetch_value_calls);
+    delete ext;
+}
+
+TEST(pmda, multiple_instances) {
+    pmdaInterface first_interface, second_interface;
+    memset(&first_interface, 0, sizeof(first_interface));
+    memset(&second_interface, 0, sizeof(second_interface));
+    pmID pmid = PMDA_PMID(0, 0);
+    pmResult * result = NULL;
+    {
+        routed_pmda first, second;
+        first.stub_supported_metrics(0)
+            (0, "metric", PM_TYPE_U32, PM_SEM_INSTANT, pcp::units(0,0,0, 0,0,0));
+        second.stub_supported_metrics = first.stub_supported_metrics;
+        first.initialize_pmda(first_interface);
+        second.initialize_pmda(second_interface);
+        EXPECT_EQ(&first, pcp::pmda::get_instance(first_interface.version.two.ext));
+        EXPECT_EQ(&second, pcp::pmda::get_instance(second_interface.version.two.ext));
+
+        // Unregistered extensions fall back to the singleton instance.
+        EXPECT_EQ(pcp::pmda::get_instance(), pcp::pmda::get_instance(NULL));
+
+        // Each interface's callbacks are routed to its own instance.
+        second_interface.version.two.fetch(1, &pmid, &result, second_interface.version.two.ext);
+        EXPECT_EQ(size_t(0), first.begin_fetch_values_calls);
+        EXPECT_EQ(size_t(1), second.begin_fetch_values_calls);
+        EXPECT_EQ(&second, second.fetch_callback_instance);
+        first_interface.version.two.fetch(1, &pmid, &result, first_interface.version.two.ext);
+        EXPECT_EQ(size_t(1), first.begin_fetch_values_calls);
+        EXPECT_EQ(&first, first.fetch_callback_instance);
+        EXPECT_EQ(pcp::pmda::get_instance(), pcp::pmda::get_fetch_callback_instance());
+    }
+
+    // Instances are unregistered on destruction.
+    EXPECT_EQ(pcp::pmda::get_instance(), pcp::pmda::get_instance(first_interface.version.two.ext));
+    EXPECT_EQ(pcp::pmda::get_instance(), pcp::pmda::get_instance(second_interface.version.two.ext));
+    delete first_interface.version.two.ext;
+    delete second_interface.version.two.ext;
+}
+
+TEST(pmda, instance_domain_changes) {
+    stub_pmda pmda;
+    pcp::instance_domain domain(1);
+    domain(1, "one")(2, "two");
+    pmda.stub_supported_metrics(0)
+        (0, "metric", PM_TYPE_U32, PM_SEM_INSTANT, pcp::units(0,0,0, 0,0,0), &domain);
+    pmdaInterface interface;
+    memset(&interface, 0, sizeof(interface));
+    pmda.initialize_pmda(interface);
+    pmdaIndom &indom = interface.version.two.ext->e_indoms[0];
+    ASSERT_EQ(2, indom.it_numinst);
+
+    // Changes are applied at the start of the next instance request.
+    domain(3, "three");
+    domain.erase(1);
+    EXPECT_EQ(2, indom.it_numinst);
+    EXPECT_EQ(PM_ERR_NYI, pmda.on_instance(indom.it_indom, PM_IN_NULL, NULL, NULL,
+                                           interface.version.two.ext));
+    ASSERT_EQ(2, indom.it_numinst);
+    EXPECT_EQ(2, indom.it_set[0].i_inst);
+    EXPECT_STREQ("two", indom.it_set[0].i_name);
+    EXPECT_EQ(3, indom.it_set[1].i_inst);
+    EXPECT_STREQ("three", indom.it_set[1].i_name);
+
+    // Or fetch request, in which case growing the domain grows the table.
+    domain(4, "four")(5, "five");
+    pmID pmid = PMDA_PMID(0, 0);
+    pmResult * result = NULL;
+    pmda.on_fetch(1, &pmid, &result, interface.version.two.ext);
+    ASSERT_EQ(4, indom.it_numinst);
+    EXPECT_EQ(5, indom.it_set[3].i_inst);
+    EXPECT_STREQ("five", indom.it_set[3].i_name);
+
+    // Shrinking re-uses the existing table.
+    const pmdaInstid * const instances = indom.it_set;
+    domain.clear();
+    domain(6, "six");
+    pmda.on_fetch(1, &pmid, &result, interface.version.two.ext);
+    ASSERT_EQ(1, indom.it_numinst);
+    EXPECT_EQ(instances, indom.it_set);
+    EXPECT_EQ(6, indom.it_set[0].i_inst);
+    EXPECT_STREQ("six", indom.it_set[0].i_name);
+
+    delete [] indom.it_set;
+    delete [] interface.version.two.ext->e_indoms;
+    delete [] interface.version.two.ext->e_metrics;
+    delete interface.version.two.ext;
+}
+
+TEST(pmda, cached_instance_domain) {
+    stub_pmda pmda;
+    pcp::cached_instance_domain domain(1);
+    pmda.stub_supported_metrics(0)
+        (0, "metric", PM_TYPE_U32, PM_SEM_INSTANT, pcp::units(0,0,0, 0,0,0), &domain);
+    pmdaInterface interface;
+    memset(&interface, 0, sizeof(interface));
+    pmda.initialize_pmda(interface);
+    pmdaExt * const ext = interface.version.two.ext;
+
+    // The pmdaIndom table is left empty, for libpcp_pmda to use the cache.
+    pmdaIndom &indom = ext->e_indoms[0];
+    EXPECT_EQ(domain.get_pm_instance_domain(), indom.it_indom);
+    EXPECT_EQ(0, indom.it_numinst);
+    EXPECT_EQ(static_cast<pmdaInstid *>(NULL), indom.it_set);
+
+    // And remains so, as the cache changes.
+    domain.set_pm_instance_domain(3);
+    domain.store("three");
+    pmInResult * result = NULL;
+    char name[] = "three";
+    EXPECT_EQ(PM_ERR_NYI, pmda.on_instance(indom.it_indom, PM_IN_NULL, name, &result, ext));
+    EXPECT_EQ(0, indom.it_numinst);
+    EXPECT_EQ(static_cast<pmdaInstid *>(NULL), indom.it_set);
+
+    // Instances are validated against the cache.
+    pmAtomValue atom;
+    EXPECT_EQ(PM_ERR_NYI, pmda.on_fetch_callback(&ext->e_metrics[0], 3, &atom));
+    EXPECT_EQ(PM_ERR_INST, pmda.on_fetch_callback(&ext->e_metrics[0], 4, &atom));
+
+    delete [] ext->e_indoms;
+    delete [] ext->e_metrics;
+    delete ext;
+}
+
+TEST(pmda, cached_instance_domain_fetch) {
+    batch_pmda pmda;
+    pcp::cached_instance_domain domain(1);
+    pmda.stub_supported_metrics(0)
+        (1, "plural", PM_TYPE_U32, PM_SEM_INSTANT, pcp::units(0,0,0, 0,0,0), &domain);
+    pmdaInterface interface;
+    memset(&interface, 0, sizeof(interface));
+    pmda.initialize_pmda(interface);
+    pmdaExt * const ext = interface.version.two.ext;
+    const fake_pmda_cache cache(domain.get_pm_instance_domain());
+    domain.store("zero");
+    domain.store("one");
+    domain.store("two");
+    domain.store("three");
+    domain.hide("one");
+
+    // Batch fetches walk the cache's active instances.
+    pmID pmid = PMDA_PMID(0, 1);
+    pmResult * result = NULL;
+    EXPECT_EQ(0, pmda.on_fetch(1, &pmid, &result, ext));
+    EXPECT_EQ(1u, pmda.fetch_values_calls);
+    ASSERT_NE(static_cast<pmResult *>(NULL), result);
+    ASSERT_EQ(2, result->vset[0]->numval); // Instance 2 has no value.
+    EXPECT_EQ(0, result->vset[0]->vlist[0].inst);
+    EXPECT_EQ(100, result->vset[0]->vlist[0].value.lval);
+    EXPECT_EQ(3, result->vset[0]->vlist[1].inst);
+    EXPECT_EQ(103, result->vset[0]->vlist[1].value.lval);
+    free(result->vset[0]);
+
+    delete [] ext->e_indoms;
+    delete [] ext->e_metrics;
+    delete ext;
+}
+
+TEST(pmda, typed_indom_fetch) {
+    batch_pmda pmda;
+    pcp::cache::typed_indom<int> domain(1);
+    pmda.stub_supported_metrics(0)
+        (1, "plural", PM_TYPE_U32, PM_SEM_INSTANT, pcp::units(0,0,0, 0,0,0), &domain);
+    pmdaInterface interface;
+    memset(&interface, 0, sizeof(interface));
+    pmda.initialize_pmda(interface);
+    pmdaExt * const ext = interface.version.two.ext;
+    const fake_pmda_cache cache(domain.get_pm_instance_domain());
+    domain.store("zero");
+    domain.store("one");
+    domain.inactivate_all();
+    domain.store("one");
+
+    // Stored instances are validated, and fetched, via the cache.
+    pmAtomValue atom;
+    EXPECT_EQ(PM_ERR_NYI, pmda.on_fetch_callback(&ext->e_metrics[0], 1, &atom));
+    EXPECT_EQ(PM_ERR_INST, pmda.on_fetch_callback(&ext->e_metrics[0], 0, &atom));
+    pmID pmid = PMDA_PMID(0, 1);
+    pmResult * result = NULL;
+    EXPECT_EQ(0, pmda.on_fetch(1, &pmid, &result, ext));
+    ASSERT_NE(static_cast<pmResult *>(NULL), result);
+    ASSERT_EQ(1, result->vset[0]->numval);
+    EXPECT_EQ(1, result->vset[0]->vlist[0].inst);
+    EXPECT_EQ(101, result->vset[0]->vlist[0].value.lval);
+    free(result->vset[0]);
+
+    delete [] ext->e_indoms;
+    delete [] ext->e_metrics;
+    delete ext;
+}
+
+TEST(pmda, compact_instance_domain) {
+    batch_pmda pmda;
+    pcp::compact_instance_domain domain(1);
+    domain(3, "three")(1, "one");
+    pmda.stub_supported_metrics(0)
+        (1, "plural", PM_TYPE_U32, PM_SEM_INSTANT, pcp::units(0,0,0, 0,0,0), &domain);
+    pmdaInterface interface;
+    memset(&interface, 0, sizeof(interface));
+    pmda.initialize_pmda(interface);
+    pmdaIndom &indom = interface.version.two.ext->e_indoms[0];
+    ASSERT_EQ(2, indom.it_numinst);
+    EXPECT_EQ(1, indom.it_set[0].i_inst);
+    EXPECT_STREQ("one", indom.it_set[0].i_name);
+
+    // Validated, synced, and enumerated, just like std::map-based domains.
+    pmAtomValue atom;
+    pmdaMetric * const metrics = interface.version.two.ext->e_metrics;
+    EXPECT_EQ(PM_ERR_NYI, pmda.on_fetch_callback(&metrics[0], 3, &atom));
+    EXPECT_EQ(PM_ERR_INST, pmda.on_fetch_callback(&metrics[0], 2, &atom));
+    domain(2, "two");
+    pmID pmid = PMDA_PMID(0, 1);
+    pmResult * result = NULL;
+    EXPECT_EQ(0, pmda.on_fetch(1, &pmid, &result, interface.version.two.ext));
+    ASSERT_EQ(3, indom.it_numinst);
+    EXPECT_STREQ("two", indom.it_set[1].i_name);
+    ASSERT_NE(static_cast<pmResult *>(NULL), result);
+    ASSERT_EQ(2, result->vset[0]->numval); // Instance 2 has no value.
+    EXPECT_EQ(1, result->vset[0]->vlist[0].inst);
+    EXPECT_EQ(3, result->vset[0]->vlist[1].inst);
+    EXPECT_EQ(103, result->vset[0]->vlist[1].value.lval);
+    free(result->vset[0]);
+
+    delete [] indom.it_set;
+    delete [] interface.version.two.ext->e_indoms;
+    delete [] interface.version.two.ext->e_metrics;
+    delete interface.version.two.ext;
+}
+
+/// @brief Loads descriptions lazily, for odd instance IDs only.
+class lazy_instance_domain : public pcp::compact_instance_domain {
+public:
+    explicit lazy_instance_domain(const pcp::domain_id_type domain_id)
+        : pcp::compact_instance_domain(domain_id) { }
+
+protected:
+    virtual bool load_descriptions(const pcp::instance_id_type instance_id,
+                                   std::string &short_description,
+                                   std::string &verbose_description) const
+    {
+        if ((instance_id % 2) == 0) {
+            return false;
+        }
+        short_description = "odd";
+        verbose_description = "an odd instance";
+        return true;
+    }
+};
+
+TEST(pmda, compact_instance_domain_help_text) {
+    publicized_pmda pmda;
+    lazy_instance_domain domain(1);
+    domain(1, "one")(2, "two")(4, "four", "even", "an even instance");
+    pmda.stub_supported_metrics(0)
+        (1, "plural", PM_TYPE_U32, PM_SEM_INSTANT, pcp::units(0,0,0, 0,0,0), &domain);
+
+    // Exported help text includes both given, and lazily loaded, descriptions.
+    const std::string filename = testing::TempDir() + "pcp_cpp_compact_help";
+    const std::string option = "--export-help=" + filename;
+    const char * argv[] = { "pmda_name", option.c_str() };
+    pmdaInterface interface;
+    interface.version.two.ext = new pmdaExt;
+    boost::program_options::variables_map options;
+    EXPECT_FALSE(pmda.parse_command_line(2, argv, interface, options));
+    delete interface.version.two.ext;
+    std::ifstream file(filename.c_str());
+    std::ostringstream help;
+    help << file.rdbuf();
+    remove(filename.c_str());
+    EXPECT_NE(std::string::npos, help.str().find("@ 1.1 odd\nan odd instance\n"));
+    EXPECT_NE(std::string::npos, help.str().find("@ 1.2 \n"));
+    EXPECT_NE(std::string::npos, help.str().find("@ 1.4 even\nan even instance\n"));
+
+    // Text requests are served the same way; the indom's serial is the
+    // requested instance, and its domain the instance domain's own ID.
+    memset(&interface, 0, sizeof(interface));
+    pmda.initialize_pmda(interface);
+    char * text = NULL;
+    EXPECT_EQ(0, pmda.on_text((1 << 22) | 1, PM_TEXT_INDOM | PM_TEXT_ONELINE,
+                              &text, interface.version.two.ext));
+    EXPECT_STREQ("odd", text);
+    free(text);
+    EXPECT_EQ(0, pmda.on_text((1 << 22) | 4, PM_TEXT_INDOM | PM_TEXT_HELP,
+                              &text, interface.version.two.ext));
+    EXPECT_STREQ("an even instance", text);
+    free(text);
+    EXPECT_EQ(PM_ERR_NYI, pmda.on_text((1 << 22) | 2, PM_TEXT_INDOM | PM_TEXT_ONELINE,
+                                       &text, interface.version.two.ext));
+    EXPECT_EQ(PM_ERR_NYI, pmda.on_text((1 << 22) | 3, PM_TEXT_INDOM | PM_TEXT_ONELINE,
+                                       &text, interface.version.two.ext));
+
+    delete [] interface.version.two.ext->e_indoms[0].it_set;
+    delete [] interface.version.two.ext->e_indoms;
+    delete [] interface.version.two.ext->e_metrics;
+    delete interface.version.two.ext;
+}
+
+TEST(pmda, instance_lookup) {
+    stub_pmda pmda;
+    pcp::instance_domain domain(1);
+    domain(1, "one")(2, "two");
+    pmda.stub_supported_metrics(0)
+        (0, "metric", PM_TYPE_U32, PM_SEM_INSTANT, pcp::units(0,0,0, 0,0,0), &domain);
+    pmdaInterface interface;
+    memset(&interface, 0, sizeof(interface));
+    pmda.initialize_pmda(interface);
+    pmdaExt * const ext = interface.version.two.ext;
+    const pmInDom indom = ext->e_indoms[0].it_indom;
+
+    // Name to ID.
+    pmInResult * result = NULL;
+    char name[] = "two";
+    ASSERT_EQ(0, pmda.on_instance(indom, PM_IN_NULL, name, &result, ext));
+    ASSERT_NE(static_cast<pmInResult *>(NULL), result);
+    EXPECT_EQ(indom, result->indom);
+    ASSERT_EQ(1, result->numinst);
+    EXPECT_EQ(2, result->instlist[0]);
+    EXPECT_EQ(static_cast<char **>(NULL), result->namelist);
+    free(result->instlist);
+    free(result);
+
+    // ID to name, including instances added since initialization.
+    domain(3, "three");
+    result = NULL;
+    ASSERT_EQ(0, pmda.on_instance(indom, 3, NULL, &result, ext));
+    ASSERT_NE(static_cast<pmInResult *>(NULL), result);
+    ASSERT_EQ(1, result->numinst);
+    EXPECT_EQ(static_cast<int *>(NULL), result->instlist);
+    EXPECT_STREQ("three", result->namelist[0]);
+    free(result->namelist[0]);
+    free(result->namelist);
+    free(result);
+
+    // Misses, and listing all instances, fall back to pmdaInstance.
+    char unknown[] = "four";
+    EXPECT_EQ(PM_ERR_NYI, pmda.on_instance(indom, PM_IN_NULL, unknown, &result, ext));
+    EXPECT_EQ(PM_ERR_NYI, pmda.on_instance(indom, 4, NULL, &result, ext));
+    EXPECT_EQ(PM_ERR_NYI, pmda.on_instance(indom, PM_IN_NULL, NULL, &result, ext));
+
+    delete [] ext->e_indoms[0].it_set;
+    delete [] ext->e_indoms;
+    delete [] ext->e_metrics;
+    delete ext;
+}
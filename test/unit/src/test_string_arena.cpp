@@ -0,0 +1,56 @@
+//               Copyright Paul Colby 2018.
+// Distributed under the Boost Software License, Version 1.0.
+//       (See accompanying file LICENSE.md or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include "pcp-cpp/string_arena.hpp"
+
+#include "gtest/gtest.h"
+
+#include <vector>
+
+TEST(string_arena, store) {
+    pcp::string_arena arena(16);
+    EXPECT_EQ(0u, arena.capacity());
+
+    // Stored strings are null-terminated copies.
+    const char * const first = arena.store("first");
+    EXPECT_STREQ("first", first);
+    EXPECT_STREQ("sec", arena.store("second", 3));
+    EXPECT_STREQ("third", arena.store(std::string("third")));
+    EXPECT_STREQ("", arena.store(std::string()));
+
+    // Strings larger than the chunk size get chunks of their own.
+    const std::string large(100, 'x');
+    EXPECT_EQ(large, arena.store(large));
+
+    // Earlier strings are not moved by later ones.
+    EXPECT_STREQ("first", first);
+}
+
+TEST(string_arena, reset_reuses_memory) {
+    pcp::string_arena arena(64);
+    std::vector<std::string> values;
+    for (int index = 0; index < 100; ++index) {
+        values.push_back(std::string(index % 20, 'a' + (index % 26)));
+    }
+
+    std::vector<const char *> stored;
+    for (size_t index = 0; index < values.size(); ++index) {
+        stored.push_back(arena.store(values[index]));
+    }
+    for (size_t index = 0; index < values.size(); ++index) {
+        EXPECT_EQ(values[index], stored[index]);
+    }
+    const size_t capacity = arena.capacity();
+    EXPECT_LE(64u, capacity);
+
+    // Storing the same strings again, after a reset, needs no more memory.
+    for (int pass = 0; pass < 3; ++pass) {
+        arena.reset();
+        for (size_t index = 0; index < values.size(); ++index) {
+            EXPECT_EQ(stored[index], arena.store(values[index]));
+        }
+        EXPECT_EQ(capacity, arena.capacity());
+    }
+}
@@ -0,0 +1,157 @@
+//               Copyright Paul Colby 2018.
+// Distributed under the Boost Software License, Version 1.0.
+//       (See accompanying file LICENSE.md or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include "pcp-cpp/typed_indom.hpp"
+
+#include "fake_libpcp-pmda.h"
+
+#include "gtest/gtest.h"
+
+// PM_ERR_FAULT ("QA fault injected") was not added until PCP 3.6.0.
+#ifndef PM_ERR_FAULT
+#define PM_ERR_FAULT PM_ERR_GENERIC
+#endif
+
+/// @brief Counts its live instances.
+struct counted {
+    static int live;
+    int value;
+    counted() : value(0) { ++live; }
+    ~counted() { --live; }
+};
+
+int counted::live = 0;
+
+TEST(typed_indom, constructor) {
+    const pcp::cache::typed_indom<counted> indom(12, 4);
+    EXPECT_EQ(pcp::domain_id_type(12), indom.get_domain_id());
+    EXPECT_EQ(PM_INDOM_NULL, static_cast<pmInDom>(indom));
+    EXPECT_TRUE(indom.uses_pmda_cache());
+    EXPECT_EQ(size_t(0), indom.size());
+    EXPECT_EQ(size_t(0), indom.capacity());
+}
+
+TEST(typed_indom, store) {
+    {
+        const fake_pmda_cache cache(400);
+        pcp::cache::typed_indom<counted> indom(1, 4);
+        indom.set_pm_instance_domain(400);
+        counted &first = indom.store("first");
+        EXPECT_EQ(0, first.value);
+        EXPECT_EQ(1, counted::live);
+        EXPECT_EQ(size_t(1), indom.size());
+        EXPECT_EQ(size_t(4), indom.capacity());
+        EXPECT_TRUE(indom.contains(0));
+
+        // Storing again returns the same object.
+        first.value = 1;
+        EXPECT_EQ(&first, &indom.store("first"));
+        EXPECT_EQ(1, counted::live);
+
+        const char buffer[] = "second";
+        counted &second = indom.store(pcp::cache::string_ref(buffer, 6));
+        EXPECT_NE(&first, &second);
+        EXPECT_EQ(2, counted::live);
+        EXPECT_TRUE(indom.contains(1));
+
+        // Allocated a slab at a time.
+        indom.store("third");
+        indom.store("fourth");
+        indom.store("fifth");
+        EXPECT_EQ(size_t(5), indom.size());
+        EXPECT_EQ(size_t(8), indom.capacity());
+
+        // Errors are thrown, without leaking objects.
+        indom.set_pm_instance_domain(PM_ERR_FAULT);
+        EXPECT_THROW(indom.store("error"), pcp::exception);
+        EXPECT_EQ(size_t(5), indom.size());
+        EXPECT_EQ(5, counted::live);
+    }
+    EXPECT_EQ(0, counted::live); // Destroyed with the indom.
+}
+
+TEST(typed_indom, reactivate) {
+    const fake_pmda_cache cache(401);
+    pcp::cache::typed_indom<counted> indom(1, 4);
+    indom.set_pm_instance_domain(401);
+    counted &first = indom.store("first");
+    first.value = 123;
+    indom.store("second");
+
+    // Instances that come back get their previous objects back.
+    indom.inactivate_all();
+    EXPECT_FALSE(indom.contains(0));
+    EXPECT_EQ(static_cast<counted *>(NULL), indom.find("first"));
+    EXPECT_EQ(&first, indom.find("first", pcp::cache::lookup_flags(0)));
+    counted &again = indom.store("first");
+    EXPECT_EQ(&first, &again);
+    EXPECT_EQ(123, again.value);
+    EXPECT_TRUE(indom.contains(0));
+    EXPECT_FALSE(indom.contains(1));
+    EXPECT_EQ(size_t(2), indom.size());
+    EXPECT_EQ(2, counted::live);
+
+    indom.hide("first");
+    EXPECT_FALSE(indom.contains(0));
+    EXPECT_EQ(&first, &indom.store("first"));
+    EXPECT_TRUE(indom.contains(0));
+}
+
+TEST(typed_indom, purge) {
+    const fake_pmda_cache cache(402);
+    pcp::cache::typed_indom<counted> indom(1, 2);
+    indom.set_pm_instance_domain(402);
+    indom.store("first");
+    indom.store("second");
+    indom.store("third");
+    EXPECT_EQ(size_t(3), indom.size());
+
+    // Recently stored instances are not purged.
+    EXPECT_EQ(size_t(0), indom.purge(5));
+    EXPECT_EQ(size_t(3), indom.size());
+
+    // Nor are long-lived active instances that are stored again.
+    fake_pmda_cache::advance_clock(10);
+    counted &first = indom.store("first");
+    first.value = 123;
+    indom.store("second");
+    indom.store("third");
+    EXPECT_EQ(size_t(0), indom.purge(5));
+    EXPECT_EQ(&first, indom.find("first"));
+    EXPECT_EQ(123, first.value);
+
+    // Purged objects are destroyed, and their slots reused.
+    fake_pmda_cache::advance_clock(10);
+    indom.inactivate_all();
+    indom.store("second");
+    EXPECT_EQ(size_t(2), indom.purge(5));
+    EXPECT_EQ(size_t(1), indom.size());
+    EXPECT_EQ(1, counted::live);
+    EXPECT_TRUE(indom.contains(1));
+    EXPECT_EQ(size_t(4), indom.capacity());
+    indom.store("fourth"); // Reusing all four slots, without another slab.
+    indom.store("fifth");
+    indom.store("sixth");
+    EXPECT_EQ(size_t(4), indom.capacity());
+    EXPECT_EQ(4, counted::live);
+}
+
+TEST(typed_indom, find) {
+    const fake_pmda_cache cache(403);
+    pcp::cache::typed_indom<counted> indom(1);
+    indom.set_pm_instance_domain(403);
+    counted &first = indom.store("first");
+    EXPECT_EQ(&first, indom.find(0));
+    EXPECT_EQ(&first, indom.find("first"));
+    const char buffer[] = "first second";
+    EXPECT_EQ(&first, indom.find(pcp::cache::string_ref(buffer, 5)));
+    EXPECT_EQ(static_cast<counted *>(NULL), indom.find(pcp::cache::string_ref(buffer + 6, 6)));
+    EXPECT_EQ(static_cast<counted *>(NULL), indom.find(1));
+
+    // Errors are not found, rather than thrown.
+    indom.set_pm_instance_domain(PM_ERR_FAULT);
+    EXPECT_EQ(static_cast<counted *>(NULL), indom.find(123));
+    EXPECT_EQ(static_cast<counted *>(NULL), indom.find("foo"));
+}
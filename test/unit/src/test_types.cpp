@@ -49,3 +49,24 @@ TEST(types, pm_types) {
     EXPECT_EQ(PM_TYPE_STRING, pcp::type<char *>());
     EXPECT_EQ(PM_TYPE_STRING, pcp::type<std::string>());
 }
+
+TEST(types, atom_type_of) {
+    // Compile-time constants, so usable as array sizes.
+    char u64[pcp::atom_type_of<uint64_t>::value];
+    EXPECT_EQ(static_cast<size_t>(PM_TYPE_U64), sizeof(u64));
+
+    EXPECT_EQ(PM_TYPE_32,  static_cast<int>(pcp::atom_type_of<int8_t>::value));
+    EXPECT_EQ(PM_TYPE_32,  static_cast<int>(pcp::atom_type_of<int16_t>::value));
+    EXPECT_EQ(PM_TYPE_32,  static_cast<int>(pcp::atom_type_of<int32_t>::value));
+    EXPECT_EQ(PM_TYPE_64,  static_cast<int>(pcp::atom_type_of<int64_t>::value));
+    EXPECT_EQ(PM_TYPE_U32, static_cast<int>(pcp::atom_type_of<uint8_t>::value));
+    EXPECT_EQ(PM_TYPE_U32, static_cast<int>(pcp::atom_type_of<uint16_t>::value));
+    EXPECT_EQ(PM_TYPE_U32, static_cast<int>(pcp::atom_type_of<uint32_t>::value));
+    EXPECT_EQ(PM_TYPE_U64, static_cast<int>(pcp::atom_type_of<uint64_t>::value));
+
+    EXPECT_EQ(PM_TYPE_FLOAT,  static_cast<int>(pcp::atom_type_of<float>::value));
+    EXPECT_EQ(PM_TYPE_DOUBLE, static_cast<int>(pcp::atom_type_of<double>::value));
+
+    EXPECT_EQ(PM_TYPE_STRING, static_cast<int>(pcp::atom_type_of<char *>::value));
+    EXPECT_EQ(PM_TYPE_STRING, static_cast<int>(pcp::atom_type_of<std::string>::value));
+}
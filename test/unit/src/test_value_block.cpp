@@ -0,0 +1,120 @@
+//               Copyright Paul Colby 2018.
+// Distributed under the Boost Software License, Version 1.0.
+//       (See accompanying file LICENSE.md or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include "pcp-cpp/value_block.hpp"
+
+#include "gtest/gtest.h"
+
+#include <string>
+#include <vector>
+
+TEST(value_block_pool, store) {
+    pcp::value_block_pool pool(64);
+    EXPECT_EQ(0u, pool.capacity());
+
+    const pmValueBlock * const first = pool.store("first", 5);
+    EXPECT_EQ(PM_TYPE_AGGREGATE, static_cast<int>(first->vtype));
+    EXPECT_EQ(PM_VAL_HDR_SIZE + 5u, static_cast<unsigned int>(first->vlen));
+    EXPECT_EQ(std::string("first"), std::string(first->vbuf, 5));
+
+    const pmValueBlock * const second = pool.store("", 0, PM_TYPE_AGGREGATE_STATIC);
+    EXPECT_EQ(PM_TYPE_AGGREGATE_STATIC, static_cast<int>(second->vtype));
+    EXPECT_EQ(static_cast<unsigned int>(PM_VAL_HDR_SIZE), static_cast<unsigned int>(second->vlen));
+    EXPECT_EQ(0u, reinterpret_cast<size_t>(second) % sizeof(void *));
+
+    // Blocks larger than the chunk size get chunks of their own.
+    const std::string large(100, 'x');
+    const pmValueBlock * const third = pool.store(large.data(), large.size());
+    EXPECT_EQ(large, std::string(third->vbuf, large.size()));
+
+    // Earlier blocks are not moved by later ones.
+    EXPECT_EQ(std::string("first"), std::string(first->vbuf, 5));
+}
+
+TEST(value_block_pool, incremental) {
+    pcp::value_block_pool pool(32);
+    pool.store("before", 6);
+
+    // Grow a block well beyond the chunk size, a few bytes at a time.
+    pool.begin();
+    std::string expected;
+    for (int index = 0; index < 50; ++index) {
+        const char value = static_cast<char>('a' + (index % 26));
+        if (index % 2) {
+            pool.append(&value, 1);
+        } else {
+            *static_cast<char *>(pool.extend(1)) = value;
+        }
+        expected += value;
+    }
+    const pmValueBlock * const block = pool.finish();
+    EXPECT_EQ(PM_VAL_HDR_SIZE + expected.size(), static_cast<size_t>(block->vlen));
+    EXPECT_EQ(expected, std::string(block->vbuf, expected.size()));
+
+    // Blocks larger than PM_VAL_VLEN_MAX are rejected.
+    pool.begin();
+    EXPECT_THROW(pool.extend(PM_VAL_VLEN_MAX), pcp::exception);
+}
+
+TEST(value_block_pool, reset_reuses_memory) {
+    pcp::value_block_pool pool(128);
+    size_t capacity = 0;
+    for (int round = 0; round < 3; ++round) {
+        std::vector<const pmValueBlock *> blocks;
+        for (int index = 0; index < 100; ++index) {
+            const std::string value(index % 40, static_cast<char>('a' + (index % 26)));
+            blocks.push_back(pool.store(value.data(), value.size()));
+        }
+        for (int index = 0; index < 100; ++index) {
+            const std::string value(index % 40, static_cast<char>('a' + (index % 26)));
+            EXPECT_EQ(value, std::string(blocks[index]->vbuf, value.size()));
+        }
+        if (round == 0) {
+            capacity = pool.capacity();
+        } else {
+            EXPECT_EQ(capacity, pool.capacity());
+        }
+        pool.reset();
+    }
+}
+
+TEST(event_array, records) {
+    pcp::event_array events;
+    const pmEventArray * const array = reinterpret_cast<pmEventArray *>(events.get());
+    EXPECT_EQ(0, array->ea_nrecords);
+
+    // Parameters must follow a record.
+    EXPECT_THROW(events.add_parameter(123, PM_TYPE_U32, 1u), pcp::exception);
+
+    struct timeval timestamp = { 1, 2 };
+    events.add_record(timestamp);
+    events.add_parameter(123, PM_TYPE_U32, 1u);
+    char value[] = "value";
+    events.add_parameter(124, PM_TYPE_STRING, value);
+    events.add_missed_records(timestamp, 10);
+    EXPECT_EQ(2, array->ea_nrecords);
+
+    events.reset();
+    EXPECT_EQ(0, array->ea_nrecords);
+}
+
+#ifdef PM_TYPE_HIGHRES_EVENT
+TEST(highres_event_array, records) {
+    pcp::highres_event_array events;
+    const pmHighResEventArray * const array = reinterpret_cast<pmHighResEventArray *>(events.get());
+    EXPECT_EQ(0, array->ea_nrecords);
+
+    EXPECT_THROW(events.add_parameter(123, PM_TYPE_U64, 1ull), pcp::exception);
+
+    struct timespec timestamp = { 1, 2 };
+    events.add_record(timestamp);
+    events.add_parameter(123, PM_TYPE_U64, 1ull);
+    events.add_missed_records(timestamp, 10);
+    EXPECT_EQ(2, array->ea_nrecords);
+
+    events.reset();
+    EXPECT_EQ(0, array->ea_nrecords);
+}
+#endif